@@ -1,5 +1,6 @@
 #include "App.h"
 #include "Raytracer.h"
+#include "Jobs.h"
 
 #include <GLFW/glfw3.h>
 #include <ImPlot.h>
@@ -25,8 +26,6 @@ namespace App
 	GLFWwindow* window { nullptr };
 	AppDesc app_desc;
 
-	uint32_t* render_buffer { nullptr };
-
 	Timer fps_timer;
 	float last_render_time { 1.0f };
 	float last_update_time { 1.0f };
@@ -34,9 +33,6 @@ namespace App
 	int init(AppDesc& desc)
 	{
 		app_desc = desc;
-		delete[] render_buffer;
-		render_buffer = new uint32_t[app_desc.width * app_desc.height];
-		memset(render_buffer, 0, app_desc.width * app_desc.height * sizeof(uint32_t));
 
 		if (!glfwInit())
 			return -1;
@@ -88,8 +84,8 @@ namespace App
 		RaytracerInitDesc raytracer_desc;
 		raytracer_desc.width_px = desc.width;
 		raytracer_desc.height_px = desc.height;
-		raytracer_desc.screen_buffer_ptr = render_buffer;
 		
+		Jobs::init();
 		Raytracer::init(raytracer_desc);
 
 		while (!glfwWindowShouldClose(window))
@@ -98,6 +94,7 @@ namespace App
 		}
 
 		Raytracer::terminate();
+		Jobs::terminate();
 
 		glfwTerminate();
 		return 0;
@@ -131,18 +128,25 @@ namespace App
 		Raytracer::update(last_update_time + last_render_time);
 		glfwSetInputMode(window, GLFW_CURSOR, Raytracer::ui_is_visible() ? GLFW_CURSOR_NORMAL : GLFW_CURSOR_DISABLED);
 
-		// Only get the render time
 		last_update_time =  fps_timer.lap_delta();
+
+		// Queues this frame on the device, the previous one gets presented while it renders
 		Raytracer::raytrace();
-		last_render_time = fps_timer.lap_delta();
 
 		Raytracer::ui();
 
-		// Flipping the buffer so its proper
-		glRasterPos2f(-1,1);
-		glPixelZoom( 1, -1 );
-		glDrawPixels(app_desc.width, app_desc.height, GL_RGBA, GL_UNSIGNED_BYTE, render_buffer);
+		const u32* presented_frame = Raytracer::acquire_frame();
+		last_render_time = fps_timer.lap_delta();
+
+		if(presented_frame != nullptr)
+		{
+			// Flipping the buffer so its proper
+			glRasterPos2f(-1,1);
+			glPixelZoom( 1, -1 );
+			glDrawPixels(app_desc.width, app_desc.height, GL_RGBA, GL_UNSIGNED_BYTE, presented_frame);
+		}
 
+		Log::flush_notifications();
 		ImGuiNotify::RenderNotifications();
 
 		ImGui::Render();
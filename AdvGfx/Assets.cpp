@@ -1,8 +1,15 @@
 #include "Assets.h"
 
 #include "BVH.h"
+#include "GLTF.h"
+#include "Jobs.h"
+#include "MeshFile.h"
+#include "TextureCompression.h"
+#include "TextureFile.h"
+#include "TextureStreaming.h"
 
 #include <stb_image.h>
+#include <unordered_set>
 
 #define TINYEXR_IMPLEMENTATION
 #define TINYEXR_USE_MINIZ 0
@@ -10,45 +17,567 @@
 #define TINYEXR_USE_THREAD 1
 #include "tinyexr.h"
 
+// The bake of a texture, mapped from disk or kept in memory if it couldn't be written. Stays alive for streaming
+struct LoadedTexture
+{
+	MappedTextureFile mapped;
+	std::vector<u8> baked;
+	TextureFileView view;
+};
+
+// Either a mapped bake, or the model built from its source if baking failed
+struct LoadedModel
+{
+	MappedMeshFile mapped;
+	std::unique_ptr<Model> built;
+	std::vector<MeshView> meshes;
+	std::span<const ModelInstance> instances;
+};
+
+// A file referenced by name, the heavy part of its import runs on a worker
+struct PendingImport
+{
+	std::string file_name;
+	std::filesystem::path path;
+	Timer timer;
+	std::future<std::unique_ptr<LoadedModel>> model;
+	std::future<std::unique_ptr<LoadedTexture>> texture;
+	std::future<EXR_CPU> exr;
+};
+
 struct
 {
 
 	// GPU Data Headers
 	std::vector<MeshHeader> mesh_headers {};
 	std::vector<TextureHeader> texture_headers {};
+	std::vector<std::unique_ptr<LoadedTexture>> textures {};
 
 	// CPU Data
 	std::unordered_map<std::string, EXR_CPU> exrs_cpu {};
-	std::unordered_map<std::string, Mesh> meshes_cpu;
+	std::vector<std::string> mesh_names {};
+	std::vector<std::string> texture_names {};
+	std::map<std::string, std::vector<ModelInstance>> models {};
+
+	// By stable name, meshes after the file they come from and textures after their file
+	std::unordered_map<std::string, u32> mesh_idxs {};
+	std::unordered_map<std::string, u32> texture_idxs {};
 
+	bool indexed_geometry { true };
+	bool compact_vertex_data { true };
+	bool compress_textures { true };
+
+	// Staged since the last commit, then released. The device buffers hold the only copy of committed geometry.
+	// Only one of the geometry layouts is filled
 	std::vector<Tri> consolidated_tris {};
+	std::vector<glm::vec4> consolidated_vertex_positions {};
+	std::vector<TriIndices> consolidated_tri_indices {};
 	std::vector<VertexData> consolidated_vertex_data{};
+	std::vector<CompactVertexData> consolidated_compact_vertex_data {};
 	std::vector<BVHNode> consolidated_nodes {};
 	std::vector<u32> consolidated_tri_idxs {};
 
-	std::vector<u8> consolidated_textures {};
+	// Kept on the host for building the TLAS
+	std::vector<BVHNode> mesh_root_nodes {};
+
+	ComputeGrowableBuffer* tris_compute_buffer				{ nullptr };
+	ComputeGrowableBuffer* vertex_position_compute_buffer	{ nullptr };
+	ComputeGrowableBuffer* tri_indices_compute_buffer		{ nullptr };
+	ComputeGrowableBuffer* vertex_data_compute_buffer		{ nullptr };
+	ComputeGrowableBuffer* bvh_compute_buffer				{ nullptr };
+	ComputeGrowableBuffer* tri_idx_compute_buffer			{ nullptr };
 
-	ComputeWriteBuffer* tris_compute_buffer				{ nullptr };
-	ComputeWriteBuffer* vertex_data_compute_buffer		{ nullptr };
-	ComputeWriteBuffer* bvh_compute_buffer				{ nullptr };
-	ComputeWriteBuffer* tri_idx_compute_buffer			{ nullptr };
+	ComputeGrowableBuffer* mesh_header_compute_buffer		{ nullptr };
 
-	ComputeWriteBuffer* mesh_header_compute_buffer		{ nullptr };
+	ComputeGrowableBuffer* texture_header_compute_buffer	{ nullptr };
 
-	ComputeWriteBuffer* texture_compute_buffer			{ nullptr };
-	ComputeWriteBuffer* texture_header_compute_buffer	{ nullptr };
+	// Element counts already on the device, anything past them has been staged by an import
+	struct
+	{
+		usize tris { 0 };
+		usize vertex_positions { 0 };
+		usize tri_indices { 0 };
+		usize vertex_data { 0 };
+		usize nodes { 0 };
+		usize tri_idxs { 0 };
+		usize mesh_headers { 0 };
+		usize texture_headers { 0 };
+	} committed;
 
 	std::unordered_map<std::string, std::vector<DiskAsset>> disk_assets {};
 
+	// Every importable file under the assets directory by name with extension, and the ones imported so far
+	std::unordered_map<std::string, std::filesystem::path> disk_paths {};
+	std::unordered_set<std::string> imported_files {};
+	std::vector<PendingImport> pending_imports {};
+
 } internal;
 
-// Search for, and automatically import assets from disk 
+TextureFormat get_texture_format()
+{
+	return internal.compress_textures ? TextureFormat::BC1 : TextureFormat::RGBA8;
+}
+
+// 2x2 box filter per level, sizes round down so odd sizes drop their last row and column. Clamping only
+// covers sides that are already 1 texel wide
+void build_mip_chain(TextureLevels& texture)
+{
+	u32 width = texture.width;
+	u32 height = texture.height;
+
+	texture.level_offsets = { 0 };
+
+	while((width > 1 || height > 1) && texture.level_offsets.size() < MAX_TEXTURE_LEVELS)
+	{
+		u32 level_width = glm::max(width / 2, 1u);
+		u32 level_height = glm::max(height / 2, 1u);
+		u64 level_offset = texture.data.size();
+
+		texture.data.resize(level_offset + (usize)level_width * level_height * 4);
+
+		const u8* source = &texture.data[texture.level_offsets.back()];
+		u8* level = &texture.data[level_offset];
+
+		for(u32 y = 0; y < level_height; y++)
+		{
+			u32 y0 = glm::min(y * 2, height - 1);
+			u32 y1 = glm::min(y * 2 + 1, height - 1);
+
+			for(u32 x = 0; x < level_width; x++)
+			{
+				u32 x0 = glm::min(x * 2, width - 1);
+				u32 x1 = glm::min(x * 2 + 1, width - 1);
+
+				for(u32 c = 0; c < 4; c++)
+				{
+					u32 sum = source[(x0 + y0 * width) * 4 + c] + source[(x1 + y0 * width) * 4 + c]
+						+ source[(x0 + y1 * width) * 4 + c] + source[(x1 + y1 * width) * 4 + c];
+
+					level[(x + y * level_width) * 4 + c] = (u8)((sum + 2) / 4);
+				}
+			}
+		}
+
+		texture.level_offsets.push_back(level_offset);
+		width = level_width;
+		height = level_height;
+	}
+}
+
+// Encodes every level of an RGBA8 mip chain, alpha is not kept
+void compress_texture(TextureLevels& texture, TextureFormat format)
+{
+	std::vector<u8> compressed_levels;
+	std::vector<u64> compressed_level_offsets;
+
+	for(usize level = 0; level < texture.level_offsets.size(); level++)
+	{
+		u32 level_width = glm::max(texture.width >> level, 1u);
+		u32 level_height = glm::max(texture.height >> level, 1u);
+		u64 level_offset = compressed_levels.size();
+
+		compressed_levels.resize(level_offset + TextureCompression::get_compressed_byte_size(level_width, level_height));
+
+		const u8* rgba = &texture.data[texture.level_offsets[level]];
+
+		if(format == TextureFormat::BC4)
+			TextureCompression::compress_bc4(rgba, level_width, level_height, &compressed_levels[level_offset]);
+		else
+			TextureCompression::compress_bc1(rgba, level_width, level_height, &compressed_levels[level_offset]);
+
+		compressed_level_offsets.push_back(level_offset);
+	}
+
+	texture.format = format;
+	texture.data = std::move(compressed_levels);
+	texture.level_offsets = std::move(compressed_level_offsets);
+}
+
+// Decodes, filters and compresses the image, then bakes it into tiles
+bool bake_texture(const std::filesystem::path& path, LoadedTexture& loaded_texture)
+{
+	TextureLevels texture;
+	i32 width, height, channels;
+
+	u8* pixels = stbi_load(path.string().c_str(), &width, &height, &channels, 4);
+
+	if(pixels == nullptr)
+	{
+		LOGERROR(std::format("Failed to load texture {}: {}", path.string(), stbi_failure_reason()));
+		return false;
+	}
+
+	texture.width = (u32)width;
+	texture.height = (u32)height;
+
+	// A full chain adds a third on top of the base level
+	usize base_byte_size = (usize)width * height * 4;
+	texture.data.reserve(base_byte_size + base_byte_size / 3 + 4 * MAX_TEXTURE_LEVELS);
+	texture.data.assign(pixels, pixels + base_byte_size);
+
+	stbi_image_free(pixels);
+
+	build_mip_chain(texture);
+
+	if(internal.compress_textures)
+		compress_texture(texture, channels <= 2 ? TextureFormat::BC4 : TextureFormat::BC1);
+
+	LOGDEBUG(std::format("Loaded a texture with a size of {} x {}, {} channels, {} levels and {} bytes", width, height, channels, texture.level_offsets.size(), texture.data.size()));
+
+	std::string baked_path = TextureFile::get_baked_path(path.string());
+	loaded_texture.baked = TextureFile::bake(path.string(), texture);
+
+	if(TextureFile::write(baked_path, loaded_texture.baked) && loaded_texture.mapped.open(baked_path, path.string(), get_texture_format()))
+	{
+		loaded_texture.baked.clear();
+		loaded_texture.view = loaded_texture.mapped.view;
+		return true;
+	}
+
+	LOGDEFAULT(std::format("Could not write {}, keeping the texture in memory", baked_path));
+	return TextureFile::get_view(loaded_texture.baked.data(), loaded_texture.baked.size(), loaded_texture.view);
+}
+
+// Decoding and BVH builds are thread-safe, staging into the consolidated data is not and happens on the main thread
+std::unique_ptr<LoadedTexture> load_texture(const std::filesystem::path& path)
+{
+	auto loaded_texture = std::make_unique<LoadedTexture>();
+
+	if(loaded_texture->mapped.open(TextureFile::get_baked_path(path.string()), path.string(), get_texture_format()))
+	{
+		loaded_texture->view = loaded_texture->mapped.view;
+		return loaded_texture;
+	}
+
+	if(!bake_texture(path, *loaded_texture))
+		return nullptr;
+
+	return loaded_texture;
+}
+
+// Only the tiles of the coarsest level are uploaded right away, the rest is streamed in once the renderer asks for it
+void stage_texture(const std::string& file_name, std::unique_ptr<LoadedTexture> loaded_texture)
+{
+	if(loaded_texture == nullptr)
+		return;
+
+	const TextureFileHeader& file_header = *loaded_texture->view.header;
+
+	TextureHeader loaded_texture_header {};
+	loaded_texture_header.width = file_header.width;
+	loaded_texture_header.height = file_header.height;
+	loaded_texture_header.level_count = file_header.level_count;
+	loaded_texture_header.format = file_header.format;
+
+	u32 first_tile_idx = TextureStreaming::add_texture(loaded_texture->view);
+
+	for(u32 level = 0; level < loaded_texture_header.level_count; level++)
+		loaded_texture_header.level_tile_offsets[level] = first_tile_idx + file_header.level_tile_offsets[level];
+
+	internal.texture_idxs[file_name] = (u32)internal.texture_headers.size();
+	internal.texture_names.push_back(file_name);
+	internal.texture_headers.push_back(loaded_texture_header);
+	internal.textures.push_back(std::move(loaded_texture));
+}
+
+// Same mapping as get_exr_color in rt_trace, the lower hemisphere is folded over the corners
+glm::vec3 octahedral_to_direction(glm::vec2 uv)
+{
+	glm::vec2 octahedral = uv * 2.0f - 1.0f;
+	glm::vec3 direction = glm::vec3(octahedral.x, 1.0f - glm::abs(octahedral.x) - glm::abs(octahedral.y), octahedral.y);
+
+	f32 fold = glm::max(-direction.y, 0.0f);
+	direction.x += direction.x >= 0.0f ? -fold : fold;
+	direction.z += direction.z >= 0.0f ? -fold : fold;
+
+	return glm::normalize(direction);
+}
+
+// Bilinear, wrapping around in longitude
+glm::vec4 sample_lat_long(const f32* rgba, i32 width, i32 height, glm::vec3 direction)
+{
+	f32 u = (glm::atan(direction.z, direction.x) + glm::pi<f32>()) / glm::two_pi<f32>();
+	f32 v = glm::acos(glm::clamp(direction.y, -1.0f, 1.0f)) / glm::pi<f32>();
+
+	f32 texel_x = u * width - 0.5f;
+	f32 texel_y = glm::clamp(v * height - 0.5f, 0.0f, (f32)(height - 1));
+	f32 texel_x_floor = glm::floor(texel_x);
+	f32 texel_y_floor = glm::floor(texel_y);
+
+	i32 x0 = ((i32)texel_x_floor % width + width) % width;
+	i32 x1 = (x0 + 1) % width;
+	i32 y0 = (i32)texel_y_floor;
+	i32 y1 = glm::min(y0 + 1, height - 1);
+
+	auto texel = [&](i32 x, i32 y) { return glm::make_vec4(&rgba[((usize)x + (usize)y * width) * 4]); };
+
+	f32 hor_fract = texel_x - texel_x_floor;
+	f32 ver_fract = texel_y - texel_y_floor;
+
+	return glm::mix(glm::mix(texel(x0, y0), texel(x1, y0), hor_fract), glm::mix(texel(x0, y1), texel(x1, y1), hor_fract), ver_fract);
+}
+
+// Resampled into an octahedral map of about the same texel count, so lookups need no trigonometry. Half RGB (alpha premultiplied) is 6 instead of 16 bytes per texel
+EXR_CPU load_exr(const std::filesystem::path& path)
+{
+	EXR_CPU exr;
+	const char* err = nullptr;
+
+	f32* rgba = nullptr;
+	i32 width = 0;
+	i32 height = 0;
+
+	LoadEXR(&rgba, &width, &height, path.string().c_str(), &err);
+
+	if (err)
+	{
+		LOGERROR(err);
+		return exr;
+	}
+
+	i32 size = glm::max((i32)glm::round(glm::sqrt((f32)width * height)), 1);
+	exr.width = size;
+	exr.height = size;
+	exr.data.resize((usize)size * size * 3);
+
+	for(i32 y = 0; y < size; y++)
+	{
+		for(i32 x = 0; x < size; x++)
+		{
+			glm::vec3 direction = octahedral_to_direction((glm::vec2(x, y) + 0.5f) / (f32)size);
+			glm::vec4 color = sample_lat_long(rgba, width, height, direction);
+
+			u16* texel = &exr.data[((usize)x + (usize)y * size) * 3];
+			texel[0] = glm::packHalf1x16(color.r * color.a);
+			texel[1] = glm::packHalf1x16(color.g * color.a);
+			texel[2] = glm::packHalf1x16(color.b * color.a);
+		}
+	}
+
+	free(rgba);
+
+	LOGDEBUG(std::format("Loaded an exr with a size of {} x {}, baked to a {} x {} octahedral map", width, height, size, size));
+
+	return exr;
+}
+
+void stage_exr(const std::filesystem::path& path, EXR_CPU&& exr)
+{
+	std::string file_name_with_extension = path.string().substr(path.string().find_last_of("/\\") + 1);
+
+	internal.exrs_cpu[file_name_with_extension] = std::move(exr);
+}
+
+// Worst error the compact vertex format may introduce: degrees for normals, relative to the UV's magnitude for UVs
+const f32 COMPACT_NORMAL_ERROR_BOUND_DEGREES = 0.06f;
+const f32 COMPACT_UV_ERROR_BOUND = 1.0f / 1024.0f;
+
+// Meshes that break the bound still render, but the warning tells which one to check (e.g. UVs beyond half range).
+// Runs on the import job once per bake, whichever vertex layout is in use
+void check_compact_vertex_data(const MeshView& loaded_mesh)
+{
+	f32 min_normal_cos_error = 1.0f;
+	f32 max_uv_error = 0.0f;
+
+	for(const VertexData& vertex_data : loaded_mesh.vertex_data)
+	{
+		VertexData decoded = expand_vertex_data(compact_vertex_data(vertex_data));
+
+		if(glm::length(vertex_data.normal) > 0.0f)
+		{
+			f32 cos_error = glm::dot(glm::normalize(vertex_data.normal), decoded.normal);
+			min_normal_cos_error = glm::min(min_normal_cos_error, cos_error);
+		}
+
+		f32 uv_magnitude = glm::max(1.0f, glm::max(glm::abs(vertex_data.uv.x), glm::abs(vertex_data.uv.y)));
+		max_uv_error = glm::max(max_uv_error, glm::length(decoded.uv - vertex_data.uv) / uv_magnitude);
+	}
+
+	f32 max_normal_error_degrees = glm::degrees(glm::acos(glm::clamp(min_normal_cos_error, -1.0f, 1.0f)));
+
+	// NaN (from UVs out of half range) counts as over the bound
+	bool within_bounds = max_normal_error_degrees <= COMPACT_NORMAL_ERROR_BOUND_DEGREES && max_uv_error <= COMPACT_UV_ERROR_BOUND;
+
+	if(!within_bounds)
+		LOGDEFAULT(std::format("Compact vertex data of {} is off by up to {} degrees (normals) and {} (UVs)", loaded_mesh.name, max_normal_error_degrees, max_uv_error));
+}
+
+std::unique_ptr<LoadedModel> load_model(const std::string& path)
+{
+	auto loaded_model = std::make_unique<LoadedModel>();
+	std::string baked_path = MeshFile::get_baked_path(path);
+
+	if(loaded_model->mapped.open(baked_path, path))
+	{
+		loaded_model->meshes = loaded_model->mapped.meshes;
+		loaded_model->instances = loaded_model->mapped.instances;
+		return loaded_model;
+	}
+
+	// Parsed and built once, later runs map the bake instead
+	auto model = std::make_unique<Model>();
+
+	if(!GLTF::load(path, *model))
+		return loaded_model;
+
+	for(const Mesh& mesh : model->meshes)
+		check_compact_vertex_data(MeshFile::get_view(mesh));
+
+	if(MeshFile::write(baked_path, path, *model) && loaded_model->mapped.open(baked_path, path))
+	{
+		LOGDEBUG(std::format("Baked model {}", baked_path));
+
+		loaded_model->meshes = loaded_model->mapped.meshes;
+		loaded_model->instances = loaded_model->mapped.instances;
+		return loaded_model;
+	}
+
+	LOGDEFAULT(std::format("Could not bake model {}, using it as is", path));
+
+	loaded_model->built = std::move(model);
+
+	for(const Mesh& mesh : loaded_model->built->meshes)
+		loaded_model->meshes.push_back(MeshFile::get_view(mesh));
+
+	loaded_model->instances = loaded_model->built->instances;
+	return loaded_model;
+}
+
+usize get_staged_vertex_data_count()
+{
+	usize staged_count = internal.compact_vertex_data ? internal.consolidated_compact_vertex_data.size() : internal.consolidated_vertex_data.size();
+
+	return internal.committed.vertex_data + staged_count;
+}
+
+void stage_vertex_data(const VertexData& vertex_data)
+{
+	if(internal.compact_vertex_data)
+		internal.consolidated_compact_vertex_data.push_back(compact_vertex_data(vertex_data));
+	else
+		internal.consolidated_vertex_data.push_back(vertex_data);
+}
+
+// Copies straight out of the mapping, the arrays already have the device layout
+void stage_mesh(const MeshView& loaded_mesh)
+{
+	// Create Mesh header for compute
+	MeshHeader loaded_mesh_header;
+	loaded_mesh_header.tris_count      = (u32)loaded_mesh.tri_indices.size();
+	loaded_mesh_header.tri_idx_count   = (u32)loaded_mesh.tri_idxs.size();
+	loaded_mesh_header.bvh_node_count  = (u32)loaded_mesh.bvh_nodes.size();
+	loaded_mesh_header.vertex_data_offset = (u32)get_staged_vertex_data_count();
+
+	if(internal.indexed_geometry)
+	{
+		// Tris & Vertices: positions, normals & UVs
+		loaded_mesh_header.tris_offset = (u32)(internal.committed.tri_indices + internal.consolidated_tri_indices.size());
+		loaded_mesh_header.vertex_data_count = (u32)loaded_mesh.vertex_positions.size();
+
+		internal.consolidated_tri_indices.insert(internal.consolidated_tri_indices.end(), loaded_mesh.tri_indices.begin(), loaded_mesh.tri_indices.end());
+		internal.consolidated_vertex_positions.insert(internal.consolidated_vertex_positions.end(), loaded_mesh.vertex_positions.begin(), loaded_mesh.vertex_positions.end());
+
+		for(const VertexData& vertex_data : loaded_mesh.vertex_data)
+			stage_vertex_data(vertex_data);
+	}
+	else
+	{
+		// Every corner expanded in place
+		loaded_mesh_header.tris_offset = (u32)(internal.committed.tris + internal.consolidated_tris.size());
+		loaded_mesh_header.vertex_data_count = loaded_mesh_header.tris_count * 3;
+
+		for(const TriIndices& tri_indices : loaded_mesh.tri_indices)
+		{
+			Tri& tri = internal.consolidated_tris.emplace_back();
+
+			for(u32 j = 0; j < 3; j++)
+			{
+				tri.vertices[j] = loaded_mesh.vertex_positions[tri_indices.vertex_idx[j]];
+				stage_vertex_data(loaded_mesh.vertex_data[tri_indices.vertex_idx[j]]);
+			}
+		}
+	}
+
+	// Tri Idx	
+	loaded_mesh_header.tri_idx_offset = (u32)(internal.committed.tri_idxs + internal.consolidated_tri_idxs.size());
+	internal.consolidated_tri_idxs.insert(internal.consolidated_tri_idxs.end(), loaded_mesh.tri_idxs.begin(), loaded_mesh.tri_idxs.end());
+
+	// BVH nodes
+	loaded_mesh_header.root_bvh_node_idx = (u32)(internal.committed.nodes + internal.consolidated_nodes.size());
+	internal.consolidated_nodes.insert(internal.consolidated_nodes.end(), loaded_mesh.bvh_nodes.begin(), loaded_mesh.bvh_nodes.end());
+	internal.mesh_root_nodes.push_back(loaded_mesh.bvh_nodes.empty() ? BVHNode() : loaded_mesh.bvh_nodes[0]);
+
+	internal.mesh_idxs[loaded_mesh.name] = (u32)internal.mesh_headers.size();
+	internal.mesh_headers.push_back(loaded_mesh_header);
+	internal.mesh_names.push_back(loaded_mesh.name);
+}
+
+// The model's instances are kept with global mesh indices, so World can spawn them as they are
+void stage_model(const std::string& file_name, const LoadedModel& loaded_model)
+{
+	if(loaded_model.meshes.empty())
+		return;
+
+	u32 first_mesh_idx = (u32)internal.mesh_headers.size();
+
+	for(const MeshView& mesh : loaded_model.meshes)
+		stage_mesh(mesh);
+
+	auto& model_instances = internal.models[file_name];
+	model_instances.clear();
+
+	for(ModelInstance instance : loaded_model.instances)
+	{
+		instance.mesh_idx += first_mesh_idx;
+		model_instances.push_back(instance);
+	}
+}
+
+template<typename T>
+bool is_ready(const std::future<T>& result)
+{
+	return result.valid() && result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+bool is_finished(const PendingImport& pending_import)
+{
+	return is_ready(pending_import.model) || is_ready(pending_import.texture) || is_ready(pending_import.exr);
+}
+
+// Blocks if the worker isn't done yet
+void stage_import(PendingImport& pending_import)
+{
+	if(pending_import.model.valid())
+	{
+		stage_model(pending_import.file_name, *pending_import.model.get());
+	}
+	else if(pending_import.texture.valid())
+	{
+		stage_texture(pending_import.file_name, pending_import.texture.get());
+	}
+	else if(pending_import.exr.valid())
+	{
+		stage_exr(pending_import.path, pending_import.exr.get());
+	}
+
+	LOGDEBUG(std::format("Imported {} in {} ms", pending_import.file_name, (u32)pending_import.timer.start_to_now()));
+}
+
+// Lists the assets directory and builds the kernels in it, everything else is only read once something references it
 void find_disk_assets()
 {
 	std::string assets_directory = get_current_directory_path() + "\\..\\..\\AdvGfx\\assets\\";
+
+	// Sorted, so the listings (and older scenes importing all of it) see the same order every run
+	std::vector<std::filesystem::path> asset_paths;
 	for (const auto & asset_path : std::filesystem::recursive_directory_iterator(assets_directory))
+		asset_paths.push_back(asset_path.path());
+
+	std::sort(asset_paths.begin(), asset_paths.end());
+
+	for (const auto & asset_path : asset_paths)
 	{
-		std::string file_path = asset_path.path().string();
+		std::string file_path = asset_path.string();
 		std::string file_name_with_extension = file_path.substr(file_path.find_last_of("/\\") + 1);
 		std::string file_extension = file_name_with_extension.substr(file_name_with_extension.find_last_of(".") + 1);
 		std::string file_name = file_name_with_extension.substr(0, file_name_with_extension.length() - file_extension.length() - 1);
@@ -83,20 +612,16 @@ void find_disk_assets()
 				break;
 			}
 			case hashstr("exr"):
-			{
-				Assets::import_exr(file_path);
-				break;
-			}
 			case hashstr("gltf"):
-			{
-				Assets::import_mesh(file_path);
-				break;
-			}
+			case hashstr("glb"):
 			case hashstr("png"):
 			case hashstr("jpg"):
 			case hashstr("jpeg"):
 			{
-				Assets::import_texture(file_path);
+				// Scenes reference files by name, so the first one found wins
+				if(!internal.disk_paths.emplace(file_name_with_extension, asset_path).second)
+					LOGDEFAULT(std::format("{} exists more than once in the assets directory, using {}", file_name_with_extension, internal.disk_paths[file_name_with_extension].string()));
+
 				break;
 			}
 		}
@@ -105,11 +630,80 @@ void find_disk_assets()
 	}
 }
 
-void Assets::init()
+void Assets::init(const AssetsInitDesc& desc)
 {
+	internal.indexed_geometry = desc.indexed_geometry;
+	internal.compact_vertex_data = desc.compact_vertex_data;
+	internal.compress_textures = desc.compress_textures;
+
+	TextureStreaming::init(desc.texture_pool_byte_size, TextureFile::get_tile_byte_size(get_texture_format()));
+
+	internal.tris_compute_buffer = new ComputeGrowableBuffer(ComputeMemoryCategory::Geometry);
+	internal.vertex_position_compute_buffer = new ComputeGrowableBuffer(ComputeMemoryCategory::Geometry);
+	internal.tri_indices_compute_buffer = new ComputeGrowableBuffer(ComputeMemoryCategory::Geometry);
+	internal.vertex_data_compute_buffer = new ComputeGrowableBuffer(ComputeMemoryCategory::Geometry);
+	internal.bvh_compute_buffer = new ComputeGrowableBuffer(ComputeMemoryCategory::Geometry);
+	internal.tri_idx_compute_buffer = new ComputeGrowableBuffer(ComputeMemoryCategory::Geometry);
+	internal.mesh_header_compute_buffer = new ComputeGrowableBuffer(ComputeMemoryCategory::Geometry);
+	internal.texture_header_compute_buffer = new ComputeGrowableBuffer(ComputeMemoryCategory::Textures);
+
 	find_disk_assets();
 }
 
+// Appends the staged elements to the device buffer and frees them, the host never needs committed geometry again
+template<typename T>
+void commit_and_release_staged(ComputeGrowableBuffer& buffer, std::vector<T>& staged, usize& committed_count)
+{
+	if(staged.empty())
+		return;
+
+	usize byte_offset = committed_count * sizeof(T);
+	usize staged_byte_size = staged.size() * sizeof(T);
+
+	// Blocking, so the staged data can go right after
+	buffer.resize(byte_offset + staged_byte_size);
+	buffer.update_range(staged.data(), byte_offset, staged_byte_size);
+
+	committed_count += staged.size();
+	std::vector<T>().swap(staged);
+}
+
+// Uploads what has been appended since the last commit
+template<typename T, typename Allocator>
+void commit_staged(ComputeGrowableBuffer& buffer, const std::vector<T, Allocator>& data, usize& committed_count)
+{
+	if(data.size() == committed_count)
+		return;
+
+	buffer.update(data, committed_count * sizeof(T));
+	committed_count = data.size();
+}
+
+void Assets::commit_imports()
+{
+	usize staged_mesh_count = internal.mesh_headers.size() - internal.committed.mesh_headers;
+	usize staged_texture_count = internal.texture_headers.size() - internal.committed.texture_headers;
+
+	if(staged_mesh_count == 0 && staged_texture_count == 0)
+		return;
+
+	commit_and_release_staged(*internal.tris_compute_buffer, internal.consolidated_tris, internal.committed.tris);
+	commit_and_release_staged(*internal.vertex_position_compute_buffer, internal.consolidated_vertex_positions, internal.committed.vertex_positions);
+	commit_and_release_staged(*internal.tri_indices_compute_buffer, internal.consolidated_tri_indices, internal.committed.tri_indices);
+
+	if(internal.compact_vertex_data)
+		commit_and_release_staged(*internal.vertex_data_compute_buffer, internal.consolidated_compact_vertex_data, internal.committed.vertex_data);
+	else
+		commit_and_release_staged(*internal.vertex_data_compute_buffer, internal.consolidated_vertex_data, internal.committed.vertex_data);
+
+	commit_and_release_staged(*internal.bvh_compute_buffer, internal.consolidated_nodes, internal.committed.nodes);
+	commit_and_release_staged(*internal.tri_idx_compute_buffer, internal.consolidated_tri_idxs, internal.committed.tri_idxs);
+	commit_staged(*internal.mesh_header_compute_buffer, internal.mesh_headers, internal.committed.mesh_headers);
+	commit_staged(*internal.texture_header_compute_buffer, internal.texture_headers, internal.committed.texture_headers);
+
+	LOGDEBUG(std::format("Committed {} meshes and {} textures to the device.", staged_mesh_count, staged_texture_count));
+}
+
 const std::vector<DiskAsset>& Assets::get_disk_files_by_extension(const std::string& extension)
 {
 	// TODO: Don't know if theres a better way to do this? (What i meant is an "empty reference")
@@ -124,115 +718,149 @@ const std::vector<DiskAsset>& Assets::get_disk_files_by_extension(const std::str
 	return assets_vector->second;
 }
 
-void Assets::import_mesh(const std::filesystem::path path)
+void Assets::request_files(const std::vector<std::string>& file_names)
 {
-	std::string file_name = path.filename().string();
-
-	internal.meshes_cpu.insert({
-		file_name, Mesh(path.string())
-	});
-
-	delete internal.tris_compute_buffer;
-	delete internal.vertex_data_compute_buffer;
-	delete internal.bvh_compute_buffer;
-	delete internal.tri_idx_compute_buffer;
-
-	Mesh& loaded_mesh = internal.meshes_cpu.find(file_name)->second;
+	for(const std::string& file_name : file_names)
+	{
+		if(internal.imported_files.contains(file_name))
+			continue;
 
-	// Create Mesh header for compute
-	MeshHeader loaded_mesh_header;
-	loaded_mesh_header.tris_count      = (u32)loaded_mesh.tris.size();
-	loaded_mesh_header.vertex_data_count   = (u32)loaded_mesh.vertex_data.size();
-	loaded_mesh_header.tri_idx_count   = (u32)loaded_mesh.bvh->primitive_idx.size();
-	loaded_mesh_header.bvh_node_count  = (u32)loaded_mesh.bvh->nodes.size();
+		// Marked either way, so whoever waits on a missing file finds it done (and not loaded) right away
+		internal.imported_files.insert(file_name);
 
-	// Tris
-	loaded_mesh_header.tris_offset = (u32)internal.consolidated_tris.size();
-	internal.consolidated_tris.reserve(loaded_mesh_header.tris_count);
-	internal.consolidated_tris.insert(internal.consolidated_tris.end(), loaded_mesh.tris.begin(), loaded_mesh.tris.end());
+		auto disk_path = internal.disk_paths.find(file_name);
 
-	// Vertex Data: Normals & UVs
-	loaded_mesh_header.vertex_data_offset = (u32)internal.consolidated_vertex_data.size();
-	internal.consolidated_vertex_data.reserve(loaded_mesh_header.vertex_data_count);
-	internal.consolidated_vertex_data.insert(internal.consolidated_vertex_data.end(), loaded_mesh.vertex_data.begin(), loaded_mesh.vertex_data.end());
+		if(disk_path == internal.disk_paths.end())
+		{
+			LOGERROR(std::format("Could not find {} in the assets directory", file_name));
+			continue;
+		}
 
-	// Tri Idx	
-	loaded_mesh_header.tri_idx_offset = (u32)internal.consolidated_tri_idxs.size();
-	internal.consolidated_tri_idxs.reserve(loaded_mesh_header.tri_idx_count);
-	internal.consolidated_tri_idxs.insert(internal.consolidated_tri_idxs.end(), loaded_mesh.bvh->primitive_idx.begin(), loaded_mesh.bvh->primitive_idx.end());
+		std::filesystem::path asset_path = disk_path->second;
+		std::string file_extension = file_name.substr(file_name.find_last_of(".") + 1);
 
-	// BVH nodes
-	loaded_mesh_header.root_bvh_node_idx = (u32)internal.consolidated_nodes.size();
-	internal.consolidated_nodes.reserve(loaded_mesh_header.bvh_node_count);
-	internal.consolidated_nodes.insert(internal.consolidated_nodes.end(), loaded_mesh.bvh->nodes.begin(), loaded_mesh.bvh->nodes.end());
+		PendingImport pending_import;
+		pending_import.file_name = file_name;
+		pending_import.path = asset_path;
+		pending_import.timer.start();
 
-	internal.mesh_headers.push_back(loaded_mesh_header);
-	internal.mesh_header_compute_buffer = new ComputeWriteBuffer({internal.mesh_headers});
+		switch(hashstr(file_extension.c_str()))
+		{
+			case hashstr("exr"):
+			{
+				pending_import.exr = Jobs::submit_with_result([asset_path]() { return load_exr(asset_path); });
+				break;
+			}
+			case hashstr("gltf"):
+			case hashstr("glb"):
+			{
+				pending_import.model = Jobs::submit_with_result([asset_path]() { return load_model(asset_path.string()); });
+				break;
+			}
+			case hashstr("png"):
+			case hashstr("jpg"):
+			case hashstr("jpeg"):
+			{
+				pending_import.texture = Jobs::submit_with_result([asset_path]() { return load_texture(asset_path); });
+				break;
+			}
+		}
 
-	internal.tris_compute_buffer	= new ComputeWriteBuffer({internal.consolidated_tris});
-	internal.vertex_data_compute_buffer	= new ComputeWriteBuffer({internal.consolidated_vertex_data });
-	internal.bvh_compute_buffer		= new ComputeWriteBuffer({internal.consolidated_nodes});
-	internal.tri_idx_compute_buffer	= new ComputeWriteBuffer({internal.consolidated_tri_idxs});
+		internal.pending_imports.push_back(std::move(pending_import));
+	}
 }
 
-void Assets::import_texture(const std::filesystem::path path)
+bool Assets::update_imports()
 {
-	delete internal.texture_compute_buffer;
-	delete internal.texture_header_compute_buffer;
+	usize staged_count = 0;
+
+	for(auto pending_import = internal.pending_imports.begin(); pending_import != internal.pending_imports.end();)
+	{
+		if(!is_finished(*pending_import))
+		{
+			pending_import++;
+			continue;
+		}
+
+		stage_import(*pending_import);
+		pending_import = internal.pending_imports.erase(pending_import);
+		staged_count++;
+	}
 
-	i32 channels;
-	i32 width;
-	i32 height;
+	commit_imports();
 
-	u8* data { nullptr } ;
+	return staged_count > 0;
+}
 
-	data = stbi_load(path.string().c_str(), &width, &height, &channels, 4);
+void Assets::import_files(const std::vector<std::string>& file_names)
+{
+	request_files(file_names);
 
-	LOGDEBUG(std::format("Loaded a texture with a size of {} x {} and {} channels", width, height, channels));
+	// In the order they were requested, so the offsets don't depend on which worker finished first
+	for(PendingImport& pending_import : internal.pending_imports)
+		stage_import(pending_import);
 
-	std::vector<u8> pixels(data, data + width * height * 4);
+	internal.pending_imports.clear();
+}
 
-	TextureHeader loaded_texture_header;
-	loaded_texture_header.width = (u32)width;
-	loaded_texture_header.height = (u32)height;
-	loaded_texture_header.start_offset = (u32)internal.consolidated_textures.size();
+bool Assets::is_import_pending(const std::string& file_name)
+{
+	for(const PendingImport& pending_import : internal.pending_imports)
+	{
+		if(pending_import.file_name == file_name)
+			return true;
+	}
 
-	internal.consolidated_textures.reserve(width * height);
-	internal.consolidated_textures.insert(internal.consolidated_textures.end(), pixels.begin(), pixels.end());
-	internal.texture_compute_buffer	= new ComputeWriteBuffer({internal.consolidated_textures});
+	return false;
+}
 
-	internal.texture_headers.push_back(loaded_texture_header);
+std::vector<std::string> Assets::get_pending_imports()
+{
+	std::vector<std::string> file_names;
 
-	internal.texture_header_compute_buffer = new ComputeWriteBuffer({internal.texture_headers});
+	for(const PendingImport& pending_import : internal.pending_imports)
+		file_names.push_back(pending_import.file_name);
 
-	delete data;
+	return file_names;
 }
 
-void Assets::import_exr(const std::filesystem::path path)
+void Assets::import_all_files()
 {
-	std::string file_name_with_extension = path.string().substr(path.string().find_last_of("/\\") + 1);
+	std::vector<std::filesystem::path> asset_paths;
+	for(const auto& [file_name, path] : internal.disk_paths)
+		asset_paths.push_back(path);
 
-	auto& exr_entry = internal.exrs_cpu.insert({ file_name_with_extension, EXR_CPU() }).first->second;	
+	std::sort(asset_paths.begin(), asset_paths.end());
 
-	const char* err = nullptr;
+	std::vector<std::string> file_names;
+	for(const auto& path : asset_paths)
+		file_names.push_back(path.filename().string());
 
-	delete[] exr_entry.data;
-	LoadEXR(&exr_entry.data, &exr_entry.width, &exr_entry.height, path.string().c_str(), &err);
+	import_files(file_names);
+}
 
-	LOGDEBUG(std::format("Loaded an exr with a size of {} x {}", exr_entry.width, exr_entry.height));
+std::string Assets::get_file_name_of_mesh(const std::string& mesh_name)
+{
+	// Meshes are named after their file, plus #mesh.primitive if the file has several
+	return mesh_name.substr(0, mesh_name.find('#'));
+}
 
-	if (err)
-		LOGERROR(err);
+i32 Assets::get_mesh_idx(const std::string& mesh_name)
+{
+	auto mesh_idx = internal.mesh_idxs.find(mesh_name);
+	return mesh_idx == internal.mesh_idxs.end() ? -1 : (i32)mesh_idx->second;
 }
 
-const EXR_CPU& Assets::get_exr_by_name(const std::string& name_with_extension)
+i32 Assets::get_texture_idx(const std::string& file_name)
 {
-	return internal.exrs_cpu.find(name_with_extension)->second;
+	auto texture_idx = internal.texture_idxs.find(file_name);
+	return texture_idx == internal.texture_idxs.end() ? -1 : (i32)texture_idx->second;
 }
 
-const EXR_CPU& Assets::get_exr_by_index(u32 index)
+const EXR_CPU* Assets::get_exr(const std::string& file_name)
 {
-	return std::next(internal.exrs_cpu.begin(), index)->second;
+	auto exr = internal.exrs_cpu.find(file_name);
+	return exr == internal.exrs_cpu.end() ? nullptr : &exr->second;
 }
 
 u32 Assets::get_texture_count()
@@ -240,62 +868,105 @@ u32 Assets::get_texture_count()
 	return (u32)internal.texture_headers.size();
 }
 
-void Assets::reconstruct_bvh(std::string mesh)
+const std::string& Assets::get_texture_name(u32 idx)
+{
+	return internal.texture_names[idx];
+}
+
+bool Assets::uses_indexed_geometry()
 {
-	internal.meshes_cpu.find(mesh)->second.reconstruct_bvh();
+	return internal.indexed_geometry;
+}
+
+bool Assets::uses_compact_vertex_data()
+{
+	return internal.compact_vertex_data;
 }
 
 // TODO: This is disgusting, find a better way
-ComputeWriteBuffer& Assets::get_tris_compute_buffer()
+ComputeGrowableBuffer& Assets::get_tris_compute_buffer()
 {
 	return *internal.tris_compute_buffer;
 }
 
-ComputeWriteBuffer& Assets::get_vertex_data_compute_buffer()
+ComputeGrowableBuffer& Assets::get_vertex_position_compute_buffer()
+{
+	return *internal.vertex_position_compute_buffer;
+}
+
+ComputeGrowableBuffer& Assets::get_tri_indices_compute_buffer()
+{
+	return *internal.tri_indices_compute_buffer;
+}
+
+ComputeGrowableBuffer& Assets::get_vertex_data_compute_buffer()
 {
 	return *internal.vertex_data_compute_buffer;
 }
 
-ComputeWriteBuffer& Assets::get_bvh_compute_buffer()
+ComputeGrowableBuffer& Assets::get_bvh_compute_buffer()
 {
 	return *internal.bvh_compute_buffer;
 }
 
-ComputeWriteBuffer& Assets::get_tri_idx_compute_buffer()
+ComputeGrowableBuffer& Assets::get_tri_idx_compute_buffer()
 {
 	return *internal.tri_idx_compute_buffer;
 }
 
-ComputeWriteBuffer& Assets::get_mesh_header_buffer()
+ComputeGrowableBuffer& Assets::get_mesh_header_buffer()
 {
 	return *internal.mesh_header_compute_buffer;
 }
 
-ComputeWriteBuffer& Assets::get_texture_compute_buffer()
+ComputeGrowableBuffer& Assets::get_texture_compute_buffer()
 {
-	return *internal.texture_compute_buffer;
+	return TextureStreaming::get_tile_pool_buffer();
 }
 
-ComputeWriteBuffer& Assets::get_texture_header_buffer()
+ComputeGrowableBuffer& Assets::get_texture_tile_table_buffer()
+{
+	return TextureStreaming::get_tile_table_buffer();
+}
+
+ComputeReadWriteBuffer& Assets::get_texture_feedback_buffer()
+{
+	return TextureStreaming::get_feedback_buffer();
+}
+
+bool Assets::update_texture_streaming(u32 frame_number)
+{
+	return TextureStreaming::update(frame_number);
+}
+
+ComputeGrowableBuffer& Assets::get_texture_header_buffer()
 {
 	return *internal.texture_header_compute_buffer;
 }
 
-const std::vector<MeshHeader>& Assets::get_mesh_headers()
+u32 Assets::get_mesh_count()
 {
-	return internal.mesh_headers;
+	return (u32)internal.mesh_headers.size();
 }
 
-const std::unordered_map<std::string, Mesh>& Assets::get_meshes()
+const std::string& Assets::get_mesh_name(u32 idx)
 {
-	return internal.meshes_cpu;
+	return internal.mesh_names[idx];
 }
 
-BVHNode Assets::get_root_bvh_node_of_mesh(u32 idx)
+const std::map<std::string, std::vector<ModelInstance>>& Assets::get_models()
+{
+	return internal.models;
+}
+
+const std::vector<MeshHeader>& Assets::get_mesh_headers()
 {
-	auto mesh_header = internal.mesh_headers[idx];
+	return internal.mesh_headers;
+}
 
-	return internal.consolidated_nodes[mesh_header.root_bvh_node_idx];
+BVHNode Assets::get_root_bvh_node_of_mesh(u32 idx)
+{
+	return internal.mesh_root_nodes[idx];
 }
 
 const MeshHeader Assets::get_mesh_header(u32 idx)
@@ -3,13 +3,15 @@
 #include "Mesh.h"
 #include "BVH.h"
 
+// Indexed geometry: the triangles index into the mesh's unique vertices (positions and vertex data).
+// De-indexed geometry: every triangle has its own Tri, and three vertex data entries at 3x its index
 struct MeshHeader
 {
-	u32 tris_offset {};
+	u32 tris_offset {}; // Into the tris buffer, or the tri indices buffer when indexed
 	u32 tris_count {};
 
-	u32 vertex_data_offset {};
-	u32 vertex_data_count {}; // Is in theory always 3x tris_count
+	u32 vertex_data_offset {}; // Into the vertex data buffer, and the vertex positions buffer when indexed
+	u32 vertex_data_count {}; // 3x tris_count when de-indexed
 
 	u32 root_bvh_node_idx {};
 	u32 bvh_node_count {}; // Technically could be unnecessary
@@ -18,20 +20,33 @@ struct MeshHeader
 	u32 tri_idx_count {};
 };
 
+// Enough for a 32k texture down to 1x1
+const u32 MAX_TEXTURE_LEVELS = 16;
+
+// Same values as TEXTURE_FORMAT_* in rt_trace
+enum class TextureFormat : u32
+{
+	RGBA8,
+	BC1, // RGB, 8 bytes per 4x4 block
+	BC4  // Greyscale, 8 bytes per 4x4 block
+};
+
 struct TextureHeader	
 {
-	u32 start_offset;
 	u32 width;
 	u32 height;
-	u32 pad;
+	u32 level_count;
+	TextureFormat format;
+	u32 level_tile_offsets[MAX_TEXTURE_LEVELS]; // Into the tile table, each level half the size of the previous one (rounded down, at least 1)
 };
 
+// Environment map baked into a square octahedral map (y up), half precision RGB
 struct EXR_CPU
 {
 	std::string name { "" };
 	i32 width { 0 };
 	i32 height { 0 };
-	f32* data { nullptr };
+	std::vector<u16> data {};
 };
 
 struct DiskAsset
@@ -40,31 +55,77 @@ struct DiskAsset
 	std::string file_name;
 };
 
-namespace Assets
+struct AssetsInitDesc
 {
-	void init();
+	// De-indexed triangles skip an indirection when intersected, but take several times the memory
+	bool indexed_geometry { true };
+
+	// Octahedral normals and half precision UVs, 8 instead of 32 bytes per vertex
+	bool compact_vertex_data { true };
 
-	void import_mesh(const std::filesystem::path path);
-	void import_texture(const std::filesystem::path path);
-	void import_exr(const std::filesystem::path path);
+	// BC1 (BC4 for greyscale images) blocks instead of RGBA8, an eighth of the memory
+	bool compress_textures { true };
 
-	const EXR_CPU& get_exr_by_name(const std::string& name_with_extension);
-	const EXR_CPU& get_exr_by_index(u32 index);
+	// Device memory textures are streamed into, however many there are
+	u64 texture_pool_byte_size { 256ull * 1024 * 1024 };
+};
+
+namespace Assets
+{
+	void init(const AssetsInitDesc& desc);
+
+	// Nothing but kernels is loaded by init(), assets are imported once something references them by file name
+	// (with extension). Files already requested are skipped, the rest loads on the job workers
+	// A model (.gltf or .glb) adds one mesh per primitive
+	void request_files(const std::vector<std::string>& file_names);
+	// Call once per frame, stages the files that finished loading and uploads them. True if any did
+	bool update_imports();
+	// Blocks until the files (and anything requested before them) are staged, commit_imports() uploads them
+	void import_files(const std::vector<std::string>& file_names);
+	// Everything on disk, in the order scenes saved before assets were referenced by name indexed it
+	void import_all_files();
+	void commit_imports();
+
+	bool is_import_pending(const std::string& file_name);
+	std::vector<std::string> get_pending_imports();
+
+	// Stable across runs and changes to the assets directory, unlike the indices
+	std::string get_file_name_of_mesh(const std::string& mesh_name);
+
+	// -1 or nullptr until the file is imported, or if it couldn't be
+	i32 get_mesh_idx(const std::string& mesh_name);
+	i32 get_texture_idx(const std::string& file_name);
+	const EXR_CPU* get_exr(const std::string& file_name);
 
 	u32 get_texture_count();
+	const std::string& get_texture_name(u32 idx);
+
+	bool uses_indexed_geometry();
+	bool uses_compact_vertex_data();
+
+	ComputeGrowableBuffer& get_tris_compute_buffer();
+	ComputeGrowableBuffer& get_vertex_position_compute_buffer();
+	ComputeGrowableBuffer& get_tri_indices_compute_buffer();
+	ComputeGrowableBuffer& get_vertex_data_compute_buffer();
+	ComputeGrowableBuffer& get_bvh_compute_buffer();
+	ComputeGrowableBuffer& get_tri_idx_compute_buffer();
+	ComputeGrowableBuffer& get_mesh_header_buffer();
+	// Pool of resident texture tiles, the tile table maps every tile of every texture to its slot in the pool
+	ComputeGrowableBuffer& get_texture_compute_buffer();
+	ComputeGrowableBuffer& get_texture_header_buffer();
+	ComputeGrowableBuffer& get_texture_tile_table_buffer();
+	ComputeReadWriteBuffer& get_texture_feedback_buffer();
+
+	// Call once per frame before tracing, true if tiles became resident (and the image sharper)
+	bool update_texture_streaming(u32 frame_number);
 
-	void reconstruct_bvh(const std::string mesh);
+	u32 get_mesh_count();
+	const std::string& get_mesh_name(u32 idx);
 
-	ComputeWriteBuffer& get_tris_compute_buffer();
-	ComputeWriteBuffer& get_vertex_data_compute_buffer();
-	ComputeWriteBuffer& get_bvh_compute_buffer();
-	ComputeWriteBuffer& get_tri_idx_compute_buffer();
-	ComputeWriteBuffer& get_mesh_header_buffer();
-	ComputeWriteBuffer& get_texture_compute_buffer();
-	ComputeWriteBuffer& get_texture_header_buffer();
+	// Per model file, the node hierarchy as instances of the model's (global) mesh indices
+	const std::map<std::string, std::vector<ModelInstance>>& get_models();
 
 	const std::vector<MeshHeader>& get_mesh_headers();
-	const std::unordered_map<std::string, Mesh>& get_meshes();
 
 	const std::vector<DiskAsset>& get_disk_files_by_extension(const std::string& extension);
 
@@ -22,7 +22,7 @@ glm::vec3 aabb_centroid(AABB& aabb)
 }
 
 // Transforms the current 8 corners of an AABB, and gets their AABB
-void transform_aabb(AABB& aabb, glm::mat4& transform)
+void transform_aabb(AABB& aabb, const glm::mat4& transform)
 {
 	glm::vec4 corners[8] =
 	{
@@ -269,8 +269,16 @@ BVHConstructionPrimitiveAABBData::BVHConstructionPrimitiveAABBData(const std::ve
 
 void BuildTLAS(BVH& bvh)
 {
-	auto& world_data = World::get_world_device_data();
-	u32 instance_count = world_data.mesh_instance_count;
+	const auto& mesh_instances = World::get_mesh_instances();
+	u32 instance_count = (u32)mesh_instances.size();
+
+	// An empty world still hands kernels a root (that nothing hits) and a non-empty index buffer
+	if (instance_count == 0)
+	{
+		bvh.nodes = { BVHNode() };
+		bvh.primitive_idx = { 0 };
+		return;
+	}
 
 	std::vector<AABB> transformed_aabbs;	
 	std::vector<u32> weights;
@@ -285,13 +293,13 @@ void BuildTLAS(BVH& bvh)
 	for (u32 i = 0; i < instance_count; i++)
 	{
 		bvh.primitive_idx[i] = i;
-		u32 mesh_index = world_data.mesh_instances[i].mesh_idx;
+		u32 mesh_index = mesh_instances[i].mesh_idx;
 
 		auto bvhnode = Assets::get_root_bvh_node_of_mesh(mesh_index);
 
 		AABB aabb = { bvhnode.min, bvhnode.max };
 
-		transform_aabb(aabb, world_data.mesh_instances[i].transform);
+		transform_aabb(aabb, mesh_instances[i].transform);
 
 		transformed_aabbs.push_back(aabb);
 		weights[i] = Assets::get_mesh_header(mesh_index).tris_count;
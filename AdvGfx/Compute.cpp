@@ -1,5 +1,10 @@
 #include "Compute.h"
 
+#include <fstream>
+
+#include "Jobs.h"
+#include "JSONUtility.h"
+
 const char *get_cl_error_string(cl_int error)
 {
 switch(error){
@@ -77,17 +82,71 @@ switch(error){
     }
 }
 
+struct ProfiledCommand
+{
+    std::string label;
+    ComputeCommandType type;
+    usize byte_size;
+    cl::Event event;
+};
+
+// A large buffer that smaller buffers are sub-allocated from
+struct MemoryArena
+{
+    cl::Buffer buffer;
+    usize byte_size { 0 };
+    u32 live_allocations { 0 };
+
+    // Offset to size, neighbouring free ranges are merged when reclaimed
+    std::map<usize, usize> free_ranges;
+
+    // Released ranges that queued work on some device may still use
+    struct RetiredRange
+    {
+        usize offset;
+        usize byte_size;
+        ComputeFence fence;
+    };
+
+    std::vector<RetiredRange> retired_ranges;
+};
+
 struct
 {
     cl::Context context;
-    cl::Device device;
+    cl::Device device; // Primary device, everything but split dispatches runs on its queue
     cl::Platform platform; // Driver
     cl::CommandQueue queue;
+
+    // Every device in the context, primary device first
+    std::vector<cl::Device> devices;
+    std::vector<cl::CommandQueue> queues;
     std::string common_source { "" };
     FILETIME common_source_last_write_time;
+    bool unified_memory { false };
+
+    // Platform, devices and driver, part of the program binary cache key
+    std::string device_identity { "" };
+    const std::string build_options { "-w" };
 
     std::unordered_map<std::string, ComputeKernel> kernels;
 
+    // Commands waiting for their profiling event to complete
+    std::vector<ProfiledCommand> profiled_commands;
+
+    // Uploads taken by the driver at buffer creation (CL_MEM_COPY_HOST_PTR) have no event, only a size
+    std::vector<ComputeCommandTiming> untimed_commands;
+
+    // Autotuned work-group configs of this device, keyed by kernel name
+    std::unordered_map<std::string, ComputeWorkGroupConfig> tuned_work_groups;
+
+    // Empty slots (byte_size 0) are reused, allocations refer to arenas by index
+    std::vector<MemoryArena> arenas;
+    usize arena_byte_size { 0 };
+    usize sub_buffer_alignment { 0 };
+    u64 dedicated_bytes { 0 };
+    std::array<u64, (usize)ComputeMemoryCategory::Count> category_bytes {};
+
 } compute;
 
 #ifdef _DEBUG
@@ -100,7 +159,8 @@ struct
 #define CHECKCL(func) func;
 #endif
 
-void load_common_shader_source()
+// Returns true if the common source has been (re)loaded
+bool load_common_shader_source()
 {
     std::string expected_common_path = get_current_directory_path() + "\\..\\..\\AdvGfx\\assets\\compute\\common.cl";
 
@@ -115,7 +175,7 @@ void load_common_shader_source()
     compute.common_source_last_write_time = current_write_time;
 
     if(!common_source_updated)
-        return;
+        return false;
 
     compute.common_source = read_file_to_string(expected_common_path);
 
@@ -127,6 +187,48 @@ void load_common_shader_source()
     {
         LOGDEBUG("Loaded shader common source.");
     }
+
+    return true;
+}
+
+ComputeDefines& ComputeDefines::set(const std::string& name, i64 value)
+{
+    values[name] = value;
+    return *this;
+}
+
+ComputeDefines& ComputeDefines::set_layout(const std::string& name, i64 value)
+{
+    layout_values[name] = value;
+    return *this;
+}
+
+std::string ComputeDefines::to_build_options() const
+{
+    std::map<std::string, i64> all_values = values;
+    all_values.insert(layout_values.begin(), layout_values.end());
+
+    std::string build_options;
+
+    for(auto& [name, value] : all_values)
+    {
+        build_options += std::format("{}-D {}={}", build_options.empty() ? "" : " ", name, value);
+    }
+
+    return build_options;
+}
+
+ComputeDefines ComputeDefines::get_layout_defines() const
+{
+    ComputeDefines layout_defines;
+    layout_defines.layout_values = layout_values;
+
+    return layout_defines;
+}
+
+bool ComputeKernelVariant::is_valid() const
+{
+    return state == ComputeKernelState::Compiled;
 }
 
 ComputeKernel::ComputeKernel(const std::string& path, const std::string& entry_point)
@@ -138,313 +240,1946 @@ ComputeKernel::ComputeKernel(const std::string& path, const std::string& entry_p
     GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &fileData);
 
     last_write_time = fileData.ftLastWriteTime;
+
+    variants.insert({"", ComputeKernelVariant()});
+
+    // Tuned on an earlier run
+    auto tuned = compute.tuned_work_groups.find(path.substr(path.find_last_of("\\/") + 1));
+
+    if(tuned != compute.tuned_work_groups.end())
+    {
+        tuning.best = tuned->second;
+        tuning.tuned = true;
+    }
 }
 
-void ComputeKernel::compile()
+std::string get_kernel_cache_directory()
 {
-    ComputeKernelState previous_state = state;
-    state = ComputeKernelState::Empty;
+    return get_current_directory_path() + "\\kernel_cache\\";
+}
 
-    cl::Program::Sources sources;
+// Cache files hold one binary per device: binary count, then the size and data of each binary
+cl::Program::Binaries read_program_binaries(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
 
-    // First try to add common source, then add shader-specific source
-    load_common_shader_source();
-    bool common_shader_source_exists = compute.common_source.length() != 0;
+    if(!file.good())
+        return {};
+
+    u32 binary_count = 0;
+    file.read((char*)&binary_count, sizeof(binary_count));
 
-    if(common_shader_source_exists)
+    cl::Program::Binaries binaries(binary_count);
+
+    for(auto& binary : binaries)
     {
-        sources.push_back(compute.common_source);
+        u64 binary_size = 0;
+        file.read((char*)&binary_size, sizeof(binary_size));
+
+        binary.resize(binary_size);
+        file.read((char*)binary.data(), binary_size);
     }
 
-    sources.push_back(read_file_to_string(path));
+    if(!file.good())
+        return {};
+
+    return binaries;
+}
+
+// Stores the program binaries, and removes binaries of older versions of the same kernel variant
+void write_program_binaries(const std::string& cache_name, const std::string& path, const cl::Program::Binaries& binaries)
+{
+    std::string cache_directory = get_kernel_cache_directory();
+
+    std::error_code error;
+    std::filesystem::create_directories(cache_directory, error);
+
+    // Runs on workers, so nothing in here may throw. Removing entries is fine while iterating
+    std::filesystem::directory_iterator entry(cache_directory, error);
+
+    for(; !error && entry != std::filesystem::directory_iterator(); entry.increment(error))
+    {
+        bool is_stale_binary = entry->path().filename().string().starts_with(cache_name + "_");
+
+        if(is_stale_binary)
+        {
+            std::error_code remove_error;
+            std::filesystem::remove(entry->path(), remove_error);
+        }
+    }
+
+    std::ofstream file(path, std::ios::binary);
 
+    u32 binary_count = (u32)binaries.size();
+    file.write((const char*)&binary_count, sizeof(binary_count));
+
+    for(auto& binary : binaries)
+    {
+        u64 binary_size = binary.size();
+        file.write((const char*)&binary_size, sizeof(binary_size));
+        file.write((const char*)binary.data(), binary_size);
+    }
+}
 
-    state = ComputeKernelState::Source;
+// Building from a cached binary skips the compiler front end entirely, only a (cheap) link remains
+bool build_program_from_binaries(const cl::Program::Binaries& binaries, const std::string& build_options, cl::Program& program)
+{
+    if(binaries.size() != compute.devices.size())
+        return false;
 
-    cl::Program created_program(compute.context, sources);
-    state = ComputeKernelState::Program;
+    std::vector<cl_int> binary_status;
+    cl_int error = CL_SUCCESS;
 
-    cl_int error = created_program.build({compute.device}, "-w");
+    program = cl::Program(compute.context, compute.devices, binaries, &binary_status, &error);
 
     if(error != CL_SUCCESS)
+        return false;
+
+    for(cl_int status : binary_status)
     {
-        LOGERROR(std::format("Failed to create kernel: {} \n {}", path, created_program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(compute.device)));
-        return;
+        if(status != CL_SUCCESS)
+            return false;
     }
-    state = ComputeKernelState::Built;
 
-    if(previous_state != ComputeKernelState::Empty)
+    return program.build(compute.devices, build_options.c_str()) == CL_SUCCESS;
+}
+
+// Runs on a worker thread, so it only reads what was handed to it and the immutable device state
+ComputeKernelBuild build_kernel(const std::string& common_source, const std::string& path, const std::string& entry_point, const std::string& defines)
+{
+    ComputeKernelBuild build;
+
+    std::string build_options = defines.empty() ? compute.build_options : std::format("{} {}", compute.build_options, defines);
+
+    cl::Program::Sources sources;
+
+    // First try to add common source, then add shader-specific source
+    build.has_common_source = common_source.length() != 0;
+
+    if(build.has_common_source)
     {
-        LOGDEBUG(std::format("Recompiled kernel: {}", path));
+        sources.push_back(common_source);
     }
-    else
+
+    sources.push_back(read_file_to_string(path));
+
+    // Anything that changes the resulting binary has to be part of the key
+    u64 cache_key = hash_string(compute.device_identity);
+    cache_key = hash_string(build_options, cache_key);
+    for(auto& source : sources)
+        cache_key = hash_string(source, cache_key);
+
+    // Variants of the same kernel are cached side by side
+    std::string cache_name = std::format("{}_{:016x}", get_file_name_from_path_string(path), hash_string(defines));
+    std::string cache_path = std::format("{}{}_{:016x}.bin", get_kernel_cache_directory(), cache_name, cache_key);
+
+    cl::Program created_program;
+    build.cache_hit = build_program_from_binaries(read_program_binaries(cache_path), build_options, created_program);
+
+    if(!build.cache_hit)
     {
-        LOGDEBUG(std::format("Created kernel: {} {}", get_file_name_from_path_string(path), common_shader_source_exists ? " - With common source" : ""));
+        created_program = cl::Program(compute.context, sources);
+
+        cl_int error = created_program.build(compute.devices, build_options.c_str());
+
+        if(error != CL_SUCCESS)
+        {
+            build.error_message = std::format("Failed to create kernel: {} \n {}", path, created_program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(compute.device));
+            return build;
+        }
+
+        auto binaries = created_program.getInfo<CL_PROGRAM_BINARIES>();
+
+        bool has_all_binaries = binaries.size() == compute.devices.size();
+        for(auto& binary : binaries)
+            has_all_binaries &= !binary.empty();
+
+        if(has_all_binaries)
+            write_program_binaries(cache_name, cache_path, binaries);
     }
 
-    cl_kernel = cl::Kernel(created_program, entry_point.c_str(), &error);
+    cl_int error = CL_SUCCESS;
+    build.cl_kernel = cl::Kernel(created_program, entry_point.c_str(), &error);
 
     if(error != CL_SUCCESS)
     {
-        LOGERROR(std::format("Failed to create kernel: {} \n {} error", path, get_cl_error_string(error)))     
-        return;
+        build.error_message = std::format("Failed to create kernel: {} \n {} error", path, get_cl_error_string(error));
+        return build;
     }
 
-    state = ComputeKernelState::Compiled;
+    build.succeeded = true;
+    return build;
 }
 
-bool ComputeKernel::is_valid()
+void ComputeKernel::compile()
 {
-    return state == ComputeKernelState::Compiled;
+    for(auto& [defines, variant] : variants)
+    {
+        compile_variant(variant);
+    }
 }
 
-bool ComputeKernel::has_been_changed()
+void ComputeKernel::compile_variant(ComputeKernelVariant& variant)
 {
-    WIN32_FILE_ATTRIBUTE_DATA fileData;
+    // Sources may have changed again while building, build once more after the running build is applied
+    if(variant.pending_build.valid())
+    {
+        variant.rebuild_requested = true;
+        return;
+    }
 
-    GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &fileData);
+    load_common_shader_source();
 
-    FILETIME current_write_time = fileData.ftLastWriteTime;
+    variant.pending_build = Jobs::submit_with_result([common_source = compute.common_source, path = path, entry_point = entry_point, defines = variant.defines]()
+    {
+        return build_kernel(common_source, path, entry_point, defines);
+    });
+}
 
-    bool shader_updated = CompareFileTime(&current_write_time, &last_write_time) == 1;
+bool ComputeKernel::apply_finished_builds()
+{
+    bool applied_any = false;
 
-    last_write_time = current_write_time;
+    for(auto& [defines, variant] : variants)
+    {
+        applied_any |= apply_finished_build(variant);
+    }
 
-    return shader_updated;
+    return applied_any;
 }
 
-ComputeReadBuffer::ComputeReadBuffer(const ComputeDataHandle& data)
-    : internal_buffer(cl::Buffer(compute.context, CL_MEM_READ_ONLY, data.data_byte_size))
-    , data_handle(data)
+bool ComputeKernel::apply_finished_build(ComputeKernelVariant& variant)
 {
-        
+    if(!variant.pending_build.valid() || variant.pending_build.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+
+    ComputeKernelBuild build = variant.pending_build.get();
+    bool applied = build.succeeded;
+
+    if(build.succeeded)
+    {
+        const char* cache_result = build.cache_hit ? "cache hit" : "cache miss";
+        std::string variant_name = variant.defines.empty() ? "" : std::format(" [{}]", variant.defines);
+
+        if(variant.is_valid())
+        {
+            LOGDEBUG(std::format("Recompiled kernel: {}{} ({})", path, variant_name, cache_result));
+        }
+        else
+        {
+            LOGDEBUG(std::format("Created kernel: {}{} {} ({})", get_file_name_from_path_string(path), variant_name, build.has_common_source ? " - With common source" : "", cache_result));
+        }
+
+        // Work that was already enqueued holds its own reference to the old kernel
+        variant.cl_kernel = build.cl_kernel;
+        variant.state = ComputeKernelState::Compiled;
+        variant.bound_by = nullptr;
+
+        variant.max_work_group_size = SIZE_MAX;
+
+        for(const cl::Device& device : compute.devices)
+            variant.max_work_group_size = glm::min(variant.max_work_group_size, (usize)variant.cl_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+    }
+    else
+    {
+        // Keep rendering with the last working kernel
+        LOGERROR(build.error_message);
+    }
+
+    if(variant.rebuild_requested)
+    {
+        variant.rebuild_requested = false;
+        compile_variant(variant);
+    }
+
+    return applied;
 }
 
-ComputeWriteBuffer::ComputeWriteBuffer(const ComputeDataHandle& data)
-    : internal_buffer(cl::Buffer(compute.context, CL_MEM_WRITE_ONLY, data.data_byte_size))
+void ComputeKernel::wait_for_builds()
 {
-    // Automatically write itself to GPU
-    CHECKCL(compute.queue.enqueueWriteBuffer(internal_buffer, CL_TRUE, 0, data.data_byte_size, data.data_ptr));
-    compute.queue.finish();
+    for(auto& [defines, variant] : variants)
+    {
+        if(variant.pending_build.valid())
+            variant.pending_build.wait();
+    }
 }
 
-void ComputeWriteBuffer::update(const ComputeDataHandle& data)
+bool ComputeKernel::is_compiling()
 {
-    CHECKCL(compute.queue.enqueueWriteBuffer(internal_buffer, CL_TRUE, 0, data.data_byte_size, data.data_ptr));
-    compute.queue.finish();
+    for(auto& [defines, variant] : variants)
+    {
+        if(variant.pending_build.valid())
+            return true;
+    }
+
+    return false;
 }
 
-ComputeReadWriteBuffer::ComputeReadWriteBuffer(const ComputeDataHandle& data)
-    : internal_buffer(cl::Buffer(compute.context, CL_MEM_READ_WRITE, data.data_byte_size))
-    , data_handle(data)
+bool ComputeKernel::is_valid()
 {
-    
+    return variants[""].is_valid();
 }
 
-ComputeGPUOnlyBuffer::ComputeGPUOnlyBuffer(size_t data_size)
-    : internal_buffer(cl::Buffer(compute.context, CL_MEM_HOST_NO_ACCESS, data_size))
+void ComputeKernel::reset_work_group_tuning()
 {
-    
+    tuning = ComputeWorkGroupTuning();
 }
 
-ComputeOperation::ComputeOperation(const std::string& kernel_name)
-    : kernel(&compute.kernels.find(kernel_name)->second)
+ComputeKernelVariant& ComputeKernel::get_or_create_variant(const std::string& build_options)
 {
+    auto found = variants.find(build_options);
+
+    if(found == variants.end())
+    {
+        found = variants.insert({build_options, ComputeKernelVariant()}).first;
+        found->second.defines = build_options;
+        compile_variant(found->second);
+    }
 
+    return found->second;
 }
 
-ComputeOperation& ComputeOperation::write(const ComputeGPUOnlyBuffer& buffer)
+ComputeKernelVariant& ComputeKernel::get_variant(const ComputeDefines& defines)
 {
-    kernel->cl_kernel.setArg(arg_count, buffer.internal_buffer);
+    ComputeKernelVariant& variant = get_or_create_variant(defines.to_build_options());
 
-    arg_count++;
-    return *this;
-}
+    // Built along with the first variant that needs it, so it is ready once a later define set is waited on
+    ComputeKernelVariant& stand_in = get_or_create_variant(defines.get_layout_defines().to_build_options());
 
-ComputeOperation& ComputeOperation::read_write(const ComputeGPUOnlyBuffer& buffer)
-{
-    kernel->cl_kernel.setArg(arg_count, buffer.internal_buffer);
+    // Every other define only skips paths, the runtime checks still hold. Layout defines have to match exactly
+    if(!variant.is_valid() && stand_in.is_valid())
+        return stand_in;
 
-    arg_count++;
-    return *this;
+    return variant;
 }
 
-ComputeOperation& ComputeOperation::write(const ComputeDataHandle& data)
+bool ComputeKernel::has_been_changed()
 {
-    // Create and push new temporary buffer
-    ComputeWriteBuffer cwb(data);
+    WIN32_FILE_ATTRIBUTE_DATA fileData;
 
-    write_buffers_non_persistent.push_back(std::move(cwb));
-    auto& cwb_ref = write_buffers_non_persistent.back();
-    
-    CHECKCL(compute.queue.enqueueWriteBuffer(cwb_ref.internal_buffer, CL_TRUE, 0, data.data_byte_size, data.data_ptr));
+    GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &fileData);
 
-    kernel->cl_kernel.setArg(arg_count, cwb_ref);
+    FILETIME current_write_time = fileData.ftLastWriteTime;
 
-    arg_count++;
-    return *this;
-}
+    bool shader_updated = CompareFileTime(&current_write_time, &last_write_time) == 1;
 
-ComputeOperation& ComputeOperation::write(const ComputeWriteBuffer& buffer)
-{    
-    kernel->cl_kernel.setArg(arg_count, buffer.internal_buffer);
+    last_write_time = current_write_time;
 
-    arg_count++;
-    return *this;
+    return shader_updated;
 }
 
-ComputeOperation& ComputeOperation::read(const ComputeReadBuffer& buffer)
-{
-    read_buffers.push_back(&buffer);
+// Limits memory use if nobody collects the timings
+const usize MAX_PROFILED_COMMANDS = 4096;
 
-    kernel->cl_kernel.setArg(arg_count, buffer.internal_buffer);
+// Keeps the event until it completes, Compute::collect_command_timings() then reads its timestamps
+void profile_command(const std::string& label, ComputeCommandType type, const cl::Event& event, usize byte_size = 0)
+{
+    // Failed enqueues leave the event empty
+    if(event() == nullptr || compute.profiled_commands.size() >= MAX_PROFILED_COMMANDS)
+        return;
 
-    arg_count++;
-    return *this;
+    compute.profiled_commands.push_back({label, type, byte_size, event});
 }
 
-ComputeOperation& ComputeOperation::read(const ComputeGPUOnlyBuffer& buffer)
+// Only alias host memory when there is something to alias, CL_MEM_USE_HOST_PTR does not accept null pointers
+bool can_alias_host_memory(const void* data_ptr, size_t data_byte_size)
 {
-    kernel->cl_kernel.setArg(arg_count, buffer.internal_buffer);
-
-    arg_count++;
-    return *this;
+    return compute.unified_memory && data_ptr != nullptr && data_byte_size > 0;
 }
 
-ComputeOperation& ComputeOperation::read_write(const ComputeReadWriteBuffer& buffer)
+// Mapping a CL_MEM_USE_HOST_PTR buffer hands back the host pointer itself, unmapping it makes the region coherent again.
+// On unified memory devices this costs next to nothing, as opposed to a full copy.
+void synchronize_host_backed_buffer(const cl::Buffer& buffer, size_t data_byte_size, cl_map_flags flags, cl_bool blocking = CL_TRUE, cl::Event* event = nullptr)
 {
-    // Push buffer
-    readwrite_buffers.push_back(&buffer);
+    cl_int error = CL_SUCCESS;
+    void* mapped_ptr = compute.queue.enqueueMapBuffer(buffer, blocking, flags, 0, data_byte_size, nullptr, nullptr, &error);
 
-    CHECKCL(compute.queue.enqueueWriteBuffer(buffer.internal_buffer, CL_TRUE, 0, buffer.data_handle.data_byte_size, buffer.data_handle.data_ptr));
-    
-    kernel->cl_kernel.setArg(arg_count, buffer.internal_buffer);
+    if(error != CL_SUCCESS)
+    {
+        LOGERROR(std::format("Failed to map host backed buffer: {}", get_cl_error_string(error)));
+        return;
+    }
 
-    arg_count++;
-    return *this;
+    CHECKCL(compute.queue.enqueueUnmapMemObject(buffer, mapped_ptr, nullptr, event));
 }
 
-ComputeOperation& ComputeOperation::global_dispatch(glm::ivec3 size)
+const usize ARENA_BYTE_SIZE = 64 * 1024 * 1024;
+
+usize align_up(usize value, usize alignment)
 {
-    global_dispatch_size = size;
-    return *this;
+    return ((value + alignment - 1) / alignment) * alignment;
 }
 
-void ComputeOperation::execute()
+void init_memory_arenas()
 {
-    if(!kernel->is_valid())
-        return;
-
-    cl::NDRange global = cl::NDRange(global_dispatch_size.x, global_dispatch_size.y, global_dispatch_size.z);
-    cl::NDRange local = cl::NullRange;
-
-    CHECKCL(compute.queue.enqueueNDRangeKernel(kernel->cl_kernel, cl::NullRange, global, local));
+    // Sub-buffer offsets have to be aligned for every device in the context
+    cl_uint alignment_bits = 0;
+    u64 max_alloc_byte_size = UINT64_MAX;
 
-    CHECKCL(compute.queue.finish());
-
-    for(auto& buffer : read_buffers)
+    for(auto& device : compute.devices)
     {
-         CHECKCL(compute.queue.enqueueReadBuffer(buffer->internal_buffer, CL_TRUE, 0, buffer->data_handle.data_byte_size, buffer->data_handle.data_ptr));
-    }
-    for(auto& buffer : readwrite_buffers)
-    {
-         CHECKCL(compute.queue.enqueueReadBuffer(buffer->internal_buffer, CL_TRUE, 0, buffer->data_handle.data_byte_size, buffer->data_handle.data_ptr));
+        alignment_bits = glm::max(alignment_bits, device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>());
+        max_alloc_byte_size = glm::min(max_alloc_byte_size, (u64)device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>());
     }
+
+    compute.sub_buffer_alignment = glm::max((usize)alignment_bits / 8, (usize)256);
+    compute.arena_byte_size = (usize)glm::min((u64)ARENA_BYTE_SIZE, max_alloc_byte_size);
 }
 
-void Compute::create_kernel(const std::string& path, const std::string& entry_point)
+u64 get_reserved_device_bytes()
 {
-    std::string file_name_with_extension = path.substr(path.find_last_of("\\/") + 1);
-    if(compute.kernels.find(file_name_with_extension) != compute.kernels.end())
-    {
-        LOGERROR(std::format("Kernel {} already exists, ignoring", file_name_with_extension));
-        return;
-    }
+    u64 reserved_bytes = compute.dedicated_bytes;
 
-    auto ref = compute.kernels.insert({file_name_with_extension, ComputeKernel(path, entry_point)});
+    for(auto& arena : compute.arenas)
+        reserved_bytes += arena.byte_size;
 
-    // Attempt to compile the newly created kernel
-    ref.first->second.compile();
+    return reserved_bytes;
 }
 
-void select_platform()
+bool create_memory_arena(u32& arena_idx)
 {
-    //get all platforms (drivers)
-    std::vector<cl::Platform> all_platforms;
-    cl::Platform::get(&all_platforms);
+    u64 device_global_bytes = compute.device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
 
-    if(all_platforms.empty())
-    {   
-        LOGERROR("No platforms found. Check OpenCL installation!");
-        exit(1);
+    if(get_reserved_device_bytes() + compute.arena_byte_size > device_global_bytes)
+    {
+        LOGDEFAULT(std::format("Device memory budget exceeded, {} MB of {} MB reserved", get_reserved_device_bytes() >> 20, device_global_bytes >> 20));
     }
-    else
+
+    cl_int error = CL_SUCCESS;
+    cl::Buffer buffer = cl::Buffer(compute.context, CL_MEM_READ_WRITE, compute.arena_byte_size, nullptr, &error);
+
+    if(error != CL_SUCCESS)
     {
-        compute.platform = all_platforms[0];
-        LOGDEBUG(std::format("Using platform: {}", compute.platform.getInfo<CL_PLATFORM_NAME>()));
+        LOGERROR(std::format("Failed to create a memory arena: {}", get_cl_error_string(error)));
+        return false;
     }
+
+    auto empty_slot = std::find_if(compute.arenas.begin(), compute.arenas.end(), [](const MemoryArena& arena) { return arena.byte_size == 0; });
+    arena_idx = (u32)std::distance(compute.arenas.begin(), empty_slot);
+
+    if(empty_slot == compute.arenas.end())
+        compute.arenas.emplace_back();
+
+    MemoryArena& arena = compute.arenas[arena_idx];
+    arena.buffer = buffer;
+    arena.byte_size = compute.arena_byte_size;
+    arena.free_ranges[0] = compute.arena_byte_size;
+
+    return true;
 }
 
-void select_device()
+void insert_free_range(MemoryArena& arena, usize offset, usize byte_size)
 {
-    std::vector<cl::Device> all_devices;
-    compute.platform.getDevices(CL_DEVICE_TYPE_GPU, &all_devices);
+    auto range = arena.free_ranges.insert({offset, byte_size}).first;
 
-    if(all_devices.empty())
+    auto next = std::next(range);
+    if(next != arena.free_ranges.end() && range->first + range->second == next->first)
     {
-        LOGERROR("No suitable devices found. Check OpenCL installation!");
-        exit(1);
+        range->second += next->second;
+        arena.free_ranges.erase(next);
     }
-    else
+
+    if(range != arena.free_ranges.begin())
     {
-        compute.device = all_devices[0];
-        LOGDEBUG(std::format("Using device: {}", compute.device.getInfo<CL_DEVICE_NAME>()));
+        auto previous = std::prev(range);
+        if(previous->first + previous->second == range->first)
+        {
+            previous->second += range->second;
+            arena.free_ranges.erase(range);
+        }
     }
 }
 
-void get_context_and_command_queue()
+// Retired ranges become free once every queue has passed their fence
+void reclaim_retired_ranges(MemoryArena& arena)
 {
-    compute.context = (compute.device);
-    compute.queue = cl::CommandQueue(compute.context, compute.device);
-}
+    std::erase_if(arena.retired_ranges, [&arena](const MemoryArena::RetiredRange& retired)
+    {
+        if(!retired.fence.is_complete())
+            return false;
 
-void Compute::init()
-{
-    select_platform();
-    select_device();
-    get_context_and_command_queue();
-    load_common_shader_source();
+        insert_free_range(arena, retired.offset, retired.byte_size);
+        return true;
+    });
 }
 
-// Returns true if any kernels have been recompiled
-bool Compute::recompile_kernels(ComputeKernelRecompilationCondition condition)
+// Best fit over all arenas, a new arena is only created if nothing fits
+bool find_arena_range(usize byte_size, u32& arena_idx, usize& offset)
 {
-    bool recompiled_any = false;
+    usize best_range_size = SIZE_MAX;
 
-    for(auto& [key, kernel] : compute.kernels)
+    for(u32 i = 0; i < compute.arenas.size(); i++)
     {
-        bool recompile_kernel = false;
+        reclaim_retired_ranges(compute.arenas[i]);
 
-        switch(condition)
+        for(auto& [range_offset, range_size] : compute.arenas[i].free_ranges)
         {
-        case ComputeKernelRecompilationCondition::Force:
-            recompile_kernel = true;
-            break;
-        case ComputeKernelRecompilationCondition::SourceChanged:
-            recompile_kernel = kernel.has_been_changed();
-            break;
+            if(range_size >= byte_size && range_size < best_range_size)
+            {
+                best_range_size = range_size;
+                arena_idx = i;
+                offset = range_offset;
+            }
         }
+    }
 
-        if(recompile_kernel)
+    if(best_range_size != SIZE_MAX)
+        return true;
+
+    offset = 0;
+    return create_memory_arena(arena_idx);
+}
+
+void track_dedicated_memory(ComputeAllocation& allocation, usize byte_size, ComputeMemoryCategory category)
+{
+    allocation.release();
+    allocation.arena_idx = ComputeAllocation::DEDICATED;
+    allocation.offset = 0;
+    allocation.byte_size = byte_size;
+    allocation.category = category;
+    allocation.valid = true;
+
+    compute.dedicated_bytes += byte_size;
+    compute.category_bytes[(usize)category] += byte_size;
+}
+
+// Hands out a sub-buffer of an arena, large buffers (or a failed arena) get a buffer of their own
+cl::Buffer allocate_device_memory(usize byte_size, cl_mem_flags flags, ComputeMemoryCategory category, ComputeAllocation& allocation)
+{
+    allocation.release();
+
+    usize aligned_byte_size = align_up(glm::max(byte_size, (usize)1), compute.sub_buffer_alignment);
+
+    u32 arena_idx = 0;
+    usize offset = 0;
+
+    // Large buffers would mostly leave arenas half empty
+    if(aligned_byte_size <= compute.arena_byte_size / 4 && find_arena_range(aligned_byte_size, arena_idx, offset))
+    {
+        MemoryArena& arena = compute.arenas[arena_idx];
+
+        cl_buffer_region region { offset, aligned_byte_size };
+        cl_int error = CL_SUCCESS;
+        cl::Buffer sub_buffer = arena.buffer.createSubBuffer(flags, CL_BUFFER_CREATE_TYPE_REGION, &region, &error);
+
+        if(error == CL_SUCCESS)
+        {
+            auto range = arena.free_ranges.find(offset);
+            usize range_size = range->second;
+            arena.free_ranges.erase(range);
+
+            if(range_size > aligned_byte_size)
+                arena.free_ranges[offset + aligned_byte_size] = range_size - aligned_byte_size;
+
+            arena.live_allocations++;
+
+            allocation.arena_idx = arena_idx;
+            allocation.offset = offset;
+            allocation.byte_size = aligned_byte_size;
+            allocation.category = category;
+            allocation.valid = true;
+            compute.category_bytes[(usize)category] += aligned_byte_size;
+
+            return sub_buffer;
+        }
+
+        LOGERROR(std::format("Failed to create a sub-buffer: {}", get_cl_error_string(error)));
+    }
+
+    track_dedicated_memory(allocation, byte_size, category);
+    return cl::Buffer(compute.context, flags, glm::max(byte_size, (usize)1));
+}
+
+ComputeAllocation::ComputeAllocation(ComputeAllocation&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+ComputeAllocation& ComputeAllocation::operator=(ComputeAllocation&& other) noexcept
+{
+    if(this != &other)
+    {
+        release();
+
+        arena_idx = other.arena_idx;
+        offset = other.offset;
+        byte_size = other.byte_size;
+        category = other.category;
+        valid = other.valid;
+
+        other.valid = false;
+    }
+
+    return *this;
+}
+
+ComputeAllocation::~ComputeAllocation()
+{
+    release();
+}
+
+// Work that is still queued keeps the sub-buffer alive, the range is only reused once every queue is past it
+void ComputeAllocation::release()
+{
+    if(!valid)
+        return;
+
+    valid = false;
+    compute.category_bytes[(usize)category] -= byte_size;
+
+    if(arena_idx == DEDICATED)
+    {
+        compute.dedicated_bytes -= byte_size;
+        return;
+    }
+
+    MemoryArena& arena = compute.arenas[arena_idx];
+    arena.live_allocations--;
+
+    // Split dispatches run on other queues, ordering on the primary queue alone isn't enough
+    arena.retired_ranges.push_back({ offset, byte_size, ComputeFence() });
+}
+
+ComputeReadBuffer::ComputeReadBuffer(const ComputeDataHandle& data, ComputeMemoryCategory category)
+    : data_handle(data)
+{
+    aliases_host_memory = can_alias_host_memory(data.data_ptr, data.data_byte_size);
+
+    if(aliases_host_memory)
+    {
+        internal_buffer = cl::Buffer(compute.context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, data.data_byte_size, data.data_ptr);
+        track_dedicated_memory(allocation, data.data_byte_size, category);
+        return;
+    }
+
+    internal_buffer = allocate_device_memory(data.data_byte_size, CL_MEM_READ_ONLY, category, allocation);
+}
+
+ComputeWriteBuffer::ComputeWriteBuffer(const ComputeDataHandle& data, ComputeMemoryCategory category)
+    : data_handle(data)
+{
+    // Device reads straight from host memory the driver allocated. The data is copied in rather than aliased, the
+    // caller's memory may move or be freed while queued work still reads the buffer
+    if(can_alias_host_memory(data.data_ptr, data.data_byte_size))
+    {
+        internal_buffer = cl::Buffer(compute.context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR | CL_MEM_COPY_HOST_PTR, data.data_byte_size, data.data_ptr);
+        track_dedicated_memory(allocation, data.data_byte_size, category);
+        return;
+    }
+
+    if(category != ComputeMemoryCategory::Uploads)
+    {
+        internal_buffer = allocate_device_memory(data.data_byte_size, CL_MEM_WRITE_ONLY, category, allocation);
+
+        // Arena memory can't be initialized at creation, blocking so the host data may change right after
+        if(data.data_ptr != nullptr && data.data_byte_size > 0)
+        {
+            cl::Event upload_event;
+            CHECKCL(compute.queue.enqueueWriteBuffer(internal_buffer, CL_TRUE, 0, data.data_byte_size, data.data_ptr, nullptr, &upload_event));
+            profile_command("upload", ComputeCommandType::Upload, upload_event, data.data_byte_size);
+        }
+        return;
+    }
+
+    // Transient uploads write themselves to the GPU, the copy is taken at creation so it doesn't wait on queued work
+    internal_buffer = (data.data_ptr != nullptr)
+        ? cl::Buffer(compute.context, CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR, data.data_byte_size, data.data_ptr)
+        : cl::Buffer(compute.context, CL_MEM_WRITE_ONLY, data.data_byte_size);
+
+    track_dedicated_memory(allocation, data.data_byte_size, category);
+
+    if(data.data_ptr != nullptr && compute.untimed_commands.size() < MAX_PROFILED_COMMANDS)
+    {
+        ComputeCommandTiming timing;
+        timing.label = "upload";
+        timing.type = ComputeCommandType::Upload;
+        timing.byte_size = data.data_byte_size;
+        compute.untimed_commands.push_back(timing);
+    }
+}
+
+void ComputeWriteBuffer::update(const ComputeDataHandle& data)
+{
+    // Queued work keeps the old buffer alive, so a larger one simply replaces it
+    if(data.data_byte_size > data_handle.data_byte_size)
+    {
+        *this = ComputeWriteBuffer(data, allocation.category);
+        return;
+    }
+
+    // Ordered after the queued work that still reads the buffer, host allocated or not
+    cl::Event upload_event;
+    CHECKCL(compute.queue.enqueueWriteBuffer(internal_buffer, CL_TRUE, 0, data.data_byte_size, data.data_ptr, nullptr, &upload_event));
+    profile_command("upload", ComputeCommandType::Upload, upload_event, data.data_byte_size);
+
+    compute.queue.finish();
+}
+
+ComputeReadWriteBuffer::ComputeReadWriteBuffer(const ComputeDataHandle& data, ComputeMemoryCategory category)
+    : data_handle(data)
+{
+    aliases_host_memory = can_alias_host_memory(data.data_ptr, data.data_byte_size);
+
+    if(aliases_host_memory)
+    {
+        internal_buffer = cl::Buffer(compute.context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, data.data_byte_size, data.data_ptr);
+        track_dedicated_memory(allocation, data.data_byte_size, category);
+        return;
+    }
+
+    internal_buffer = allocate_device_memory(data.data_byte_size, CL_MEM_READ_WRITE, category, allocation);
+}
+
+void ComputeReadWriteBuffer::wait_for_read_back() const
+{
+    if(read_back_event() != nullptr)
+        CHECKCL(read_back_event.wait());
+}
+
+const size_t MIN_GROWABLE_BYTE_SIZE = 64 * 1024;
+
+ComputeGrowableBuffer::ComputeGrowableBuffer(ComputeMemoryCategory category)
+    : category(category)
+{
+    grow(MIN_GROWABLE_BYTE_SIZE);
+}
+
+void ComputeGrowableBuffer::grow(size_t required_byte_size)
+{
+    size_t new_capacity = glm::max(glm::max(required_byte_size, capacity + capacity / 2), MIN_GROWABLE_BYTE_SIZE);
+
+    ComputeAllocation new_allocation;
+    cl::Buffer new_buffer = allocate_device_memory(new_capacity, CL_MEM_READ_ONLY, category, new_allocation);
+
+    // Queued after all work that still reads the old buffer, which stays alive until then
+    if(byte_size > 0)
+    {
+        cl::Event copy_event;
+        CHECKCL(compute.queue.enqueueCopyBuffer(internal_buffer, new_buffer, 0, 0, byte_size, nullptr, &copy_event));
+        profile_command("grow copy", ComputeCommandType::Upload, copy_event, byte_size);
+    }
+
+    internal_buffer = new_buffer;
+    allocation = std::move(new_allocation);
+    capacity = new_capacity;
+}
+
+// Never aliases host memory, frames in flight would read the host data while it is edited or reallocated
+void ComputeGrowableBuffer::update(const ComputeDataHandle& data, size_t dirty_byte_offset)
+{
+    if(data.data_byte_size > capacity)
+        grow(data.data_byte_size);
+
+    byte_size = data.data_byte_size;
+
+    if(dirty_byte_offset >= data.data_byte_size)
+        return;
+
+    size_t dirty_byte_size = data.data_byte_size - dirty_byte_offset;
+
+    cl::Event upload_event;
+    CHECKCL(compute.queue.enqueueWriteBuffer(internal_buffer, CL_TRUE, dirty_byte_offset, dirty_byte_size, (u8*)data.data_ptr + dirty_byte_offset, nullptr, &upload_event));
+    profile_command("upload", ComputeCommandType::Upload, upload_event, dirty_byte_size);
+}
+
+void ComputeGrowableBuffer::update_range(const ComputeDataHandle& data, size_t byte_offset, size_t range_byte_size)
+{
+    update_range((u8*)data.data_ptr + byte_offset, byte_offset, range_byte_size);
+}
+
+void ComputeGrowableBuffer::update_range(const void* source, size_t byte_offset, size_t range_byte_size)
+{
+    cl::Event upload_event;
+    CHECKCL(compute.queue.enqueueWriteBuffer(internal_buffer, CL_TRUE, byte_offset, range_byte_size, source, nullptr, &upload_event));
+    profile_command("upload", ComputeCommandType::Upload, upload_event, range_byte_size);
+}
+
+void ComputeGrowableBuffer::resize(size_t new_byte_size)
+{
+    if(new_byte_size > capacity)
+        grow(new_byte_size);
+
+    byte_size = new_byte_size;
+}
+
+size_t ComputeGrowableBuffer::get_byte_size() const
+{
+    return byte_size;
+}
+
+ComputeGPUOnlyBuffer::ComputeGPUOnlyBuffer(size_t data_size, ComputeMemoryCategory category)
+{
+    internal_buffer = allocate_device_memory(data_size, CL_MEM_HOST_NO_ACCESS, category, allocation);
+}
+
+ComputeFrameRing::ComputeFrameRing(size_t frame_byte_size, u32 frame_count)
+    : frame_byte_size(frame_byte_size)
+{
+    frames.resize(frame_count);
+
+    for(auto& frame : frames)
+    {
+        // Driver allocated (pinned) memory, the device can DMA straight into it. Stays mapped for the lifetime of the ring
+        frame.pinned_buffer = cl::Buffer(compute.context, CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_WRITE, frame_byte_size);
+        frame.host_ptr = compute.queue.enqueueMapBuffer(frame.pinned_buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, frame_byte_size);
+
+        memset(frame.host_ptr, 0, frame_byte_size);
+    }
+}
+
+ComputeFrameRing::~ComputeFrameRing()
+{
+    compute.queue.finish();
+
+    for(auto& frame : frames)
+    {
+        CHECKCL(compute.queue.enqueueUnmapMemObject(frame.pinned_buffer, frame.host_ptr));
+    }
+
+    compute.queue.finish();
+}
+
+void ComputeFrameRing::enqueue_readback(const ComputeGPUOnlyBuffer& source)
+{
+    Frame& frame = frames[next_frame_idx];
+
+    // Only waits if the host laps the device, which keeps latency bounded
+    if(frame.in_flight)
+    {
+        frame.ready.wait();
+    }
+
+    CHECKCL(compute.queue.enqueueReadBuffer(source.internal_buffer, CL_FALSE, 0, frame_byte_size, frame.host_ptr, nullptr, &frame.ready));
+    profile_command("frame readback", ComputeCommandType::Download, frame.ready, frame_byte_size);
+
+    frame.in_flight = true;
+    frame.sequence = ++latest_sequence;
+    next_frame_idx = (next_frame_idx + 1) % (u32)frames.size();
+
+    // Kick off the queued work, so the device renders while the host presents and does UI
+    compute.queue.flush();
+}
+
+void* ComputeFrameRing::acquire_presentable_frame()
+{
+    if(latest_sequence == 0)
+        return nullptr;
+
+    // The device should still be busy with the latest frame, so present the one before it
+    u64 target_sequence = (latest_sequence > 1) ? (latest_sequence - 1) : latest_sequence;
+
+    // Nothing new got queued since we last presented (e.g. accumulation limit reached), show the newest frame instead
+    if(target_sequence <= presented_sequence)
+        target_sequence = latest_sequence;
+
+    for(auto& frame : frames)
+    {
+        if(frame.sequence != target_sequence)
+            continue;
+
+        if(frame.in_flight)
+        {
+            frame.ready.wait();
+            frame.in_flight = false;
+        }
+
+        presented_sequence = target_sequence;
+        return frame.host_ptr;
+    }
+
+    return nullptr;
+}
+
+void ComputeFrameRing::wait_for_frame(const void* host_ptr)
+{
+    for(auto& frame : frames)
+    {
+        if(frame.host_ptr != host_ptr || !frame.in_flight)
+            continue;
+
+        frame.ready.wait();
+        frame.in_flight = false;
+    }
+}
+
+ComputeFence::ComputeFence()
+{
+    for(cl::CommandQueue& queue : compute.queues)
+    {
+        cl::Event marker;
+        CHECKCL(queue.enqueueMarkerWithWaitList(nullptr, &marker));
+        markers.push_back(marker);
+    }
+}
+
+bool ComputeFence::is_complete() const
+{
+    for(const cl::Event& marker : markers)
+    {
+        if(marker.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE)
+            return false;
+    }
+
+    return true;
+}
+
+ComputeOperation::ComputeOperation(const std::string& kernel_name, const ComputeDefines& defines)
+    : kernel(&compute.kernels.find(kernel_name)->second)
+    , kernel_name(get_file_name_from_path_string(kernel->path))
+    , defines(defines)
+{
+
+}
+
+ComputePass::ComputePass(const std::string& kernel_name)
+    : ComputeOperation(kernel_name)
+{
+    persistent = true;
+}
+
+ComputeOperation& ComputePass::begin(const ComputeDefines& pass_defines)
+{
+    arg_cursor = 0;
+    upload_cursor = 0;
+    read_buffers.clear();
+    readwrite_buffers.clear();
+
+    if(!(defines == pass_defines))
+        defines = pass_defines;
+
+    return *this;
+}
+
+void ComputePass::prepare_variant(const ComputeDefines& defines)
+{
+    kernel->get_variant(defines);
+}
+
+void ComputeOperation::bind_arg(const cl::Buffer& buffer, const ComputeSplitMerge* merge)
+{
+    if(arg_cursor == kernel_args.size())
+    {
+        kernel_args.push_back(buffer);
+        changed_args.push_back(true);
+        arg_merges.emplace_back();
+    }
+    else if(kernel_args[arg_cursor]() != buffer())
+    {
+        kernel_args[arg_cursor] = buffer;
+        changed_args[arg_cursor] = true;
+    }
+
+    arg_merges[arg_cursor] = merge != nullptr ? std::optional<ComputeSplitMerge>(*merge) : std::nullopt;
+
+    arg_cursor++;
+}
+
+// Each uniform argument rotates through a few buffers, so data of frames that are still in flight isn't overwritten
+const cl::Buffer& ComputeOperation::upload_frame_data(const ComputeDataHandle& data)
+{
+    if(upload_cursor == frame_uploads.size())
+        frame_uploads.emplace_back();
+
+    FrameUpload& upload = frame_uploads[upload_cursor++];
+    FrameUpload::Slot& slot = upload.slots[upload.next_slot];
+    upload.next_slot = (upload.next_slot + 1) % FRAME_UPLOAD_SLOTS;
+
+    // Only stalls if the device is more than a few replays behind
+    if(slot.uploaded() != nullptr)
+    {
+        CHECKCL(slot.uploaded.wait());
+    }
+
+    // Empty data still needs a valid buffer to bind
+    if(slot.buffer() == nullptr || slot.staging.size() != data.data_byte_size)
+    {
+        slot.staging.resize(data.data_byte_size);
+        slot.buffer = cl::Buffer(compute.context, CL_MEM_READ_ONLY, glm::max(data.data_byte_size, (size_t)16));
+    }
+
+    if(data.data_byte_size > 0)
+    {
+        // Staged, so the caller's data may change as soon as this returns
+        memcpy(slot.staging.data(), data.data_ptr, data.data_byte_size);
+
+        CHECKCL(compute.queue.enqueueWriteBuffer(slot.buffer, CL_FALSE, 0, data.data_byte_size, slot.staging.data(), nullptr, &slot.uploaded));
+        profile_command("upload", ComputeCommandType::Upload, slot.uploaded, data.data_byte_size);
+    }
+
+    return slot.buffer;
+}
+
+ComputeOperation& ComputeOperation::write(const ComputeGPUOnlyBuffer& buffer)
+{
+    bind_arg(buffer.internal_buffer);
+
+    return *this;
+}
+
+ComputeOperation& ComputeOperation::read_write(const ComputeGPUOnlyBuffer& buffer, ComputeSplitMerge merge)
+{
+    bind_arg(buffer.internal_buffer, &merge);
+
+    return *this;
+}
+
+ComputeOperation& ComputeOperation::write(const ComputeDataHandle& data)
+{
+    if(persistent)
+    {
+        bind_arg(upload_frame_data(data));
+        return *this;
+    }
+
+    // Create and push new temporary buffer, it uploads (or aliases) the data by itself
+    ComputeWriteBuffer cwb(data, ComputeMemoryCategory::Uploads);
+
+    write_buffers_non_persistent.push_back(std::move(cwb));
+    auto& cwb_ref = write_buffers_non_persistent.back();
+
+    bind_arg(cwb_ref.internal_buffer);
+
+    return *this;
+}
+
+ComputeOperation& ComputeOperation::write(const ComputeGrowableBuffer& buffer)
+{
+    bind_arg(buffer.internal_buffer);
+
+    return *this;
+}
+
+ComputeOperation& ComputeOperation::write(const ComputeWriteBuffer& buffer)
+{    
+    bind_arg(buffer.internal_buffer);
+
+    return *this;
+}
+
+ComputeOperation& ComputeOperation::read(const ComputeReadBuffer& buffer, ComputeSplitMerge merge)
+{
+    read_buffers.push_back(&buffer);
+
+    bind_arg(buffer.internal_buffer, &merge);
+
+    return *this;
+}
+
+ComputeOperation& ComputeOperation::read(const ComputeGPUOnlyBuffer& buffer, ComputeSplitMerge merge)
+{
+    bind_arg(buffer.internal_buffer, &merge);
+
+    return *this;
+}
+
+ComputeOperation& ComputeOperation::read_write(const ComputeReadWriteBuffer& buffer, ComputeSplitMerge merge)
+{
+    // Push buffer
+    readwrite_buffers.push_back(&buffer);
+
+    // Non-blocking, a blocking write would wait for all previously queued kernels
+    if(buffer.aliases_host_memory)
+    {
+        synchronize_host_backed_buffer(buffer.internal_buffer, buffer.data_handle.data_byte_size, CL_MAP_WRITE_INVALIDATE_REGION, CL_FALSE);
+    }
+    else
+    {
+        cl::Event upload_event;
+        CHECKCL(compute.queue.enqueueWriteBuffer(buffer.internal_buffer, CL_FALSE, 0, buffer.data_handle.data_byte_size, buffer.data_handle.data_ptr, nullptr, &upload_event));
+        profile_command("upload", ComputeCommandType::Upload, upload_event, buffer.data_handle.data_byte_size);
+    }
+    
+    bind_arg(buffer.internal_buffer, &merge);
+
+    return *this;
+}
+
+ComputeOperation& ComputeOperation::global_dispatch(glm::ivec3 size)
+{
+    global_dispatch_size = size;
+    return *this;
+}
+
+ComputeOperation& ComputeOperation::split_across_devices()
+{
+    split = true;
+    return *this;
+}
+
+ComputeOperation& ComputeOperation::autotune_work_groups()
+{
+    autotune = true;
+    return *this;
+}
+
+// Candidates the autotuner tries, the first one leaves the local size to the driver
+const std::array<ComputeWorkGroupConfig, 7> work_group_candidates
+{{
+    { {0, 0}, false },
+    { {8, 8}, false },
+    { {8, 8}, true },
+    { {16, 8}, false },
+    { {16, 8}, true },
+    { {32, 4}, false },
+    { {32, 4}, true },
+}};
+
+const u32 WORK_GROUP_TUNING_SAMPLES = 8;
+
+std::string get_work_group_tuning_path()
+{
+    return std::format("{}work_groups_{:016x}.json", get_kernel_cache_directory(), hash_string(compute.device_identity));
+}
+
+void load_work_group_tuning()
+{
+    std::ifstream f(get_work_group_tuning_path());
+
+    if(!f.good())
+        return;
+
+    json tuning_data = json::parse(f, nullptr, false);
+
+    if(tuning_data.is_discarded() || !tuning_data.contains("kernels"))
+        return;
+
+    for(auto& [kernel_name, entry] : tuning_data["kernels"].items())
+    {
+        ComputeWorkGroupConfig config;
+        config.local_size = { entry.value("local_size_x", 0), entry.value("local_size_y", 0) };
+        config.tile_swizzle = entry.value("tile_swizzle", false);
+
+        compute.tuned_work_groups[kernel_name] = config;
+    }
+
+    LOGDEBUG(std::format("Loaded {} tuned work-group configs.", compute.tuned_work_groups.size()));
+}
+
+void save_work_group_tuning()
+{
+    json tuning_data;
+    tuning_data["device"] = compute.device_identity;
+    tuning_data["kernels"] = json::object();
+
+    for(auto& [kernel_name, config] : compute.tuned_work_groups)
+    {
+        tuning_data["kernels"][kernel_name] = {
+            { "local_size_x", config.local_size.x },
+            { "local_size_y", config.local_size.y },
+            { "tile_swizzle", config.tile_swizzle }
+        };
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(get_kernel_cache_directory(), error);
+
+    std::ofstream f(get_work_group_tuning_path());
+    f << tuning_data.dump(4);
+}
+
+bool work_group_config_fits(const ComputeWorkGroupConfig& config, usize max_work_group_size)
+{
+    return (usize)(config.local_size.x * config.local_size.y) <= max_work_group_size;
+}
+
+ComputeWorkGroupConfig ComputeOperation::select_work_group_config(cl::Event*& sample_event)
+{
+    sample_event = nullptr;
+
+    ComputeWorkGroupTuning& tuning = kernel->tuning;
+
+    if(!autotune)
+        return {};
+
+    if(tuning.tuned)
+        return tuning.best;
+
+    // Dispatches aren't waited on, so the previous sample is usually collected a frame later
+    if(tuning.pending_sample() != nullptr)
+    {
+        if(tuning.pending_sample.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE)
+            return work_group_candidates[tuning.candidate_idx];
+
+        cl_ulong start_ns = tuning.pending_sample.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+        cl_ulong end_ns = tuning.pending_sample.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+
+        tuning.sampled_ms += (f32)(end_ns - start_ns) / 1000000.0f;
+        tuning.sample_count++;
+        tuning.pending_sample = cl::Event();
+
+        if(tuning.sample_count == WORK_GROUP_TUNING_SAMPLES)
+        {
+            f32 average_ms = tuning.sampled_ms / (f32)tuning.sample_count;
+
+            if(tuning.candidate_idx == 0 || average_ms < tuning.best_ms)
+            {
+                tuning.best = work_group_candidates[tuning.candidate_idx];
+                tuning.best_ms = average_ms;
+            }
+
+            tuning.candidate_idx++;
+            tuning.sample_count = 0;
+            tuning.sampled_ms = 0.0f;
+        }
+    }
+
+    if(tuning.candidate_idx == work_group_candidates.size())
+    {
+        std::string kernel_name = get_file_name_from_path_string(kernel->path);
+
+        tuning.tuned = true;
+        compute.tuned_work_groups[kernel_name] = tuning.best;
+        save_work_group_tuning();
+
+        LOGDEBUG(std::format("Tuned work-groups of {}: {}x{}{} ({:.3f} ms)", kernel_name, tuning.best.local_size.x, tuning.best.local_size.y, tuning.best.tile_swizzle ? " swizzled" : "", tuning.best_ms));
+
+        return tuning.best;
+    }
+
+    sample_event = &tuning.pending_sample;
+    return work_group_candidates[tuning.candidate_idx];
+}
+
+void ComputeOperation::execute()
+{
+    dispatch(CL_TRUE);
+}
+
+void ComputeOperation::enqueue()
+{
+    dispatch(CL_FALSE);
+}
+
+// Rounds up to a whole number of work-groups
+i32 round_up_to_work_groups(i32 size, i32 local_size)
+{
+    return local_size > 0 ? ((size + local_size - 1) / local_size) * local_size : size;
+}
+
+ComputeKernelVariant* ComputeOperation::resolve_variant(ComputeWorkGroupConfig& config, cl::Event*& sample_event)
+{
+    bool reuse = resolved_variant != nullptr && !resolved_stand_in && resolved_tile_swizzle == config.tile_swizzle && resolved_defines == defines;
+
+    if(!reuse)
+    {
+        ComputeDefines variant_defines = defines;
+
+        if(config.tile_swizzle)
+            variant_defines.set("TILE_SWIZZLE", 1);
+
+        resolved_variant = &kernel->get_variant(variant_defines);
+        resolved_defines = defines;
+        resolved_tile_swizzle = config.tile_swizzle;
+
+        // Until the requested variant is built another one stands in for it
+        resolved_stand_in = resolved_variant->defines != variant_defines.to_build_options();
+    }
+
+    // A stand-in variant would skew the measurement
+    if(resolved_stand_in)
+    {
+        sample_event = nullptr;
+        config.tile_swizzle = false;
+    }
+
+    return resolved_variant;
+}
+
+// Maximum merges run a kernel of their own, until it is built nothing is split
+bool can_merge_split_dispatches()
+{
+    auto merge_kernel = compute.kernels.find("split_merge.cl");
+
+    return merge_kernel != compute.kernels.end() && merge_kernel->second.is_valid();
+}
+
+void ComputeOperation::dispatch(cl_bool blocking)
+{
+    cl::Event* sample_event = nullptr;
+    ComputeWorkGroupConfig config = select_work_group_config(sample_event);
+
+    ComputeKernelVariant& variant = *resolve_variant(config, sample_event);
+
+    if(!variant.is_valid())
+        return;
+
+    // Each variant has its own limit, too large configs fall back to the driver's choice
+    if(!work_group_config_fits(config, variant.max_work_group_size))
+    {
+        // A candidate being tuned is skipped, it can't run on this variant
+        if(sample_event != nullptr)
+        {
+            ComputeWorkGroupTuning& tuning = kernel->tuning;
+            tuning.candidate_idx++;
+            tuning.sample_count = 0;
+            tuning.sampled_ms = 0.0f;
+        }
+
+        config.local_size = { 0, 0 };
+        sample_event = nullptr;
+    }
+
+    // Another operation or a recompile may have replaced the arguments set on this kernel
+    bool bind_all = variant.bound_by != this;
+
+    for(u32 i = 0; i < kernel_args.size(); i++)
+    {
+        if(bind_all || changed_args[i])
+        {
+            variant.cl_kernel.setArg(i, kernel_args[i]);
+            changed_args[i] = false;
+        }
+    }
+
+    variant.bound_by = this;
+
+    cl::NDRange global = cl::NDRange(global_dispatch_size.x, global_dispatch_size.y, global_dispatch_size.z);
+    cl::NDRange local = cl::NullRange;
+
+    if(config.local_size.x > 0)
+    {
+        global = cl::NDRange(round_up_to_work_groups(global_dispatch_size.x, config.local_size.x), round_up_to_work_groups(global_dispatch_size.y, config.local_size.y), global_dispatch_size.z);
+        local = cl::NDRange(config.local_size.x, config.local_size.y, 1);
+    }
+
+    // Candidates are timed on the primary device only
+    bool is_tuning = autotune && !kernel->tuning.tuned;
+    usize row_group_count = global[1] / glm::max(config.local_size.y, 1);
+    bool split_dispatch = split && !is_tuning && compute.devices.size() > 1 && row_group_count >= compute.devices.size() && can_merge_split_dispatches();
+
+    if(split_dispatch)
+    {
+        dispatch_split(variant, config);
+    }
+    else
+    {
+        cl::Event kernel_event;
+        CHECKCL(compute.queue.enqueueNDRangeKernel(variant.cl_kernel, cl::NullRange, global, local, nullptr, &kernel_event));
+        profile_command(kernel_name, ComputeCommandType::Kernel, kernel_event);
+
+        if(sample_event != nullptr)
+            *sample_event = kernel_event;
+    }
+
+    if(blocking)
+    {
+        CHECKCL(compute.queue.finish());
+    }
+
+    auto read_back = [blocking](const cl::Buffer& buffer, const ComputeDataHandle& data_handle, bool aliases_host_memory, cl::Event& download_event)
+    {
+        if(aliases_host_memory)
+        {
+            synchronize_host_backed_buffer(buffer, data_handle.data_byte_size, CL_MAP_READ, blocking, &download_event);
+            return;
+        }
+
+        CHECKCL(compute.queue.enqueueReadBuffer(buffer, blocking, 0, data_handle.data_byte_size, data_handle.data_ptr, nullptr, &download_event));
+        profile_command("download", ComputeCommandType::Download, download_event, data_handle.data_byte_size);
+    };
+
+    for(auto& buffer : read_buffers)
+    {
+        cl::Event download_event;
+        read_back(buffer->internal_buffer, buffer->data_handle, buffer->aliases_host_memory, download_event);
+    }
+    for(auto& buffer : readwrite_buffers)
+    {
+        read_back(buffer->internal_buffer, buffer->data_handle, buffer->aliases_host_memory, buffer->read_back_event);
+    }
+}
+
+// Rows are handed out proportionally to how many rows per ms each device managed last time
+void ComputeOperation::dispatch_split(ComputeKernelVariant& variant, const ComputeWorkGroupConfig& config)
+{
+    u32 device_count = (u32)compute.devices.size();
+
+    if(variant.device_rows_per_ms.size() != device_count)
+    {
+        variant.device_rows_per_ms.assign(device_count, 0.0f);
+        variant.split_events.assign(device_count, cl::Event());
+        variant.split_rows.assign(device_count, 0);
+    }
+
+    // Previous bands are usually long done, unfinished ones are simply measured next time
+    for(u32 i = 0; i < device_count; i++)
+    {
+        cl::Event& event = variant.split_events[i];
+
+        if(event() == nullptr || event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE)
+            continue;
+
+        cl_ulong start_ns = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+        cl_ulong end_ns = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+        f32 elapsed_ms = (f32)(end_ns - start_ns) / 1000000.0f;
+
+        if(elapsed_ms > 0.0f && variant.split_rows[i] > 0)
+        {
+            f32 measured_rows_per_ms = (f32)variant.split_rows[i] / elapsed_ms;
+            f32& rows_per_ms = variant.device_rows_per_ms[i];
+
+            // Smoothed so a single hitch does not move the whole split around
+            rows_per_ms = rows_per_ms > 0.0f ? glm::mix(rows_per_ms, measured_rows_per_ms, 0.2f) : measured_rows_per_ms;
+        }
+
+        event = cl::Event();
+    }
+
+    bool all_measured = true;
+    f32 total_rows_per_ms = 0.0f;
+    for(f32 rows_per_ms : variant.device_rows_per_ms)
+    {
+        all_measured &= rows_per_ms > 0.0f;
+        total_rows_per_ms += rows_per_ms;
+    }
+
+    // Bands are whole rows of work-groups, the last band may reach past the image
+    u32 rows_per_group = (u32)glm::max(config.local_size.y, 1);
+    u32 total_row_groups = (u32)round_up_to_work_groups(global_dispatch_size.y, rows_per_group) / rows_per_group;
+    u32 row_group_offset = 0;
+
+    std::vector<u32> band_first_rows(device_count);
+    std::vector<u32> band_row_counts(device_count);
+
+    for(u32 i = 0; i < device_count; i++)
+    {
+        u32 remaining_devices = device_count - i - 1;
+        u32 row_groups = total_row_groups - row_group_offset;
+
+        // Every device keeps at least one row of work-groups, so it keeps being measured
+        if(remaining_devices > 0)
+        {
+            f32 share = all_measured ? variant.device_rows_per_ms[i] / total_rows_per_ms : 1.0f / (f32)device_count;
+            u32 wanted_row_groups = (u32)glm::round((f32)total_row_groups * share);
+            row_groups = glm::clamp(wanted_row_groups, 1u, total_row_groups - row_group_offset - remaining_devices);
+        }
+
+        band_first_rows[i] = row_group_offset * rows_per_group;
+        band_row_counts[i] = row_groups * rows_per_group;
+        row_group_offset += row_groups;
+    }
+
+    // The other devices write copies of their own, they start out as what the bands would read
+    split_copies.resize(device_count);
+
+    for(u32 i = 1; i < device_count; i++)
+        prepare_split_copies(i, band_first_rows[i], band_row_counts[i]);
+
+    // Everything queued on the primary queue so far (uploads, earlier passes, the copies) has to finish before other devices start
+    cl::Event primary_ready;
+    CHECKCL(compute.queue.enqueueMarkerWithWaitList(nullptr, &primary_ready));
+    std::vector<cl::Event> wait_for_primary { primary_ready };
+
+    for(u32 i = 0; i < device_count; i++)
+    {
+        // Arguments are captured at enqueue, so each device gets its copies bound in turn
+        for(u32 arg = 0; i > 0 && arg < kernel_args.size(); arg++)
+        {
+            if(arg_merges[arg].has_value())
+                variant.cl_kernel.setArg(arg, split_copies[i][arg].buffer);
+        }
+
+        cl::NDRange offset = cl::NDRange(0, band_first_rows[i], 0);
+        cl::NDRange global = cl::NDRange(round_up_to_work_groups(global_dispatch_size.x, config.local_size.x), band_row_counts[i], global_dispatch_size.z);
+        cl::NDRange local = config.local_size.x > 0 ? cl::NDRange(config.local_size.x, config.local_size.y, 1) : cl::NullRange;
+
+        const std::vector<cl::Event>* wait_list = i == 0 ? nullptr : &wait_for_primary;
+        CHECKCL(compute.queues[i].enqueueNDRangeKernel(variant.cl_kernel, offset, global, local, wait_list, &variant.split_events[i]));
+        profile_command(std::format("{} [device {}]", kernel_name, i), ComputeCommandType::Kernel, variant.split_events[i]);
+
+        variant.split_rows[i] = band_row_counts[i];
+    }
+
+    for(u32 arg = 0; arg < kernel_args.size(); arg++)
+    {
+        if(arg_merges[arg].has_value())
+            variant.cl_kernel.setArg(arg, kernel_args[arg]);
+    }
+
+    for(u32 i = 1; i < device_count; i++)
+    {
+        CHECKCL(compute.queues[i].flush());
+    }
+
+    // Merging and anything queued on the primary queue afterwards (readbacks, finalize) waits for every band
+    std::vector<cl::Event> band_events(variant.split_events.begin() + 1, variant.split_events.end());
+    CHECKCL(compute.queue.enqueueBarrierWithWaitList(&band_events));
+
+    for(u32 i = 1; i < device_count; i++)
+        merge_split_copies(i, band_first_rows[i], band_row_counts[i]);
+}
+
+// Byte range of a band in a buffer with a row of data per dispatch row, clamped to the buffer as the last band may reach past it
+void get_band_byte_range(usize buffer_byte_size, u32 dispatch_rows, u32 first_row, u32 row_count, usize& byte_offset, usize& byte_size)
+{
+    usize row_byte_size = buffer_byte_size / dispatch_rows;
+
+    byte_offset = glm::min((usize)first_row * row_byte_size, buffer_byte_size);
+    byte_size = glm::min((usize)row_count * row_byte_size, buffer_byte_size - byte_offset);
+}
+
+void ComputeOperation::prepare_split_copies(u32 device_idx, u32 first_row, u32 row_count)
+{
+    std::vector<SplitCopy>& copies = split_copies[device_idx];
+    copies.resize(kernel_args.size());
+
+    for(u32 arg = 0; arg < kernel_args.size(); arg++)
+    {
+        if(!arg_merges[arg].has_value())
+            continue;
+
+        usize byte_size = kernel_args[arg].getInfo<CL_MEM_SIZE>();
+        SplitCopy& copy = copies[arg];
+
+        // Dedicated, so no other device touches the memory object while this one writes it
+        if(copy.buffer() == nullptr || copy.allocation.byte_size != byte_size)
+        {
+            track_dedicated_memory(copy.allocation, byte_size, ComputeMemoryCategory::RenderTargets);
+            copy.buffer = cl::Buffer(compute.context, CL_MEM_READ_WRITE, byte_size);
+        }
+
+        usize copy_offset = 0;
+        usize copy_byte_size = byte_size;
+
+        if(arg_merges[arg]->type == ComputeSplitMerge::Type::Rows)
+            get_band_byte_range(byte_size, (u32)global_dispatch_size.y, first_row, row_count, copy_offset, copy_byte_size);
+
+        if(copy_byte_size == 0)
+            continue;
+
+        cl::Event copy_event;
+        CHECKCL(compute.queue.enqueueCopyBuffer(kernel_args[arg], copy.buffer, copy_offset, copy_offset, copy_byte_size, nullptr, &copy_event));
+        profile_command("split copy", ComputeCommandType::Upload, copy_event, copy_byte_size);
+    }
+}
+
+void ComputeOperation::merge_split_copies(u32 device_idx, u32 first_row, u32 row_count)
+{
+    ComputeKernelVariant& merge_variant = compute.kernels.find("split_merge.cl")->second.variants[""];
+
+    for(u32 arg = 0; arg < kernel_args.size(); arg++)
+    {
+        if(!arg_merges[arg].has_value())
+            continue;
+
+        const ComputeSplitMerge& merge = *arg_merges[arg];
+        const cl::Buffer& copy = split_copies[device_idx][arg].buffer;
+        usize byte_size = split_copies[device_idx][arg].allocation.byte_size;
+
+        if(merge.type == ComputeSplitMerge::Type::Maximum)
+        {
+            merge_variant.cl_kernel.setArg(0, kernel_args[arg]);
+            merge_variant.cl_kernel.setArg(1, copy);
+            merge_variant.bound_by = nullptr;
+
+            cl::Event merge_event;
+            CHECKCL(compute.queue.enqueueNDRangeKernel(merge_variant.cl_kernel, cl::NullRange, cl::NDRange(byte_size / sizeof(u32)), cl::NullRange, nullptr, &merge_event));
+            profile_command("split merge", ComputeCommandType::Kernel, merge_event);
+            continue;
+        }
+
+        usize merge_offset = 0;
+        usize merge_byte_size = byte_size;
+
+        if(merge.type == ComputeSplitMerge::Type::Rows)
+            get_band_byte_range(byte_size, (u32)global_dispatch_size.y, first_row, row_count, merge_offset, merge_byte_size);
+        else if(merge.row < first_row || merge.row >= first_row + row_count)
+            continue;
+
+        if(merge_byte_size == 0)
+            continue;
+
+        cl::Event merge_event;
+        CHECKCL(compute.queue.enqueueCopyBuffer(copy, kernel_args[arg], merge_offset, merge_offset, merge_byte_size, nullptr, &merge_event));
+        profile_command("split merge", ComputeCommandType::Upload, merge_event, merge_byte_size);
+    }
+}
+
+void Compute::create_kernel(const std::string& path, const std::string& entry_point)
+{
+    std::string file_name_with_extension = path.substr(path.find_last_of("\\/") + 1);
+    if(compute.kernels.find(file_name_with_extension) != compute.kernels.end())
+    {
+        LOGERROR(std::format("Kernel {} already exists, ignoring", file_name_with_extension));
+        return;
+    }
+
+    auto ref = compute.kernels.insert({file_name_with_extension, ComputeKernel(path, entry_point)});
+
+    // Kernels build in parallel, Compute::wait_for_kernels() blocks until they are usable
+    ref.first->second.compile();
+}
+
+const char* get_device_type_name(const cl::Device& device)
+{
+    cl_device_type type = device.getInfo<CL_DEVICE_TYPE>();
+
+    if(type & CL_DEVICE_TYPE_GPU) return "GPU";
+    if(type & CL_DEVICE_TYPE_CPU) return "CPU";
+    if(type & CL_DEVICE_TYPE_ACCELERATOR) return "Accelerator";
+    return "Other";
+}
+
+bool is_cpu_device(const cl::Device& device)
+{
+    return (device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU) != 0;
+}
+
+struct DeviceCandidate
+{
+    cl::Platform platform;
+    cl::Device device;
+};
+
+std::vector<DeviceCandidate> find_devices(const std::vector<cl::Platform>& platforms, ComputeDeviceType type, const std::string& name)
+{
+    cl_device_type cl_type = CL_DEVICE_TYPE_ALL;
+
+    switch(type)
+    {
+    case ComputeDeviceType::GPU:
+        cl_type = CL_DEVICE_TYPE_GPU;
+        break;
+    case ComputeDeviceType::CPU:
+        cl_type = CL_DEVICE_TYPE_CPU;
+        break;
+    default:
+        break;
+    }
+
+    std::vector<DeviceCandidate> candidates;
+
+    for(auto& platform : platforms)
+    {
+        std::vector<cl::Device> platform_devices;
+        platform.getDevices(cl_type, &platform_devices);
+
+        for(auto& device : platform_devices)
+        {
+            bool name_matches = name.empty() || device.getInfo<CL_DEVICE_NAME>().find(name) != std::string::npos;
+
+            if(name_matches)
+                candidates.push_back({platform, device});
+        }
+    }
+
+    return candidates;
+}
+
+void select_device(const ComputeInitDesc& desc)
+{
+    //get all platforms (drivers)
+    std::vector<cl::Platform> all_platforms;
+    cl::Platform::get(&all_platforms);
+
+    if(all_platforms.empty())
+    {   
+        LOGERROR("No platforms found. Check OpenCL installation!");
+        exit(1);
+    }
+
+    std::vector<DeviceCandidate> candidates = find_devices(all_platforms, desc.device_type, desc.device_name);
+
+    // Rendering slowly beats not rendering at all, so loosen the requirements step by step
+    if(candidates.empty() && !desc.device_name.empty())
+    {
+        LOGDEFAULT(std::format("No device named {} found, ignoring the name.", desc.device_name));
+        candidates = find_devices(all_platforms, desc.device_type, "");
+    }
+
+    if(candidates.empty() && desc.device_type != ComputeDeviceType::CPU)
+    {
+        LOGDEFAULT("No suitable device found, falling back to a CPU device.");
+        candidates = find_devices(all_platforms, ComputeDeviceType::CPU, "");
+    }
+
+    if(candidates.empty())
+    {
+        candidates = find_devices(all_platforms, ComputeDeviceType::Any, "");
+    }
+
+    if(candidates.empty())
+    {
+        LOGERROR("No devices found. Check OpenCL installation!");
+        exit(1);
+    }
+
+    auto& selected = candidates[glm::clamp(desc.device_index, 0, (i32)candidates.size() - 1)];
+
+    compute.platform = selected.platform;
+    compute.device = selected.device;
+
+    LOGDEBUG(std::format("Using platform: {}", compute.platform.getInfo<CL_PLATFORM_NAME>()));
+    LOGDEBUG(std::format("Using device: {} ({})", compute.device.getInfo<CL_DEVICE_NAME>(), get_device_type_name(compute.device)));
+}
+
+// A context can't span platforms, so extra devices come from the platform of the selected device
+void select_additional_devices(const ComputeInitDesc& desc)
+{
+    compute.devices = { compute.device };
+
+    if(!desc.use_multiple_devices)
+        return;
+
+    cl::Device root_device = compute.device;
+
+    if(is_cpu_device(root_device) && desc.cpu_sub_device_count > 1)
+    {
+        u32 compute_unit_count = root_device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+        u32 units_per_sub_device = glm::max(1u, compute_unit_count / (u32)desc.cpu_sub_device_count);
+
+        const cl_device_partition_property properties[] = { CL_DEVICE_PARTITION_EQUALLY, (cl_device_partition_property)units_per_sub_device, 0 };
+
+        std::vector<cl::Device> sub_devices;
+        cl_int error = root_device.createSubDevices(properties, &sub_devices);
+
+        if(error == CL_SUCCESS && sub_devices.size() > 1)
+        {
+            compute.device = sub_devices[0];
+            compute.devices = sub_devices;
+            LOGDEBUG(std::format("Partitioned CPU device into {} sub-devices.", sub_devices.size()));
+        }
+        else
+        {
+            LOGDEFAULT(std::format("Could not partition CPU device: {}", get_cl_error_string(error)));
+        }
+    }
+
+    std::vector<cl::Device> platform_devices;
+    compute.platform.getDevices(CL_DEVICE_TYPE_ALL, &platform_devices);
+
+    for(auto& device : platform_devices)
+    {
+        if(device() == root_device())
+            continue;
+
+        compute.devices.push_back(device);
+        LOGDEBUG(std::format("Using additional device: {} ({})", device.getInfo<CL_DEVICE_NAME>(), get_device_type_name(device)));
+    }
+}
+
+void get_context_and_command_queue()
+{
+    compute.context = cl::Context(compute.devices);
+
+    // Profiling events balance split dispatches and time autotuning candidates
+    cl::QueueProperties properties = cl::QueueProperties::Profiling;
+
+    compute.queues.clear();
+    for(auto& device : compute.devices)
+    {
+        compute.queues.push_back(cl::CommandQueue(compute.context, device, properties));
+    }
+
+    compute.queue = compute.queues[0];
+}
+
+// CPU and integrated devices share physical memory with the host, readbacks can alias host memory there instead of copying
+void detect_unified_memory()
+{
+    compute.unified_memory = true;
+
+    // A single discrete device makes host backed buffers a bad idea
+    for(auto& device : compute.devices)
+    {
+        // Deprecated since OpenCL 2.0 so it isn't exposed through getInfo, drivers still report it though
+        cl_bool host_unified_memory = CL_FALSE;
+        clGetDeviceInfo(device(), CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &host_unified_memory, nullptr);
+
+        compute.unified_memory &= is_cpu_device(device) || (host_unified_memory == CL_TRUE);
+    }
+
+    if(compute.unified_memory)
+    {
+        LOGDEBUG("Device uses unified memory, using zero-copy host buffers.");
+    }
+}
+
+void Compute::init(const ComputeInitDesc& desc)
+{
+    select_device(desc);
+    select_additional_devices(desc);
+    get_context_and_command_queue();
+    detect_unified_memory();
+    init_memory_arenas();
+
+    compute.device_identity = std::format("{} {} | {}",
+        compute.platform.getInfo<CL_PLATFORM_NAME>(),
+        compute.platform.getInfo<CL_PLATFORM_VERSION>(),
+        compute.device.getInfo<CL_DRIVER_VERSION>());
+
+    for(auto& device : compute.devices)
+    {
+        compute.device_identity += std::format(" | {} {}", device.getInfo<CL_DEVICE_NAME>(), device.getInfo<CL_DEVICE_VERSION>());
+    }
+
+    load_work_group_tuning();
+
+    load_common_shader_source();
+}
+
+// Queues builds for changed kernels and returns true if any finished build has been swapped in
+bool Compute::recompile_kernels(ComputeKernelRecompilationCondition condition)
+{
+    bool recompiled_any = false;
+
+    // Every kernel includes the common source
+    bool common_source_changed = condition == ComputeKernelRecompilationCondition::SourceChanged && load_common_shader_source();
+
+    for(auto& [key, kernel] : compute.kernels)
+    {
+        bool recompile_kernel = false;
+
+        switch(condition)
+        {
+        case ComputeKernelRecompilationCondition::Force:
+            recompile_kernel = true;
+            break;
+        case ComputeKernelRecompilationCondition::SourceChanged:
+            recompile_kernel = kernel.has_been_changed() || common_source_changed;
+            break;
+        }
+
+        if(recompile_kernel)
         {
             kernel.compile();
-            recompiled_any = true;
         }
+
+        recompiled_any |= kernel.apply_finished_builds();
     }
     return recompiled_any;
 }
 
+void Compute::wait_for_kernels()
+{
+    bool any_compiling = true;
+
+    while(any_compiling)
+    {
+        any_compiling = false;
+
+        for(auto& [key, kernel] : compute.kernels)
+        {
+            kernel.wait_for_builds();
+            kernel.apply_finished_builds();
+
+            any_compiling |= kernel.is_compiling();
+        }
+    }
+}
+
 bool Compute::kernel_exists(const std::string& kernel_name)
 {
     return compute.kernels.find(kernel_name) != compute.kernels.end();
-}
\ No newline at end of file
+}
+
+u32 Compute::get_device_count()
+{
+    return (u32)compute.devices.size();
+}
+
+void Compute::finish()
+{
+    compute.queue.finish();
+}
+
+void Compute::retune_work_groups()
+{
+    compute.tuned_work_groups.clear();
+
+    for(auto& [key, kernel] : compute.kernels)
+    {
+        kernel.reset_work_group_tuning();
+    }
+}
+
+std::vector<ComputeCommandTiming> Compute::collect_command_timings()
+{
+    std::vector<ComputeCommandTiming> timings = std::move(compute.untimed_commands);
+    compute.untimed_commands.clear();
+
+    auto ns_to_ms = [](cl_ulong from_ns, cl_ulong to_ns) { return to_ns > from_ns ? (f32)(to_ns - from_ns) / 1000000.0f : 0.0f; };
+
+    // Commands on a queue complete in order, but commands of different queues don't, so check every one
+    std::erase_if(compute.profiled_commands, [&](const ProfiledCommand& command)
+    {
+        if(command.event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE)
+            return false;
+
+        cl_ulong queued_ns = command.event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+        cl_ulong submit_ns = command.event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+        cl_ulong start_ns = command.event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+        cl_ulong end_ns = command.event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+
+        ComputeCommandTiming timing;
+        timing.label = command.label;
+        timing.type = command.type;
+        timing.byte_size = command.byte_size;
+        timing.queued_ms = ns_to_ms(queued_ns, submit_ns);
+        timing.submitted_ms = ns_to_ms(submit_ns, start_ns);
+        timing.execution_ms = ns_to_ms(start_ns, end_ns);
+
+        timings.push_back(timing);
+        return true;
+    });
+
+    return timings;
+}
+
+ComputeMemoryReport Compute::get_memory_report()
+{
+    ComputeMemoryReport report;
+    report.device_global_bytes = compute.device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+    report.dedicated_bytes = compute.dedicated_bytes;
+    report.category_bytes = compute.category_bytes;
+
+    for(auto& arena : compute.arenas)
+    {
+        if(arena.byte_size == 0)
+            continue;
+
+        report.arena_count++;
+        report.arena_reserved_bytes += arena.byte_size;
+
+        for(auto& [offset, size] : arena.free_ranges)
+            report.arena_free_bytes += size;
+    }
+
+    return report;
+}
+
+const char* Compute::get_memory_category_name(ComputeMemoryCategory category)
+{
+    switch(category)
+    {
+    case ComputeMemoryCategory::Geometry: return "Geometry";
+    case ComputeMemoryCategory::Textures: return "Textures";
+    case ComputeMemoryCategory::Environment: return "Environment";
+    case ComputeMemoryCategory::RenderTargets: return "Render targets";
+    case ComputeMemoryCategory::Readback: return "Readback";
+    case ComputeMemoryCategory::Uploads: return "Uploads";
+    default: return "Other";
+    }
+}
+
+void Compute::release_empty_arenas()
+{
+    u32 released_arena_count = 0;
+
+    for(auto& arena : compute.arenas)
+    {
+        reclaim_retired_ranges(arena);
+
+        // Ranges still fenced by queued work keep their arena
+        if(arena.byte_size == 0 || arena.live_allocations > 0 || !arena.retired_ranges.empty())
+            continue;
+
+        arena = MemoryArena();
+        released_arena_count++;
+    }
+
+    if(released_arena_count > 0)
+    {
+        LOGDEBUG(std::format("Released {} empty memory arenas.", released_arena_count));
+    }
+}
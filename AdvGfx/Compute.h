@@ -1,5 +1,11 @@
 #pragma once
 
+#include <future>
+#include <map>
+#include <optional>
+
+struct ComputeOperation;
+
 enum class ComputeKernelState
 {
 	Empty,
@@ -16,24 +22,208 @@ enum class ComputeKernelRecompilationCondition
 	SourceChanged
 };
 
+enum class ComputeDeviceType
+{
+	GPU,
+	CPU,
+	Any
+};
+
+struct ComputeInitDesc
+{
+	ComputeDeviceType device_type { ComputeDeviceType::GPU };
+	std::string device_name { "" };		// Part of the device name, empty matches any device
+	i32 device_index { 0 };				// Index into the matching devices
+	bool use_multiple_devices { false };	// Also use the other devices of the selected platform
+	i32 cpu_sub_device_count { 0 };		// Partitions a CPU device into sub-devices, only with multiple devices
+};
+
+// Outcome of a kernel build, produced on a worker thread and applied on the main thread
+struct ComputeKernelBuild
+{
+	cl::Kernel cl_kernel;
+	bool succeeded { false };
+	bool cache_hit { false };
+	bool has_common_source { false };
+	std::string error_message;
+};
+
+// -D defines a kernel is specialized with, sorted so equal sets always map to the same variant
+struct ComputeDefines
+{
+	ComputeDefines& set(const std::string& name, i64 value);
+	// For defines that change how buffers are read, a variant only stands in for another if these match
+	ComputeDefines& set_layout(const std::string& name, i64 value);
+
+	std::string to_build_options() const;
+	ComputeDefines get_layout_defines() const;
+
+	bool operator==(const ComputeDefines& other) const = default;
+
+private:
+	std::map<std::string, i64> values;
+	std::map<std::string, i64> layout_values;
+};
+
+// One build of a kernel for a specific set of defines
+struct ComputeKernelVariant
+{
+	bool is_valid() const;
+
+	std::string defines;
+	ComputeKernelState state { ComputeKernelState::Empty };
+	cl::Kernel cl_kernel;
+	std::future<ComputeKernelBuild> pending_build;
+	bool rebuild_requested { false };
+
+	// Smallest CL_KERNEL_WORK_GROUP_SIZE over all devices, defines change register use and so this limit
+	usize max_work_group_size { 0 };
+
+	// Operation whose arguments are currently set on cl_kernel, others have to set all of theirs again
+	const ComputeOperation* bound_by { nullptr };
+
+	// Split dispatches, measured per device to size the next split. Variants run at different speeds
+	std::vector<f32> device_rows_per_ms;
+	std::vector<cl::Event> split_events;
+	std::vector<u32> split_rows;
+};
+
+enum class ComputeCommandType
+{
+	Kernel,
+	Upload,
+	Download
+};
+
+// Device side timing of a finished command, from its profiling event
+struct ComputeCommandTiming
+{
+	std::string label;
+	ComputeCommandType type { ComputeCommandType::Kernel };
+	usize byte_size { 0 };
+
+	f32 queued_ms { 0.0f };		// Queued on the host until submitted to the device
+	f32 submitted_ms { 0.0f };	// Submitted until the device started it
+	f32 execution_ms { 0.0f };	// Started until finished
+};
+
+enum class ComputeMemoryCategory
+{
+	Geometry,
+	Textures,
+	Environment,
+	RenderTargets,
+	Readback,
+	Uploads,
+	Other,
+	Count
+};
+
+// Device memory of a buffer, a range of a shared arena or a dedicated allocation. The range is freed on destruction
+struct ComputeAllocation
+{
+	ComputeAllocation() = default;
+	ComputeAllocation(ComputeAllocation&& other) noexcept;
+	ComputeAllocation& operator=(ComputeAllocation&& other) noexcept;
+	ComputeAllocation(const ComputeAllocation&) = delete;
+	ComputeAllocation& operator=(const ComputeAllocation&) = delete;
+	~ComputeAllocation();
+
+	void release();
+
+	static constexpr u32 DEDICATED = UINT32_MAX;
+
+	u32 arena_idx { DEDICATED };
+	usize offset { 0 };
+	usize byte_size { 0 };
+	ComputeMemoryCategory category { ComputeMemoryCategory::Other };
+	bool valid { false };
+};
+
+struct ComputeMemoryReport
+{
+	u64 device_global_bytes { 0 };
+	u64 arena_reserved_bytes { 0 };
+	u64 arena_free_bytes { 0 };
+	u64 dedicated_bytes { 0 };
+	u32 arena_count { 0 };
+	std::array<u64, (usize)ComputeMemoryCategory::Count> category_bytes {};
+};
+
+// How a buffer the kernel writes is put back together after a split dispatch. Every device but the primary one
+// writes a copy of its own, the copies are merged into the buffer on the primary queue before anything reads it
+struct ComputeSplitMerge
+{
+	enum class Type
+	{
+		Rows,		// Row major, a row of data per dispatch row. Devices only write the rows of their band
+		SingleRow,	// Only written by pixels of one row, taken from the device whose band holds it
+		Maximum		// u32 elements, the largest value any device wrote wins
+	};
+
+	static ComputeSplitMerge rows() { return { Type::Rows, 0 }; }
+	static ComputeSplitMerge single_row(u32 row) { return { Type::SingleRow, row }; }
+	static ComputeSplitMerge maximum() { return { Type::Maximum, 0 }; }
+
+	Type type { Type::Rows };
+	u32 row { 0 };
+};
+
+// Local size and pixel mapping of a 2D dispatch
+struct ComputeWorkGroupConfig
+{
+	glm::ivec2 local_size { 0, 0 }; // Zero leaves the local size to the driver
+	bool tile_swizzle { false };
+};
+
+// Tries every candidate config for a number of dispatches, and keeps the fastest one
+struct ComputeWorkGroupTuning
+{
+	ComputeWorkGroupConfig best;
+	bool tuned { false };
+
+	u32 candidate_idx { 0 };
+	u32 sample_count { 0 };
+	f32 sampled_ms { 0.0f };
+	f32 best_ms { 0.0f };
+	cl::Event pending_sample;
+};
+
 // To allow recompilation at runtime
 struct ComputeKernel
 {
 	ComputeKernel(const std::string& path, const std::string& entry_point);
+	// Queues a build of every variant on a worker, the current kernels stay in use until the builds have been applied
 	void compile();
+	// Swaps in finished builds, returns true if any variant changed
+	bool apply_finished_builds();
+	void wait_for_builds();
+	bool is_compiling();
 	bool is_valid();
 	bool has_been_changed();
 
+	// Queues a build the first time a define set is seen. Until it is done the variant with only the layout defines
+	// stands in, if that one isn't built either the returned variant is not valid yet
+	ComputeKernelVariant& get_variant(const ComputeDefines& defines);
+
+	void reset_work_group_tuning();
+
 	std::string path;
 	std::string entry_point;
 
 	friend struct ComputeOperation;
 
 private:
+	void compile_variant(ComputeKernelVariant& variant);
+	ComputeKernelVariant& get_or_create_variant(const std::string& build_options);
+	bool apply_finished_build(ComputeKernelVariant& variant);
+
 	FILETIME last_write_time {};
-	ComputeKernelState state { ComputeKernelState::Empty };
-	cl::Kernel cl_kernel;
-	
+
+	// Keyed by build options, the base variant has none
+	std::unordered_map<std::string, ComputeKernelVariant> variants;
+
+	ComputeWorkGroupTuning tuning;
 };
 
 // To deal with templated c++ garbage
@@ -42,8 +232,8 @@ struct ComputeDataHandle
 {
 	inline ComputeDataHandle() {};
 
-	template<typename T>
-	inline ComputeDataHandle(const std::vector<T>& data)
+	template<typename T, typename Allocator>
+	inline ComputeDataHandle(const std::vector<T, Allocator>& data)
 	{
 		size_t data_size = sizeof(T);
 		size_t data_count = data.size();
@@ -63,6 +253,7 @@ struct ComputeDataHandle
 	friend struct ComputeReadBuffer;
 	friend struct ComputeWriteBuffer;
 	friend struct ComputeReadWriteBuffer;
+	friend struct ComputeGrowableBuffer;
 private:
 	void* data_ptr { nullptr };
 	size_t data_byte_size { 0 };
@@ -70,44 +261,131 @@ private:
 
 struct ComputeReadBuffer
 {
-	ComputeReadBuffer(const ComputeDataHandle& data);
+	ComputeReadBuffer(const ComputeDataHandle& data, ComputeMemoryCategory category = ComputeMemoryCategory::Readback);
 
 	friend struct ComputeOperation;
 private:
 	cl::Buffer internal_buffer;
+	ComputeAllocation allocation;
 	ComputeDataHandle data_handle;
+	bool aliases_host_memory { false };
 };
 
 struct ComputeWriteBuffer
 {
-	ComputeWriteBuffer(const ComputeDataHandle& data);
+	ComputeWriteBuffer(const ComputeDataHandle& data, ComputeMemoryCategory category = ComputeMemoryCategory::Other);
+	// Blocking, the host data may change right after
 	void update(const ComputeDataHandle& data);
 
 	friend struct ComputeOperation;
 private:
 	cl::Buffer internal_buffer;
+	ComputeAllocation allocation;
+	ComputeDataHandle data_handle;
 };
 
 struct ComputeReadWriteBuffer
 {
-	ComputeReadWriteBuffer(const ComputeDataHandle& data);
+	ComputeReadWriteBuffer(const ComputeDataHandle& data, ComputeMemoryCategory category = ComputeMemoryCategory::Other);
+
+	// Enqueued operations read back without blocking, the host data is only complete after this
+	void wait_for_read_back() const;
 
 	friend struct ComputeOperation;
 private:
 	cl::Buffer internal_buffer;
+	ComputeAllocation allocation;
 	ComputeDataHandle data_handle;
+	bool aliases_host_memory { false };
+
+	// Set by the operation that last read this buffer back
+	mutable cl::Event read_back_event;
+};
+
+// Device buffer with spare capacity, updates only upload the bytes that changed
+struct ComputeGrowableBuffer
+{
+	ComputeGrowableBuffer(ComputeMemoryCategory category);
+
+	// Data is the full host copy, everything from dirty_byte_offset on is uploaded. Grows geometrically,
+	// bytes before the offset are copied over on the device. Blocking, the host data may change right after
+	void update(const ComputeDataHandle& data, size_t dirty_byte_offset);
+
+	// Uploads one range of the host copy, the data has to be what was last passed to update(). Blocking as well
+	void update_range(const ComputeDataHandle& data, size_t byte_offset, size_t range_byte_size);
+	// Same, for callers without a host copy. The source holds just the range
+	void update_range(const void* source, size_t byte_offset, size_t range_byte_size);
+
+	// Sizes the buffer without uploading anything, for contents that are only ever written in ranges
+	void resize(size_t new_byte_size);
+
+	size_t get_byte_size() const;
+
+	friend struct ComputeOperation;
+private:
+	void grow(size_t required_byte_size);
+
+	cl::Buffer internal_buffer;
+	ComputeAllocation allocation;
+	ComputeMemoryCategory category { ComputeMemoryCategory::Other };
+	size_t byte_size { 0 };
+	size_t capacity { 0 };
 };
 
 struct ComputeGPUOnlyBuffer
 {
-	ComputeGPUOnlyBuffer(size_t data_size);
+	ComputeGPUOnlyBuffer(size_t data_size, ComputeMemoryCategory category = ComputeMemoryCategory::RenderTargets);
 
 	cl::Buffer internal_buffer;
+	ComputeAllocation allocation;
+};
+
+// Marks everything queued so far on every device's queue, complete once all of that work has finished
+struct ComputeFence
+{
+	ComputeFence();
+
+	bool is_complete() const;
+
+private:
+	std::vector<cl::Event> markers;
+};
+
+// Ring of pinned host frames, lets the device render frame N+1 while the host presents frame N
+struct ComputeFrameRing
+{
+	ComputeFrameRing(size_t frame_byte_size, u32 frame_count);
+	~ComputeFrameRing();
+
+	// Queues a non-blocking copy of the device output into the next host frame
+	void enqueue_readback(const ComputeGPUOnlyBuffer& source);
+
+	// Returns the frame queued before the latest one (waiting for it if needed), nullptr if nothing was queued yet
+	void* acquire_presentable_frame();
+
+	// Waits until no readback is copying into the frame anymore, a later readback may have reused it since it was acquired
+	void wait_for_frame(const void* host_ptr);
+
+private:
+	struct Frame
+	{
+		cl::Buffer pinned_buffer;
+		cl::Event ready;
+		void* host_ptr { nullptr };
+		u64 sequence { 0 };
+		bool in_flight { false };
+	};
+
+	std::vector<Frame> frames;
+	size_t frame_byte_size { 0 };
+	u32 next_frame_idx { 0 };
+	u64 latest_sequence { 0 };
+	u64 presented_sequence { 0 };
 };
 
 struct ComputeOperation
 {
-	ComputeOperation(const std::string& kernel_name);
+	ComputeOperation(const std::string& kernel_name, const ComputeDefines& defines = {});
 
 	ComputeOperation& write(const ComputeDataHandle& data);
 
@@ -115,32 +393,110 @@ struct ComputeOperation
 
 	ComputeOperation& write(const ComputeGPUOnlyBuffer& buffer);
 
+	ComputeOperation& write(const ComputeGrowableBuffer& buffer);
+
 	// Data should already be resized to accomodate data!
 	// Buffer should not be created inline
-	ComputeOperation& read(const ComputeReadBuffer& buffer);
+	// The merge only matters for split dispatches
+	ComputeOperation& read(const ComputeReadBuffer& buffer, ComputeSplitMerge merge = ComputeSplitMerge::rows());
 
-	ComputeOperation& read(const ComputeGPUOnlyBuffer& buffer);
+	ComputeOperation& read(const ComputeGPUOnlyBuffer& buffer, ComputeSplitMerge merge = ComputeSplitMerge::rows());
 
-	ComputeOperation& read_write(const ComputeReadWriteBuffer& buffer);
+	ComputeOperation& read_write(const ComputeReadWriteBuffer& buffer, ComputeSplitMerge merge = ComputeSplitMerge::rows());
 
-	ComputeOperation& read_write(const ComputeGPUOnlyBuffer& buffer);
+	ComputeOperation& read_write(const ComputeGPUOnlyBuffer& buffer, ComputeSplitMerge merge = ComputeSplitMerge::rows());
 
 	ComputeOperation& global_dispatch(glm::ivec3 size);
 
+	// Distributes rows of the dispatch over all devices, balanced by their measured throughput. Buffers the kernel
+	// writes are merged as given when binding them
+	ComputeOperation& split_across_devices();
+
+	// Picks the local size and pixel mapping through the autotuner, the kernel has to fetch its pixel with
+	// get_pixel_coordinates() and bounds check it, as the global size is rounded up to the local size
+	ComputeOperation& autotune_work_groups();
+
+	// Runs the kernel and waits for it, read buffers are up to date afterwards
 	void execute();
+
+	// Queues the kernel and its readbacks without waiting, read buffers must outlive the queued work
+	void enqueue();
 	
-private:
+protected:
+	void dispatch(cl_bool blocking);
+	void dispatch_split(ComputeKernelVariant& variant, const ComputeWorkGroupConfig& config);
+
+	// Only marks the argument as changed if it refers to a different buffer than last time. Buffers the kernel writes
+	// come with a merge
+	void bind_arg(const cl::Buffer& buffer, const ComputeSplitMerge* merge = nullptr);
+
+	// The copies of written buffers the other devices of a split dispatch use, and merging them back
+	void prepare_split_copies(u32 device_idx, u32 first_row, u32 row_count);
+	void merge_split_copies(u32 device_idx, u32 first_row, u32 row_count);
+
+	// Copies the data into the next buffer of a small upload ring, only used by passes
+	const cl::Buffer& upload_frame_data(const ComputeDataHandle& data);
+
+	// Looks up the variant for the current defines and config, cached as long as neither changes
+	ComputeKernelVariant* resolve_variant(ComputeWorkGroupConfig& config, cl::Event*& sample_event);
+
+	// Returns the config for this dispatch, and starts measuring it if the kernel is still being tuned
+	ComputeWorkGroupConfig select_work_group_config(cl::Event*& sample_event);
+
 	struct read_destination
 	{
 		ComputeDataHandle data_handle;
 		cl::Buffer buffer;
 	};
 
-	int arg_count { 0 };
-
 	glm::ivec3 global_dispatch_size{1, 1, 1};
+	bool split { false };
+	bool autotune { false };
 
 	ComputeKernel* kernel { nullptr };
+	std::string kernel_name;
+	ComputeDefines defines;
+
+	// Set on the kernel variant at dispatch, the variant depends on the selected work-group config
+	std::vector<cl::Buffer> kernel_args;
+	std::vector<u8> changed_args;
+	u32 arg_cursor { 0 };
+
+	// Parallel to the arguments, empty for buffers the kernel only reads
+	std::vector<std::optional<ComputeSplitMerge>> arg_merges;
+
+	struct SplitCopy
+	{
+		cl::Buffer buffer;
+		ComputeAllocation allocation;
+	};
+
+	// Per device (the primary one has none) and argument, kept from one split dispatch to the next
+	std::vector<std::vector<SplitCopy>> split_copies;
+
+	ComputeKernelVariant* resolved_variant { nullptr };
+	ComputeDefines resolved_defines;
+	bool resolved_tile_swizzle { false };
+	bool resolved_stand_in { false };
+
+	static constexpr u32 FRAME_UPLOAD_SLOTS = 4;
+
+	struct FrameUpload
+	{
+		struct Slot
+		{
+			cl::Buffer buffer;
+			cl::Event uploaded;
+			std::vector<u8> staging;
+		};
+
+		std::array<Slot, FRAME_UPLOAD_SLOTS> slots;
+		u32 next_slot { 0 };
+	};
+
+	bool persistent { false };
+	u32 upload_cursor { 0 };
+	std::vector<FrameUpload> frame_uploads;
 
 	std::vector<ComputeWriteBuffer> write_buffers_non_persistent;
 	std::vector<ComputeReadBuffer const *> read_buffers;
@@ -148,13 +504,47 @@ private:
 
 };
 
+// An operation that is kept around and replayed every frame, only arguments that changed are set on the kernel again.
+// Per-frame data is uploaded into buffers owned by the pass instead of creating new ones.
+struct ComputePass : ComputeOperation
+{
+	ComputePass(const std::string& kernel_name);
+
+	// Starts recording this frame's arguments, they have to be given in the same order every frame
+	ComputeOperation& begin(const ComputeDefines& defines = {});
+
+	// Queues the build of a variant ahead of its first use, so Compute::wait_for_kernels() covers it
+	void prepare_variant(const ComputeDefines& defines);
+};
+
 namespace Compute
 {
-	void init();
+	void init(const ComputeInitDesc& desc);
 
 	void create_kernel(const std::string& path, const std::string& entry_point);
 
 	bool recompile_kernels(ComputeKernelRecompilationCondition condition);
+	// Blocks until all queued kernel builds are done, used during startup
+	void wait_for_kernels();
 
 	bool kernel_exists(const std::string& kernel_name);
+
+	// Discards the stored work-group configs, autotuned kernels are tuned again over the next frames
+	void retune_work_groups();
+
+	// Returns timings of every profiled command that finished since the last call, unfinished ones are returned later
+	std::vector<ComputeCommandTiming> collect_command_timings();
+
+	// Bytes per category against the size of the primary device
+	ComputeMemoryReport get_memory_report();
+	const char* get_memory_category_name(ComputeMemoryCategory category);
+
+	// Releases arenas nothing lives in anymore, meant for after a scene (re)load. Live ranges are never moved,
+	// so an arena that still holds anything stays as fragmented as it is
+	void release_empty_arenas();
+
+	u32 get_device_count();
+
+	// Blocks until everything queued so far is done, e.g. before freeing host memory a readback may still write to
+	void finish();
 }
\ No newline at end of file
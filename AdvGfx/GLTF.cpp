@@ -0,0 +1,569 @@
+#include "GLTF.h"
+
+#include "BVH.h"
+
+#include <span>
+
+const u32 GLB_MAGIC = 0x46546c67; // "glTF"
+const u32 GLB_CHUNK_JSON = 0x4e4f534a; // "JSON"
+const u32 GLB_CHUNK_BIN = 0x004e4942; // "BIN\0"
+
+const u32 GLTF_MODE_TRIANGLES = 4;
+const u32 GLTF_MAX_NODE_DEPTH = 64;
+
+const u32 GLTF_BYTE = 5120;
+const u32 GLTF_UNSIGNED_BYTE = 5121;
+const u32 GLTF_SHORT = 5122;
+const u32 GLTF_UNSIGNED_SHORT = 5123;
+const u32 GLTF_UNSIGNED_INT = 5125;
+const u32 GLTF_FLOAT = 5126;
+
+struct GLBHeader
+{
+	u32 magic;
+	u32 version;
+	u32 byte_size;
+};
+
+struct GLBChunkHeader
+{
+	u32 byte_size;
+	u32 type;
+};
+
+// Parsed json plus a span for every buffer, which point into the mapped .glb or the storage below
+struct GLTFDocument
+{
+	MappedFile file;
+	json root;
+	std::vector<std::span<const u8>> buffers;
+
+	std::vector<std::unique_ptr<MappedFile>> external_buffers;
+	std::vector<std::vector<u8>> decoded_buffers;
+};
+
+// Typed, strided window onto a buffer view
+struct AccessorView
+{
+	const u8* data { nullptr };
+	u32 count { 0 };
+	u32 stride { 0 };
+	u32 component_type { 0 };
+	u32 component_count { 0 };
+};
+
+u32 get_component_byte_size(u32 component_type)
+{
+	switch(component_type)
+	{
+		case GLTF_BYTE:
+		case GLTF_UNSIGNED_BYTE:	return 1;
+		case GLTF_SHORT:
+		case GLTF_UNSIGNED_SHORT:	return 2;
+		case GLTF_UNSIGNED_INT:
+		case GLTF_FLOAT:			return 4;
+		default:					return 0;
+	}
+}
+
+u32 get_component_count(const std::string& type)
+{
+	switch(hashstr(type.c_str()))
+	{
+		case hashstr("SCALAR"):	return 1;
+		case hashstr("VEC2"):	return 2;
+		case hashstr("VEC3"):	return 3;
+		case hashstr("VEC4"):	return 4;
+		default:				return 0;
+	}
+}
+
+// Only embedded base64 buffers use this, everything else is read in place
+bool decode_base64(std::string_view encoded, std::vector<u8>& decoded)
+{
+	auto get_sextet = [](char c) -> i32
+	{
+		if(c >= 'A' && c <= 'Z') return c - 'A';
+		if(c >= 'a' && c <= 'z') return c - 'a' + 26;
+		if(c >= '0' && c <= '9') return c - '0' + 52;
+		if(c == '+') return 62;
+		if(c == '/') return 63;
+		return -1;
+	};
+
+	decoded.clear();
+	decoded.reserve(encoded.size() / 4 * 3);
+
+	u32 bits = 0;
+	i32 bit_count = 0;
+
+	for(char c : encoded)
+	{
+		if(c == '=')
+			break;
+
+		i32 sextet = get_sextet(c);
+		if(sextet < 0)
+			return false;
+
+		bits = (bits << 6) | (u32)sextet;
+		bit_count += 6;
+
+		if(bit_count >= 8)
+		{
+			bit_count -= 8;
+			decoded.push_back((u8)(bits >> bit_count));
+		}
+	}
+
+	return true;
+}
+
+bool open_glb(GLTFDocument& document, const std::string& path)
+{
+	const u8* data = document.file.data;
+	u64 byte_size = document.file.byte_size;
+
+	if(byte_size < sizeof(GLBHeader) + sizeof(GLBChunkHeader))
+		return false;
+
+	const GLBHeader& header = *(const GLBHeader*)data;
+
+	if(header.magic != GLB_MAGIC || header.version != 2 || header.byte_size > byte_size)
+	{
+		LOGERROR(std::format("{} is not a glTF 2.0 binary", path));
+		return false;
+	}
+
+	std::span<const u8> bin_chunk;
+	u64 offset = sizeof(GLBHeader);
+
+	while(offset + sizeof(GLBChunkHeader) <= header.byte_size)
+	{
+		const GLBChunkHeader& chunk = *(const GLBChunkHeader*)(data + offset);
+		const u8* chunk_data = data + offset + sizeof(GLBChunkHeader);
+
+		if(offset + sizeof(GLBChunkHeader) + chunk.byte_size > header.byte_size)
+			return false;
+
+		if(chunk.type == GLB_CHUNK_JSON)
+			document.root = json::parse(chunk_data, chunk_data + chunk.byte_size, nullptr, false);
+		else if(chunk.type == GLB_CHUNK_BIN && bin_chunk.empty())
+			bin_chunk = { chunk_data, chunk.byte_size };
+
+		offset += sizeof(GLBChunkHeader) + chunk.byte_size;
+	}
+
+	if(!document.root.is_object())
+		return false;
+
+	// The first buffer without an uri is the BIN chunk
+	for(const auto& buffer : document.root.value("buffers", json::array()))
+		document.buffers.push_back(buffer.contains("uri") ? std::span<const u8>() : bin_chunk);
+
+	return true;
+}
+
+bool open_gltf(GLTFDocument& document, const std::string& path)
+{
+	const char* text = (const char*)document.file.data;
+	document.root = json::parse(text, text + document.file.byte_size, nullptr, false);
+
+	if(!document.root.is_object())
+		return false;
+
+	for(const auto& buffer : document.root.value("buffers", json::array()))
+		document.buffers.push_back({});
+
+	return true;
+}
+
+// External and embedded buffers, the BIN chunk of a .glb has already been resolved
+bool resolve_buffer_uris(GLTFDocument& document, const std::string& path)
+{
+	std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+	const json& buffers = document.root.value("buffers", json::array());
+
+	document.decoded_buffers.reserve(buffers.size());
+
+	for(usize i = 0; i < buffers.size(); i++)
+	{
+		if(!buffers[i].contains("uri"))
+			continue;
+
+		std::string uri = buffers[i]["uri"];
+
+		if(uri.starts_with("data:"))
+		{
+			usize data_start = uri.find(";base64,");
+
+			if(data_start == std::string::npos)
+				return false;
+
+			auto& decoded = document.decoded_buffers.emplace_back();
+
+			if(!decode_base64(std::string_view(uri).substr(data_start + 8), decoded))
+				return false;
+
+			document.buffers[i] = decoded;
+		}
+		else
+		{
+			auto& external_buffer = document.external_buffers.emplace_back(std::make_unique<MappedFile>());
+
+			if(!external_buffer->open(directory + uri))
+			{
+				LOGERROR(std::format("Failed to open buffer {} of {}", uri, path));
+				return false;
+			}
+
+			document.buffers[i] = { external_buffer->data, external_buffer->byte_size };
+		}
+	}
+
+	return true;
+}
+
+// Validates the accessor against its buffer view, so reads through the view never leave the buffer
+bool get_accessor(const GLTFDocument& document, i32 accessor_idx, AccessorView& view)
+{
+	if(accessor_idx < 0 || !document.root.contains("accessors") || !document.root.contains("bufferViews"))
+		return false;
+
+	const json& accessors = document.root["accessors"];
+	const json& buffer_views = document.root["bufferViews"];
+
+	if(accessor_idx >= (i32)accessors.size())
+		return false;
+
+	const json& accessor = accessors[accessor_idx];
+
+	if(accessor.contains("sparse") || !accessor.contains("bufferView") || accessor["bufferView"].get<u32>() >= buffer_views.size())
+		return false;
+
+	const json& buffer_view = buffer_views[accessor["bufferView"].get<u32>()];
+	u32 buffer_idx = buffer_view.value("buffer", (u32)document.buffers.size());
+
+	if(buffer_idx >= document.buffers.size())
+		return false;
+
+	std::span<const u8> buffer = document.buffers[buffer_idx];
+
+	view.component_type = accessor.value("componentType", 0u);
+	view.component_count = get_component_count(accessor.value("type", std::string()));
+	view.count = accessor.value("count", 0u);
+
+	u32 element_byte_size = get_component_byte_size(view.component_type) * view.component_count;
+	view.stride = buffer_view.value("byteStride", element_byte_size);
+
+	u64 view_offset = buffer_view.value("byteOffset", 0ull);
+	u64 view_byte_size = buffer_view.value("byteLength", 0ull);
+	u64 accessor_offset = accessor.value("byteOffset", 0ull);
+
+	if(element_byte_size == 0 || view_offset + view_byte_size > buffer.size())
+		return false;
+
+	if(view.count > 0 && accessor_offset + (u64)(view.count - 1) * view.stride + element_byte_size > view_byte_size)
+		return false;
+
+	view.data = buffer.data() + view_offset + accessor_offset;
+	return true;
+}
+
+template<typename T>
+T read_element(const AccessorView& view, u32 idx)
+{
+	T value;
+	memcpy(&value, view.data + (u64)idx * view.stride, sizeof(T));
+	return value;
+}
+
+// Index accessors are validated with is_index_accessor, anything else reads as out of range
+u32 read_index(const AccessorView& view, u32 idx)
+{
+	switch(view.component_type)
+	{
+		case GLTF_UNSIGNED_BYTE:	return read_element<u8>(view, idx);
+		case GLTF_UNSIGNED_SHORT:	return read_element<u16>(view, idx);
+		case GLTF_UNSIGNED_INT:		return read_element<u32>(view, idx);
+		default:					return UINT32_MAX;
+	}
+}
+
+bool is_index_accessor(const AccessorView& view)
+{
+	bool is_unsigned = view.component_type == GLTF_UNSIGNED_BYTE || view.component_type == GLTF_UNSIGNED_SHORT || view.component_type == GLTF_UNSIGNED_INT;
+
+	return is_unsigned && view.component_count == 1;
+}
+
+bool is_float_accessor(const AccessorView& view, u32 component_count)
+{
+	return view.component_type == GLTF_FLOAT && view.component_count == component_count;
+}
+
+bool load_primitive(const GLTFDocument& document, const json& primitive, Mesh& mesh)
+{
+	if(primitive.value("mode", GLTF_MODE_TRIANGLES) != GLTF_MODE_TRIANGLES || !primitive.contains("attributes") || !primitive["attributes"].is_object())
+		return false;
+
+	const json& attributes = primitive["attributes"];
+
+	AccessorView positions;
+	if(!get_accessor(document, attributes.value("POSITION", -1), positions) || !is_float_accessor(positions, 3))
+		return false;
+
+	AccessorView normals;
+	bool has_normals = get_accessor(document, attributes.value("NORMAL", -1), normals) && is_float_accessor(normals, 3) && normals.count == positions.count;
+
+	AccessorView uvs;
+	mesh.has_uvs = get_accessor(document, attributes.value("TEXCOORD_0", -1), uvs) && is_float_accessor(uvs, 2) && uvs.count == positions.count;
+
+	AccessorView indices;
+	bool has_indices = primitive.contains("indices");
+
+	if(has_indices && (!get_accessor(document, primitive["indices"], indices) || !is_index_accessor(indices)))
+		return false;
+
+	u32 tri_count = (has_indices ? indices.count : positions.count) / 3;
+	mesh.tri_indices.resize(tri_count);
+
+	for(u32 t = 0; t < tri_count; t++)
+	{
+		for(u32 j = 0; j < 3; j++)
+		{
+			u32 i = t * 3 + j;
+			u32 index = has_indices ? read_index(indices, i) : i;
+
+			if(index >= positions.count)
+				return false;
+
+			mesh.tri_indices[t].vertex_idx[j] = index;
+		}
+	}
+
+	if(has_normals)
+	{
+		mesh.vertex_positions.resize(positions.count);
+		mesh.vertex_data.resize(positions.count);
+
+		for(u32 v = 0; v < positions.count; v++)
+		{
+			mesh.vertex_positions[v] = glm::vec4(read_element<glm::vec3>(positions, v), 0.0f);
+			mesh.vertex_data[v].normal = read_element<glm::vec3>(normals, v);
+
+			if(mesh.has_uvs)
+				mesh.vertex_data[v].uv = read_element<glm::vec2>(uvs, v);
+		}
+	}
+	else
+	{
+		// Without normals every corner gets its own vertex, so the triangles can be shaded flat
+		mesh.vertex_positions.resize(tri_count * 3);
+		mesh.vertex_data.resize(tri_count * 3);
+
+		for(u32 t = 0; t < tri_count; t++)
+		{
+			glm::vec3 corners[3];
+			for(u32 j = 0; j < 3; j++)
+				corners[j] = read_element<glm::vec3>(positions, mesh.tri_indices[t].vertex_idx[j]);
+
+			glm::vec3 normal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+			normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f, 0.0f, 1.0f);
+
+			for(u32 j = 0; j < 3; j++)
+			{
+				u32 v = t * 3 + j;
+
+				mesh.vertex_positions[v] = glm::vec4(corners[j], 0.0f);
+				mesh.vertex_data[v].normal = normal;
+
+				if(mesh.has_uvs)
+					mesh.vertex_data[v].uv = read_element<glm::vec2>(uvs, mesh.tri_indices[t].vertex_idx[j]);
+
+				mesh.tri_indices[t].vertex_idx[j] = v;
+			}
+		}
+	}
+
+	mesh.reconstruct_bvh();
+
+	return true;
+}
+
+// Malformed transforms are left out (identity), the node itself is still placed
+glm::mat4 get_node_transform(const json& node)
+{
+	if(node.contains("matrix"))
+	{
+		std::vector<f32> elements = node.value("matrix", std::vector<f32>{});
+
+		if(elements.size() != 16)
+			return glm::identity<glm::mat4>();
+
+		// Column major, same as glm
+		glm::mat4 matrix;
+		for(u32 i = 0; i < 16; i++)
+			matrix[i / 4][i % 4] = elements[i];
+
+		return matrix;
+	}
+
+	std::vector<f32> translation = node.value("translation", std::vector<f32>{ 0.0f, 0.0f, 0.0f });
+	std::vector<f32> rotation = node.value("rotation", std::vector<f32>{ 0.0f, 0.0f, 0.0f, 1.0f });
+	std::vector<f32> scale = node.value("scale", std::vector<f32>{ 1.0f, 1.0f, 1.0f });
+
+	if(translation.size() != 3 || rotation.size() != 4 || scale.size() != 3)
+		return glm::identity<glm::mat4>();
+
+	glm::mat4 transform = glm::translate(glm::identity<glm::mat4>(), glm::vec3(translation[0], translation[1], translation[2]));
+	transform *= glm::mat4_cast(glm::quat(rotation[3], rotation[0], rotation[1], rotation[2]));
+	transform = glm::scale(transform, glm::vec3(scale[0], scale[1], scale[2]));
+
+	return transform;
+}
+
+// Every primitive of a node's mesh becomes an instance, so repeated meshes are stored once
+void add_node_instances(const json& nodes, u32 node_idx, const glm::mat4& parent_transform, const std::vector<std::vector<i32>>& primitive_mesh_idxs, Model& model, u32 depth)
+{
+	if(node_idx >= nodes.size() || depth > GLTF_MAX_NODE_DEPTH)
+		return;
+
+	const json& node = nodes[node_idx];
+	glm::mat4 transform = parent_transform * get_node_transform(node);
+
+	u32 gltf_mesh_idx = node.value("mesh", (u32)primitive_mesh_idxs.size());
+
+	if(gltf_mesh_idx < primitive_mesh_idxs.size())
+	{
+		for(i32 mesh_idx : primitive_mesh_idxs[gltf_mesh_idx])
+		{
+			if(mesh_idx < 0)
+				continue;
+
+			ModelInstance instance;
+			instance.transform = transform;
+			instance.mesh_idx = (u32)mesh_idx;
+			model.instances.push_back(instance);
+		}
+	}
+
+	for(u32 child_idx : node.value("children", std::vector<u32>{}))
+		add_node_instances(nodes, child_idx, transform, primitive_mesh_idxs, model, depth + 1);
+}
+
+bool load_file(const std::string& path, Model& model)
+{
+	Timer load_timer;
+	load_timer.start();
+
+	GLTFDocument document;
+
+	if(!document.file.open(path))
+	{
+		LOGERROR(std::format("Failed to open {}", path));
+		return false;
+	}
+
+	bool is_binary = path.ends_with(".glb");
+	bool opened = is_binary ? open_glb(document, path) : open_gltf(document, path);
+
+	if(!opened || !resolve_buffer_uris(document, path))
+	{
+		LOGERROR(std::format("Failed to parse {}", path));
+		return false;
+	}
+
+	f32 parsed_ms = load_timer.lap_delta();
+
+	std::string file_name = get_file_name_from_path_string(path);
+	const json& gltf_meshes = document.root.value("meshes", json::array());
+
+	usize primitive_count = 0;
+	for(const auto& gltf_mesh : gltf_meshes)
+		primitive_count += gltf_mesh.value("primitives", json::array()).size();
+
+	// Model mesh index of every primitive, -1 if it was skipped
+	std::vector<std::vector<i32>> primitive_mesh_idxs(gltf_meshes.size());
+
+	for(usize m = 0; m < gltf_meshes.size(); m++)
+	{
+		const json& primitives = gltf_meshes[m].value("primitives", json::array());
+
+		for(usize p = 0; p < primitives.size(); p++)
+		{
+			Mesh mesh;
+
+			// Single primitive files keep the plain file name
+			mesh.name = primitive_count == 1 ? file_name : std::format("{}#{}.{}", file_name, m, p);
+
+			if(!load_primitive(document, primitives[p], mesh))
+			{
+				LOGDEFAULT(std::format("Skipped primitive {} of {}, it is not an indexed or plain triangle list with float positions", mesh.name, path));
+				primitive_mesh_idxs[m].push_back(-1);
+				continue;
+			}
+
+			primitive_mesh_idxs[m].push_back((i32)model.meshes.size());
+			model.meshes.push_back(std::move(mesh));
+		}
+	}
+
+	f32 built_ms = load_timer.lap_delta();
+
+	// Instances from the default scene, or from every root node if there are no scenes
+	const json& nodes = document.root.value("nodes", json::array());
+	std::vector<u32> root_nodes;
+
+	u32 scene_idx = document.root.value("scene", 0u);
+
+	if(document.root.contains("scenes") && scene_idx < document.root["scenes"].size())
+	{
+		root_nodes = document.root["scenes"][scene_idx].value("nodes", std::vector<u32>{});
+	}
+	else
+	{
+		std::vector<bool> is_child(nodes.size(), false);
+		for(const auto& node : nodes)
+			for(u32 child_idx : node.value("children", std::vector<u32>{}))
+				if(child_idx < is_child.size())
+					is_child[child_idx] = true;
+
+		for(u32 i = 0; i < nodes.size(); i++)
+			if(!is_child[i])
+				root_nodes.push_back(i);
+	}
+
+	for(u32 node_idx : root_nodes)
+		add_node_instances(nodes, node_idx, glm::identity<glm::mat4>(), primitive_mesh_idxs, model, 0);
+
+	// A file without nodes still places each of its meshes once
+	if(model.instances.empty())
+	{
+		for(u32 i = 0; i < model.meshes.size(); i++)
+		{
+			ModelInstance instance;
+			instance.mesh_idx = i;
+			model.instances.push_back(instance);
+		}
+	}
+
+	LOGDEBUG(std::format("Loaded {} with {} meshes and {} instances | Parsed in {} ms | Built in {} ms", file_name, model.meshes.size(), model.instances.size(), (u32)parsed_ms, (u32)built_ms));
+
+	return !model.meshes.empty();
+}
+
+bool GLTF::load(const std::string& path, Model& model)
+{
+	// Accessing a value of the wrong type throws, a malformed file fails to load as a whole
+	try
+	{
+		return load_file(path, model);
+	}
+	catch(const json::exception& exception)
+	{
+		LOGERROR(std::format("Failed to load {}: {}", path, exception.what()));
+		model = Model();
+		return false;
+	}
+}
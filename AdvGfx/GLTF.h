@@ -0,0 +1,10 @@
+#pragma once
+
+#include "Mesh.h"
+
+namespace GLTF
+{
+	// Imports every triangle primitive of a .gltf or .glb file, the node hierarchy becomes instances of them.
+	// Attributes are read in place from the mapped file (or its decoded buffers), sparse accessors are not supported
+	bool load(const std::string& path, Model& model);
+}
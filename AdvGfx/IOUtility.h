@@ -4,7 +4,49 @@ std::string get_current_directory_path();
 std::string read_file_to_string(const std::string& path);
 std::string get_file_name_from_path_string(const std::string& path);
 
+// Size and write time of a file, enough to notice it changed
+bool get_file_stamp(const std::string& path, u64& byte_size, i64& write_time);
+
+// Read-only mapping of a whole file
+struct MappedFile
+{
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	bool open(const std::string& path);
+	void close();
+
+	const u8* data { nullptr };
+	u64 byte_size { 0 };
+
+private:
+	HANDLE file { INVALID_HANDLE_VALUE };
+	HANDLE mapping { nullptr };
+};
+
 // Taken from: https://stackoverflow.com/questions/65195841/hash-function-to-switch-on-a-string
 inline constexpr u64 hashstr(const char* s, size_t index = 0) {
     return s + index == nullptr || s[index] == '\0' ? 55 : hashstr(s, index + 1) * 33 + (unsigned char)(s[index]);
 }
+
+
+// 64 bit FNV-1a, chain calls by passing the previous result as hash
+inline u64 hash_bytes(const void* data, usize byte_size, u64 hash = 14695981039346656037ull)
+{
+	const u8* bytes = (const u8*)data;
+
+	for(usize i = 0; i < byte_size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+inline u64 hash_string(const std::string& string, u64 hash = 14695981039346656037ull)
+{
+	return hash_bytes(string.data(), string.size(), hash);
+}
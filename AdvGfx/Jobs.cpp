@@ -0,0 +1,98 @@
+#include "Jobs.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+static struct JobSystem
+{
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> queue;
+	std::mutex queue_mutex;
+	std::condition_variable queue_condition;
+	bool stopping { false };
+
+	// exit() can be called without going through terminate, joinable threads would abort the process
+	~JobSystem()
+	{
+		Jobs::terminate();
+	}
+} internal;
+
+void worker_loop()
+{
+	while(true)
+	{
+		std::function<void()> task;
+
+		{
+			std::unique_lock<std::mutex> lock(internal.queue_mutex);
+			internal.queue_condition.wait(lock, [] { return internal.stopping || !internal.queue.empty(); });
+
+			if(internal.stopping && internal.queue.empty())
+				return;
+
+			task = std::move(internal.queue.front());
+			internal.queue.pop_front();
+		}
+
+		task();
+	}
+}
+
+void Jobs::init()
+{
+	if(!internal.workers.empty())
+		return;
+
+	internal.stopping = false;
+
+	// Leave one core for the render loop
+	u32 worker_count = glm::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+	for(u32 i = 0; i < worker_count; i++)
+		internal.workers.emplace_back(worker_loop);
+
+	LOGDEBUG(std::format("Started {} worker threads.", worker_count));
+}
+
+void Jobs::terminate()
+{
+	{
+		std::lock_guard<std::mutex> lock(internal.queue_mutex);
+		internal.stopping = true;
+	}
+
+	internal.queue_condition.notify_all();
+
+	for(auto& worker : internal.workers)
+	{
+		if(worker.joinable())
+			worker.join();
+	}
+
+	internal.workers.clear();
+}
+
+void Jobs::submit(std::function<void()> task)
+{
+	// No workers (yet), just run it here
+	if(internal.workers.empty())
+	{
+		task();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(internal.queue_mutex);
+		internal.queue.push_back(std::move(task));
+	}
+
+	internal.queue_condition.notify_one();
+}
+
+u32 Jobs::get_worker_count()
+{
+	return (u32)internal.workers.size();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <functional>
+#include <future>
+
+// Small worker pool for work that should not stall the render loop (kernel builds, asset imports)
+namespace Jobs
+{
+	void init();
+	void terminate();
+
+	// Runs the task on a worker thread. Tasks are started in submission order, but with more than one worker they
+	// run concurrently and may finish in any order
+	void submit(std::function<void()> task);
+
+	template <typename Task>
+	auto submit_with_result(Task task) -> std::future<decltype(task())>
+	{
+		using Result = decltype(task());
+
+		// std::function needs to be copyable, so the packaged_task lives behind a shared_ptr
+		auto packaged_task = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+		std::future<Result> result = packaged_task->get_future();
+
+		submit([packaged_task]() { (*packaged_task)(); });
+
+		return result;
+	}
+
+	u32 get_worker_count();
+}
@@ -28,7 +28,9 @@ namespace Log
 		}
 	}
 
+	// Thread-safe, notifications logged by other threads show up once the main thread flushes them
 	void print(Log::MessageType type, const char* file, int line_number, const char* func, const std::string& message);
+	void flush_notifications();
 	
 	std::pair<std::string, MessageType> get_latest_msg();
 }
@@ -1,7 +1,5 @@
 #pragma once
 
-#include "tiny_gltf.h"
-
 // Disabling nameless union/struct warning
 #pragma warning (disable: 4201)
 
@@ -15,6 +13,16 @@ struct VertexData
 	f32 pad_1[2];
 };
 
+// Octahedral normal (two snorm16) and half precision UV, a quarter of VertexData
+struct CompactVertexData
+{
+	u32 normal;
+	u32 uv;
+};
+
+CompactVertexData compact_vertex_data(const VertexData& vertex_data);
+VertexData expand_vertex_data(const CompactVertexData& compact_vertex_data);
+
 struct Tri 
 { 
 	union
@@ -36,82 +44,45 @@ struct Tri
 	};
 };
 
+// Vertex indices of a triangle, relative to the first vertex of its mesh
+struct TriIndices
+{
+	u32 vertex_idx[3];
+};
+
 struct Mesh
 {
-	Mesh(const std::string& path);
-	std::vector<Tri> tris{ };
+	Mesh();
+	Mesh(Mesh&& other) noexcept;
+	Mesh& operator=(Mesh&& other) noexcept;
+	~Mesh();
+
+	// Unique vertices, shared by every triangle that indexes them. The w of a position is unused, it keeps the device layout
+	std::vector<glm::vec4> vertex_positions;
 	std::vector<VertexData> vertex_data;
-	BVH* bvh { nullptr } ;
+	std::vector<TriIndices> tri_indices;
+	std::unique_ptr<BVH> bvh;
 	std::string name { };
 
-	bool has_uvs;
+	bool has_uvs { false };
+
+	// Every triangle with its corners spelled out, as the BVH build and the de-indexed layout want them
+	std::vector<Tri> get_tris() const;
 
 	void reconstruct_bvh();
 };
 
-template <typename T>
-inline std::vector<T> reinterpret_gltf_data_primitive_buffer_as_vector(tinygltf::Accessor& accessor, tinygltf::Model& model)
+// Places one of the model's meshes relative to the model's origin
+struct ModelInstance
 {
-	auto& buffer_view = model.bufferViews[accessor.bufferView];
-	auto& buffer = model.buffers[buffer_view.buffer];
-
-	size_t data_size = tinygltf::GetNumComponentsInType(accessor.type) * tinygltf::GetComponentSizeInBytes(accessor.componentType);
-	size_t data_count = buffer_view.byteLength / data_size;
-
-	std::vector<T> result;
-	result.resize(data_count);
-
-
-	void* data_ptr = (void*)&buffer.data[buffer_view.byteOffset];
-				
-	switch(accessor.componentType)
-	{
-		default:
-			LOGERROR(std::format("Unsupported index type {}", accessor.componentType));
-			break;
-		case 5120: // signed byte
-		{
-			char* casted = (char*)data_ptr;
-			for(int i = 0; i < data_count; i++)
-				result[i] = (T)casted[i];
-			return result;
-		}
-		case 5121: // unsigned byte
-		{
-			unsigned char* casted = (unsigned char*)data_ptr;
-			for(int i = 0; i < data_count; i++)
-				result[i] = (T)casted[i];
-			return result;
-		}
-		case 5122: // signed short
-		{
-			short* casted = (short*)data_ptr;
-			for(int i = 0; i < data_count; i++)
-				result[i] = (T)casted[i];
-			return result;
-		}
-		case 5123: // unsigned short
-		{
-			unsigned short* casted = (unsigned short*)data_ptr;
-			for(int i = 0; i < data_count; i++)
-				result[i] = (T)casted[i];
-			return result;
-		}
-		case 5125: // unsigned int
-		{
-			unsigned int* casted = (unsigned int*)data_ptr;
-			for(int i = 0; i < data_count; i++)
-				result[i] = (T)casted[i];
-			return result;
-		}
-		case 5126: // float
-		{
-			float* casted = (float*)data_ptr;
-			for(int i = 0; i < data_count; i++)
-				result[i] = (T)casted[i];
-			return result;
-		}
-	}
+	glm::mat4 transform { glm::identity<glm::mat4>() };
+	u32 mesh_idx { 0 };
+	u32 pad[3] { };
+};
 
-	return result;
-}
\ No newline at end of file
+// Every mesh in a source file, and where the file's node hierarchy places them
+struct Model
+{
+	std::vector<Mesh> meshes;
+	std::vector<ModelInstance> instances;
+};
\ No newline at end of file
@@ -0,0 +1,177 @@
+#include "MeshFile.h"
+
+#include <fstream>
+
+const u64 MESH_FILE_ALIGNMENT = 64;
+
+u64 align_mesh_file_offset(u64 offset)
+{
+	return ((offset + MESH_FILE_ALIGNMENT - 1) / MESH_FILE_ALIGNMENT) * MESH_FILE_ALIGNMENT;
+}
+
+std::string MeshFile::get_baked_path(const std::string& source_path)
+{
+	std::string file_name = get_file_name_from_path_string(source_path);
+
+	return std::format("{}\\mesh_cache\\{}_{:016x}.pmesh", get_current_directory_path(), file_name, hash_string(source_path));
+}
+
+MeshView MeshFile::get_view(const Mesh& mesh)
+{
+	MeshView view;
+	view.name = mesh.name;
+	view.vertex_positions = mesh.vertex_positions;
+	view.vertex_data = mesh.vertex_data;
+	view.tri_indices = mesh.tri_indices;
+	view.bvh_nodes = mesh.bvh->nodes;
+	view.tri_idxs = mesh.bvh->primitive_idx;
+
+	return view;
+}
+
+bool MeshFile::write(const std::string& path, const std::string& source_path, const Model& model)
+{
+	MeshFileHeader header;
+
+	if(!get_file_stamp(source_path, header.source_byte_size, header.source_write_time))
+		return false;
+
+	header.mesh_count = (u32)model.meshes.size();
+	header.instance_count = (u32)model.instances.size();
+
+	header.meshes_offset = align_mesh_file_offset(sizeof(MeshFileHeader));
+	header.instances_offset = align_mesh_file_offset(header.meshes_offset + header.mesh_count * sizeof(MeshFileEntry));
+
+	std::vector<MeshFileEntry> entries(model.meshes.size());
+	u64 offset = header.instances_offset + header.instance_count * sizeof(ModelInstance);
+
+	for(usize i = 0; i < model.meshes.size(); i++)
+	{
+		const Mesh& mesh = model.meshes[i];
+		MeshFileEntry& entry = entries[i];
+
+		mesh.name.copy(entry.name, MESH_FILE_NAME_LENGTH - 1);
+
+		entry.vertex_count = (u32)mesh.vertex_positions.size();
+		entry.tri_count = (u32)mesh.tri_indices.size();
+		entry.bvh_node_count = (u32)mesh.bvh->nodes.size();
+		entry.tri_idx_count = (u32)mesh.bvh->primitive_idx.size();
+
+		entry.vertex_positions_offset = align_mesh_file_offset(offset);
+		entry.vertex_data_offset = align_mesh_file_offset(entry.vertex_positions_offset + entry.vertex_count * sizeof(glm::vec4));
+		entry.tri_indices_offset = align_mesh_file_offset(entry.vertex_data_offset + entry.vertex_count * sizeof(VertexData));
+		entry.bvh_nodes_offset = align_mesh_file_offset(entry.tri_indices_offset + entry.tri_count * sizeof(TriIndices));
+		entry.tri_idx_offset = align_mesh_file_offset(entry.bvh_nodes_offset + entry.bvh_node_count * sizeof(BVHNode));
+
+		offset = entry.tri_idx_offset + entry.tri_idx_count * sizeof(u32);
+	}
+
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+	// Written to a temporary file first, so a crash never leaves a truncated bake behind
+	std::string temporary_path = path + ".tmp";
+	std::ofstream f(temporary_path, std::ios::binary | std::ios::trunc);
+
+	if(!f.good())
+		return false;
+
+	auto write_at = [&f](u64 offset, const void* data, usize byte_size)
+	{
+		static const char padding[MESH_FILE_ALIGNMENT] {};
+		f.write(padding, offset - (u64)f.tellp());
+		f.write((const char*)data, byte_size);
+	};
+
+	write_at(0, &header, sizeof(MeshFileHeader));
+	write_at(header.meshes_offset, entries.data(), entries.size() * sizeof(MeshFileEntry));
+	write_at(header.instances_offset, model.instances.data(), model.instances.size() * sizeof(ModelInstance));
+
+	for(usize i = 0; i < model.meshes.size(); i++)
+	{
+		const Mesh& mesh = model.meshes[i];
+
+		write_at(entries[i].vertex_positions_offset, mesh.vertex_positions.data(), mesh.vertex_positions.size() * sizeof(glm::vec4));
+		write_at(entries[i].vertex_data_offset, mesh.vertex_data.data(), mesh.vertex_data.size() * sizeof(VertexData));
+		write_at(entries[i].tri_indices_offset, mesh.tri_indices.data(), mesh.tri_indices.size() * sizeof(TriIndices));
+		write_at(entries[i].bvh_nodes_offset, mesh.bvh->nodes.data(), mesh.bvh->nodes.size() * sizeof(BVHNode));
+		write_at(entries[i].tri_idx_offset, mesh.bvh->primitive_idx.data(), mesh.bvh->primitive_idx.size() * sizeof(u32));
+	}
+
+	f.close();
+
+	if(f.fail())
+		return false;
+
+	std::filesystem::rename(temporary_path, path, error);
+	return !error;
+}
+
+bool MappedMeshFile::open(const std::string& path, const std::string& source_path)
+{
+	close();
+
+	if(!file.open(path) || file.byte_size < sizeof(MeshFileHeader))
+	{
+		close();
+		return false;
+	}
+
+	const MeshFileHeader& header = *(const MeshFileHeader*)file.data;
+
+	u64 source_byte_size = 0;
+	i64 source_write_time = 0;
+	bool source_found = get_file_stamp(source_path, source_byte_size, source_write_time);
+
+	// A missing source is fine, the bake is all that is needed
+	bool up_to_date = header.magic == MESH_FILE_MAGIC && header.version == MESH_FILE_VERSION
+		&& (!source_found || (header.source_byte_size == source_byte_size && header.source_write_time == source_write_time));
+
+	bool tables_fit = header.meshes_offset + (u64)header.mesh_count * sizeof(MeshFileEntry) <= file.byte_size
+		&& header.instances_offset + (u64)header.instance_count * sizeof(ModelInstance) <= file.byte_size;
+
+	if(!up_to_date || !tables_fit)
+	{
+		close();
+		return false;
+	}
+
+	const MeshFileEntry* entries = (const MeshFileEntry*)(file.data + header.meshes_offset);
+
+	for(u32 i = 0; i < header.mesh_count; i++)
+	{
+		const MeshFileEntry& entry = entries[i];
+
+		u64 end_offset = glm::max(
+			glm::max(entry.vertex_positions_offset + (u64)entry.vertex_count * sizeof(glm::vec4), entry.vertex_data_offset + (u64)entry.vertex_count * sizeof(VertexData)),
+			glm::max(entry.bvh_nodes_offset + (u64)entry.bvh_node_count * sizeof(BVHNode), entry.tri_idx_offset + (u64)entry.tri_idx_count * sizeof(u32)));
+
+		end_offset = glm::max(end_offset, entry.tri_indices_offset + (u64)entry.tri_count * sizeof(TriIndices));
+
+		if(end_offset > file.byte_size)
+		{
+			close();
+			return false;
+		}
+
+		MeshView& view = meshes.emplace_back();
+		view.name = std::string(entry.name, strnlen(entry.name, MESH_FILE_NAME_LENGTH));
+		view.vertex_positions = { (const glm::vec4*)(file.data + entry.vertex_positions_offset), entry.vertex_count };
+		view.vertex_data = { (const VertexData*)(file.data + entry.vertex_data_offset), entry.vertex_count };
+		view.tri_indices = { (const TriIndices*)(file.data + entry.tri_indices_offset), entry.tri_count };
+		view.bvh_nodes = { (const BVHNode*)(file.data + entry.bvh_nodes_offset), entry.bvh_node_count };
+		view.tri_idxs = { (const u32*)(file.data + entry.tri_idx_offset), entry.tri_idx_count };
+	}
+
+	instances = { (const ModelInstance*)(file.data + header.instances_offset), header.instance_count };
+
+	return true;
+}
+
+void MappedMeshFile::close()
+{
+	meshes.clear();
+	instances = {};
+
+	file.close();
+}
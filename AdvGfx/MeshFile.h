@@ -0,0 +1,81 @@
+#pragma once
+
+#include <span>
+
+#include "Mesh.h"
+#include "BVH.h"
+
+// Baked models (.pmesh): a header, a table of meshes and the model's instances, followed by the arrays exactly as the device reads them
+const u32 MESH_FILE_MAGIC = 0x48534d50; // "PMSH"
+const u32 MESH_FILE_VERSION = 3;
+
+const u32 MESH_FILE_NAME_LENGTH = 64;
+
+struct MeshFileHeader
+{
+	u32 magic { MESH_FILE_MAGIC };
+	u32 version { MESH_FILE_VERSION };
+
+	// The source file the model was baked from, a mismatch means the bake is stale
+	u64 source_byte_size { 0 };
+	i64 source_write_time { 0 };
+
+	u32 mesh_count { 0 };
+	u32 instance_count { 0 };
+
+	// Byte offsets from the start of the file, to an array of MeshFileEntry and of ModelInstance
+	u64 meshes_offset { 0 };
+	u64 instances_offset { 0 };
+};
+
+struct MeshFileEntry
+{
+	char name[MESH_FILE_NAME_LENGTH] { };
+
+	u32 vertex_count { 0 };
+	u32 tri_count { 0 };
+	u32 bvh_node_count { 0 };
+	u32 tri_idx_count { 0 };
+
+	// Each array starts on a 64 byte boundary, positions and vertex data both hold vertex_count elements
+	u64 vertex_positions_offset { 0 };
+	u64 vertex_data_offset { 0 };
+	u64 tri_indices_offset { 0 };
+	u64 bvh_nodes_offset { 0 };
+	u64 tri_idx_offset { 0 };
+};
+
+// Device ready arrays of a mesh, owned by a Mesh or pointing into a mapped file
+struct MeshView
+{
+	std::string name;
+	std::span<const glm::vec4> vertex_positions;
+	std::span<const VertexData> vertex_data;
+	std::span<const TriIndices> tri_indices;
+	std::span<const BVHNode> bvh_nodes;
+	std::span<const u32> tri_idxs;
+};
+
+// Read-only mapping of a .pmesh file, the views stay valid as long as the mapping is open
+struct MappedMeshFile
+{
+	// Fails if the file is missing, truncated, of another version or baked from another revision of the source
+	bool open(const std::string& path, const std::string& source_path);
+	void close();
+
+	std::vector<MeshView> meshes;
+	std::span<const ModelInstance> instances;
+
+private:
+	MappedFile file;
+};
+
+namespace MeshFile
+{
+	// Where the baked version of a source model lives
+	std::string get_baked_path(const std::string& source_path);
+
+	MeshView get_view(const Mesh& mesh);
+
+	bool write(const std::string& path, const std::string& source_path, const Model& model);
+}
@@ -26,6 +26,7 @@ struct Section
 	Timer timer;
 
 	void log_slice(const std::string& slice_name);
+	void add_value(const std::string& slice_name, f32 value);
 
 	inline Section()
 	{
@@ -44,17 +45,24 @@ struct
 } internal;
 
 void Section::log_slice(const std::string& slice_name)
+{
+	f32 elapsed = timer.lap_delta();
+	add_value(slice_name, elapsed);
+}
+
+// Values are stored per slice, one row of frame_track_count frames each, which is the layout PlotBarGroups expects
+void Section::add_value(const std::string& slice_name, f32 value)
 {
 	auto slice_entry = slice_to_index.find(slice_name);
 	bool entry_exists = slice_entry != slice_to_index.end();
 
 	if (entry_exists)
 	{
-		values[internal.current_frame + slice_entry->second * frame_track_count] = timer.lap_delta();
+		values[internal.current_frame + slice_entry->second * frame_track_count] += value;
 	}
 	else
 	{
-		if (slice_count == 16)
+		if (slice_count == slice_count_per_section)
 		{
 			LOGERROR(std::format("\"{} \"tried to log performance slice \"{}\", went over the slice limit of {}!", name, slice_name, slice_count_per_section));
 			return;
@@ -62,11 +70,28 @@ void Section::log_slice(const std::string& slice_name)
 
 		slice_names[slice_count] = (slice_name);
 		slice_to_index.insert({slice_name, slice_count});
-		values[slice_count_per_section * internal.current_frame + slice_count] = timer.lap_delta();
+		values[internal.current_frame + slice_count * frame_track_count] = value;
 		slice_count++;
 	}
 }
 
+Section& find_or_add_section(const std::string& section_name)
+{
+	auto section_entry = internal.section_name_to_index.find(section_name);
+
+	if (section_entry != internal.section_name_to_index.end())
+		return internal.sections[section_entry->second];
+
+	internal.sections.push_back(Section());
+	internal.section_name_to_index.insert({section_name, internal.sections.size() - 1});
+
+	auto& section = internal.sections.back();
+	section.name = section_name;
+	section.timer.start();
+
+	return section;
+}
+
 void perf::new_frame()
 {
 	internal.current_frame = (internal.current_frame + 1) % frame_track_count;
@@ -83,26 +108,30 @@ void perf::new_frame()
 
 void perf::log_section(const std::string& section_name)
 {
-	internal.sections.push_back(Section());
-	internal.section_name_to_index.insert({section_name, internal.sections.size() - 1});
-	auto& section = internal.sections.back();
-
+	auto& section = find_or_add_section(section_name);
 	section.timer.start();
-	section.name = section_name;
+
+	internal.current_section_name = section_name;
 }
 
 void perf::log_slice(const std::string& slice_name)
 {
-	internal.sections[internal.section_name_to_index[slice_name]].log_slice(slice_name);
+	find_or_add_section(internal.current_section_name).log_slice(slice_name);
+}
+
+void perf::log_value(const std::string& section_name, const std::string& slice_name, f32 value)
+{
+	find_or_add_section(section_name).add_value(slice_name, value);
 }
 
 void perf::draw_section_implot_graph(const std::string& section_name)
 {
 	bool section_exists = internal.section_name_to_index.find(section_name) != internal.section_name_to_index.end();
 
+	// Sections fed by log_value() only exist once something has been logged
 	if (!section_exists)
 	{
-		LOGERROR(std::format("Tried to draw non-existant performance slice \"{}\"!", section_name));
+		ImGui::TextDisabled("No data for \"%s\" yet.", section_name.c_str());
 		return;
 	}
 
@@ -112,10 +141,11 @@ void perf::draw_section_implot_graph(const std::string& section_name)
 		
 		// Converting std::string to const char* for ImPlot
 		std::vector<const char*> label_ids;
-		for (auto& name : section.slice_names) 
-			label_ids.push_back(name.data());
+		for (u32 i = 0; i < section.slice_count; i++) 
+			label_ids.push_back(section.slice_names[i].data());
 
-		ImPlot::PlotBarGroups(label_ids.data(), section.values, slice_count_per_section, frame_track_count, 1.0f, 0.0f, ImPlotBarGroupsFlags_Stacked);
+		if (section.slice_count > 0)
+			ImPlot::PlotBarGroups(label_ids.data(), section.values, section.slice_count, frame_track_count, 1.0f, 0.0f, ImPlotBarGroupsFlags_Stacked);
 
 		ImPlot::EndPlot();
 	}
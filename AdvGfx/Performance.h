@@ -7,5 +7,8 @@ namespace perf
 	void log_section(const std::string& section_name);
 	void log_slice(const std::string& slice_name);
 
+	// Adds a value measured elsewhere (device timings, byte counts) to a slice of the current frame
+	void log_value(const std::string& section_name, const std::string& slice_name, f32 value);
+
 	void draw_section_implot_graph(const std::string& section_name);
 }
\ No newline at end of file
@@ -12,8 +12,7 @@
 
 #include "Performance.h"
 
-#define TINYGLTF_IMPLEMENTATION
-#include "tiny_gltf.h"
+#include <fstream>
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -73,6 +72,24 @@ namespace Raytracer
 	{
 		i32 accumulated_frame_limit		{ 32 };
 		i32 fps_limit					{ 80 };
+		i32 output_frame_count			{ 2 }; // Frames in flight between device and presentation
+		i32 max_depth					{ 16 };
+		f32 texture_lod_bias			{ 0.0f }; // In mip levels, positive is blurrier
+
+		// Device selection, applied on startup
+		std::string device_type			{ "gpu" }; // "gpu", "cpu" or "any"
+		std::string device_name			{ "" };
+		i32 device_index				{ 0 };
+		i32 cpu_sub_device_count		{ 0 };
+		bool use_multiple_devices		{ false };
+
+		// Geometry layout, applied on startup
+		bool indexed_geometry			{ true };
+		bool compact_vertex_data		{ true };
+
+		// Texture format and streaming pool size, applied on startup
+		bool compress_textures			{ true };
+		i32 texture_pool_megabytes		{ 256 };
 
 		bool show_onscreen_log			{ true };
 		bool accumulate_frames			{ true };
@@ -93,7 +110,10 @@ namespace Raytracer
 		glm::mat4 inv_old_camera_transform	{ glm::identity<glm::mat4>() };
 		f32 exr_angle					{ 0.0f };
 		u32 material_idx				{ 0 };
-		u32 pad[2];
+		f32 pixel_spread_angle			{ 0.0f };
+		f32 texture_lod_bias			{ 0.0f };
+		u32 frame_number				{ 0 };
+		u32 instance_count				{ 0 };
 	} scene_data;
 
 	struct WavefrontData
@@ -108,7 +128,7 @@ namespace Raytracer
 		i32 selected_instance_idx		{ -1 }; // Signed so we can easily tell if they are valid or not (kind of a waste, also kind of not since its 1 bit who cares)
 		i32 hovered_instance_idx		{ -1 };
 
-		u32* buffer						{ nullptr };
+		u32* buffer						{ nullptr }; // Last presented frame
 
 		bool show_debug_ui				{ false };
 		bool render_dirty				{ true };
@@ -127,6 +147,9 @@ namespace Raytracer
 		ComputeWriteBuffer* exr_buffer{ nullptr };
 		ComputeGPUOnlyBuffer* gpu_accumulation_buffer { nullptr };
 		ComputeGPUOnlyBuffer* gpu_detail_buffer{ nullptr };
+		ComputeGPUOnlyBuffer* gpu_render_buffer{ nullptr };
+
+		ComputeFrameRing* output_frames{ nullptr };
 
 		ComputeGPUOnlyBuffer* gpu_extend_output_buffer{ nullptr };
 
@@ -134,9 +157,30 @@ namespace Raytracer
 
 		ComputeReadWriteBuffer* gpu_wavefront_buffer{ nullptr };
 
+		ComputeReadBuffer* gpu_hovered_instance_buffer{ nullptr };
+		ComputeReadBuffer* gpu_distance_to_hovered_buffer{ nullptr };
+
+		// Recorded once, replayed every frame
+		ComputePass* generate_rays_pass{ nullptr };
+		ComputePass* trace_pass{ nullptr };
+		ComputePass* finalize_pass{ nullptr };
+
 		//std::vector<DiskAsset> exr_assets_on_disk;
-		f32* loaded_exr_data { nullptr };
-		std::string current_exr { "None" };
+		// Shown until the first skybox is in, and the skybox switch_skybox() is waiting on
+		std::vector<u16> placeholder_exr_data { 0, 0, 0 };
+		std::string pending_skybox { "" };
+
+		// Replaced skyboxes, deleted once the frames that read them are done
+		struct RetiredExrBuffer
+		{
+			ComputeWriteBuffer* buffer;
+			ComputeFence fence;
+		};
+
+		std::vector<RetiredExrBuffer> retired_exr_buffers;
+
+		// Set by every scene load, empty arenas are released once the assets the scene asked for are in
+		bool release_arenas_after_imports { false };
 
 		u32 active_camera_idx { 0 };
 		std::vector<Camera::Instance> cameras;
@@ -147,13 +191,6 @@ namespace Raytracer
 	// Resizes buffers and sets internal state
 	void resize(const RaytracerResizeDesc& desc)
 	{
-		bool replace_buffer = desc.new_buffer_ptr != nullptr;
-
-		if(replace_buffer)
-		{
-			internal.buffer = desc.new_buffer_ptr;
-		}
-
 		internal.render_width_px = desc.width_px;
 		internal.render_height_px = desc.height_px;
 		scene_data.resolution[0] = desc.width_px;
@@ -166,7 +203,6 @@ namespace Raytracer
 		RaytracerResizeDesc resize_desc;
 		resize_desc.width_px = desc.width_px;
 		resize_desc.height_px = desc.height_px;
-		resize_desc.new_buffer_ptr = desc.screen_buffer_ptr;
 
 		resize(resize_desc);
 	}
@@ -189,20 +225,70 @@ namespace Raytracer
 			TryFromJSONVal(save_data, settings, accumulate_frames);
 			TryFromJSONVal(save_data, settings, limit_accumulated_frames);
 			TryFromJSONVal(save_data, settings, fps_limit_enabled);
+			TryFromJSONVal(save_data, settings, output_frame_count);
+			TryFromJSONVal(save_data, settings, max_depth);
+			TryFromJSONVal(save_data, settings, texture_lod_bias);
+			TryFromJSONVal(save_data, settings, device_type);
+			TryFromJSONVal(save_data, settings, device_name);
+			TryFromJSONVal(save_data, settings, device_index);
+			TryFromJSONVal(save_data, settings, cpu_sub_device_count);
+			TryFromJSONVal(save_data, settings, use_multiple_devices);
+			TryFromJSONVal(save_data, settings, indexed_geometry);
+			TryFromJSONVal(save_data, settings, compact_vertex_data);
+			TryFromJSONVal(save_data, settings, compress_textures);
+			TryFromJSONVal(save_data, settings, texture_pool_megabytes);
 			TryFromJSONVal(save_data, internal, cameras);
 		}
 
+		// Double or triple buffering, anything more only adds latency
+		settings.output_frame_count = glm::clamp(settings.output_frame_count, 2, 3);
+		settings.max_depth = glm::clamp(settings.max_depth, 1, 32);
+
 		if(internal.cameras.empty())
 			internal.cameras.push_back(Camera::Instance());
 	}
 
-	void switch_skybox(u32 index)
+	// Loads on a worker, the current skybox stays until update_skybox() swaps the new one in
+	void switch_skybox(const std::string& file_name)
+	{
+		Assets::request_files({ file_name });
+
+		internal.pending_skybox = file_name;
+	}
+
+	// The world only names the skybox once it is in, so a failed load keeps the previous one
+	void update_skybox()
 	{
-		auto& exr = Assets::get_exr_by_index(index);
-		delete internal.exr_buffer;
-		internal.exr_buffer = new ComputeWriteBuffer({ exr.data, (usize)(exr.width * exr.height * 4) });
-		scene_data.exr_size[0] = exr.width;
-		scene_data.exr_size[1] = exr.height;
+		std::erase_if(internal.retired_exr_buffers, [](const auto& retired)
+		{
+			if(!retired.fence.is_complete())
+				return false;
+
+			delete retired.buffer;
+			return true;
+		});
+
+		if(internal.pending_skybox.empty() || Assets::is_import_pending(internal.pending_skybox))
+			return;
+
+		std::string file_name = internal.pending_skybox;
+		const EXR_CPU* exr = Assets::get_exr(file_name);
+		internal.pending_skybox = "";
+
+		if(exr == nullptr)
+		{
+			LOGERROR(std::format("Could not load skybox {}", file_name));
+			return;
+		}
+
+		// Frames in flight still read the old one
+		internal.retired_exr_buffers.push_back({ internal.exr_buffer, ComputeFence() });
+
+		internal.exr_buffer = new ComputeWriteBuffer(exr->data, ComputeMemoryCategory::Environment);
+		scene_data.exr_size[0] = exr->width;
+		scene_data.exr_size[1] = exr->height;
+
+		World::set_skybox_name(file_name);
 
 		internal.render_dirty = true;
 	}
@@ -217,12 +303,65 @@ namespace Raytracer
 		glm::vec4 geo_normal;
 	};
 
+	void init_compute()
+	{
+		ComputeInitDesc compute_desc;
+		compute_desc.device_name = settings.device_name;
+		compute_desc.device_index = settings.device_index;
+		compute_desc.use_multiple_devices = settings.use_multiple_devices;
+		compute_desc.cpu_sub_device_count = settings.cpu_sub_device_count;
+
+		if(settings.device_type == "cpu")
+			compute_desc.device_type = ComputeDeviceType::CPU;
+		else if(settings.device_type == "any")
+			compute_desc.device_type = ComputeDeviceType::Any;
+		else
+			compute_desc.device_type = ComputeDeviceType::GPU;
+
+		Compute::init(compute_desc);
+	}
+
+	// Specializes rt_trace for the current scene and settings, anything left undefined is decided at runtime
+	ComputeDefines get_trace_defines()
+	{
+		ComputeDefines defines;
+		defines.set("DEPTH", settings.max_depth);
+		defines.set("NO_TEXTURES", Assets::get_texture_count() == 0);
+		defines.set("DEBUG_VIEWS", internal.view_type != ViewType::Render);
+		defines.set_layout("INDEXED_GEOMETRY", Assets::uses_indexed_geometry());
+		defines.set_layout("COMPACT_VERTEX_DATA", Assets::uses_compact_vertex_data());
+
+		i32 single_material_type = World::get_single_material_type();
+
+		if(single_material_type >= 0)
+			defines.set("SINGLE_MATERIAL_TYPE", single_material_type);
+
+		return defines;
+	}
+
+	// Requests only what the scene references, the first frames render while it loads
+	void load_scene()
+	{
+		World::deserialize_scene();
+
+		// A scene without a skybox gets the first one on disk
+		const auto& disk_exrs = Assets::get_disk_files_by_extension("exr");
+
+		if(!World::get_skybox_name().empty())
+			switch_skybox(World::get_skybox_name());
+		else if(!disk_exrs.empty())
+			switch_skybox(disk_exrs.front().file_name);
+
+		internal.release_arenas_after_imports = true;
+	}
+
 	void init(const RaytracerInitDesc& desc)
 	{
-		Compute::init();
+		// Settings pick the device, so they are loaded first
+		init_load_saved_data();
+		init_compute();
 
 		init_internal(desc);
-		init_load_saved_data();
 
 		u32 render_area_px = internal.render_width_px * internal.render_height_px;
 
@@ -230,16 +369,41 @@ namespace Raytracer
 
 		internal.gpu_accumulation_buffer = new ComputeGPUOnlyBuffer((usize)(render_area_px * internal.render_channel_count * sizeof(float)));
 		internal.gpu_detail_buffer = new ComputeGPUOnlyBuffer((usize)(render_area_px * sizeof(PerPixelData)));
+		internal.gpu_render_buffer = new ComputeGPUOnlyBuffer((usize)(render_area_px * sizeof(u32)));
+		internal.output_frames = new ComputeFrameRing((usize)(render_area_px * sizeof(u32)), (u32)settings.output_frame_count);
 		internal.gpu_primary_ray_buffer = new ComputeGPUOnlyBuffer((usize)(render_area_px * GPU_RAY_STRUCT_SIZE)); // TODO: This is hardcoded, it should not be!
 		internal.gpu_extend_output_buffer = new ComputeGPUOnlyBuffer((usize)(render_area_px * (48 + GPU_RAY_STRUCT_SIZE))); // TODO: This is hardcoded, it should not be!
 
 		internal.gpu_wavefront_buffer = new ComputeReadWriteBuffer(ComputeDataHandle(&wavefront, 1));
 
-		Assets::init();
+		internal.gpu_hovered_instance_buffer = new ComputeReadBuffer({&internal.hovered_instance_idx, 1});
+		internal.gpu_distance_to_hovered_buffer = new ComputeReadBuffer({&internal.distance_to_hovered, 1});
 
-		switch_skybox(0);
+		AssetsInitDesc assets_desc;
+		assets_desc.indexed_geometry = settings.indexed_geometry;
+		assets_desc.compact_vertex_data = settings.compact_vertex_data;
+		assets_desc.compress_textures = settings.compress_textures;
+		assets_desc.texture_pool_byte_size = (u64)glm::max(settings.texture_pool_megabytes, 1) * 1024 * 1024;
 
-		World::deserialize_scene();
+		Assets::init(assets_desc);
+		World::init();
+
+		internal.generate_rays_pass = new ComputePass("rt_generate_rays.cl");
+		internal.trace_pass = new ComputePass("rt_trace.cl");
+		internal.finalize_pass = new ComputePass("rt_finalize.cl");
+
+		// A black 1x1 environment until the skybox is in
+		internal.exr_buffer = new ComputeWriteBuffer(internal.placeholder_exr_data, ComputeMemoryCategory::Environment);
+		scene_data.exr_size[0] = 1;
+		scene_data.exr_size[1] = 1;
+
+		load_scene();
+
+		// The first frames run this variant, or the one with its layout defines once the scene changes it
+		internal.trace_pass->prepare_variant(get_trace_defines());
+
+		// Kernels have been building in the background while assets were loading
+		Compute::wait_for_kernels();
 	}
 
 	// Saves data such as settings, or world state to phantasma.data.json
@@ -253,6 +417,18 @@ namespace Raytracer
 		ToJSONVal(save_data, settings, accumulate_frames);
 		ToJSONVal(save_data, settings, limit_accumulated_frames);
 		ToJSONVal(save_data, settings, fps_limit_enabled);
+		ToJSONVal(save_data, settings, output_frame_count);
+		ToJSONVal(save_data, settings, max_depth);
+		ToJSONVal(save_data, settings, texture_lod_bias);
+		ToJSONVal(save_data, settings, device_type);
+		ToJSONVal(save_data, settings, device_name);
+		ToJSONVal(save_data, settings, device_index);
+		ToJSONVal(save_data, settings, cpu_sub_device_count);
+		ToJSONVal(save_data, settings, use_multiple_devices);
+		ToJSONVal(save_data, settings, indexed_geometry);
+		ToJSONVal(save_data, settings, compact_vertex_data);
+		ToJSONVal(save_data, settings, compress_textures);
+		ToJSONVal(save_data, settings, texture_pool_megabytes);
 		ToJSONVal(save_data, internal, cameras);
 
 		std::ofstream o("phantasma.data.json");
@@ -261,6 +437,16 @@ namespace Raytracer
 
 	void terminate()
 	{
+		delete internal.output_frames;
+		internal.output_frames = nullptr;
+
+		delete internal.generate_rays_pass;
+		delete internal.trace_pass;
+		delete internal.finalize_pass;
+		internal.generate_rays_pass = nullptr;
+		internal.trace_pass = nullptr;
+		internal.finalize_pass = nullptr;
+
 		World::serialize_scene();
 		terminate_save_data();
 	}
@@ -327,9 +513,38 @@ namespace Raytracer
 		}			
 	}
 
+	// Profiling events resolve a frame or two after being queued, so they land in the frame they are collected in
+	void log_device_timings()
+	{
+		for(auto& timing : Compute::collect_command_timings())
+		{
+			f32 latency_ms = timing.queued_ms + timing.submitted_ms;
+			f32 kilobytes = (f32)timing.byte_size / 1024.0f;
+
+			switch(timing.type)
+			{
+			case ComputeCommandType::Kernel:
+				perf::log_value("device kernels (ms)", timing.label, timing.execution_ms);
+				perf::log_value("device queue latency (ms)", "kernels", latency_ms);
+				break;
+			case ComputeCommandType::Upload:
+				perf::log_value("device transfers (ms)", timing.label, timing.execution_ms);
+				perf::log_value("device transfers (KB)", timing.label, kilobytes);
+				perf::log_value("device queue latency (ms)", "uploads", latency_ms);
+				break;
+			case ComputeCommandType::Download:
+				perf::log_value("device transfers (ms)", timing.label, timing.execution_ms);
+				perf::log_value("device transfers (KB)", timing.label, kilobytes);
+				perf::log_value("device queue latency (ms)", "downloads", latency_ms);
+				break;
+			}
+		}
+	}
+
 	void update(const f32 delta_time_ms)
 	{		
 		perf::new_frame();
+		log_device_timings();
 		update_input();
 
 		auto& active_camera = internal.get_active_camera_ref();
@@ -358,41 +573,49 @@ namespace Raytracer
 
 	// TODO: figure out a better way to do this
 	std::vector<BVHNode> tlas{ BVHNode() };
-	std::vector<u32> tlas_idx{ };
+	std::vector<u32> tlas_idx{ 0 };
 
 	void raytrace_save_render_to_file()
 	{
-		if (!ImGui::IsKeyReleased(ImGuiKey_P))
+		if (!ImGui::IsKeyReleased(ImGuiKey_P) || internal.buffer == nullptr)
 			return;
 
+		internal.output_frames->wait_for_frame(internal.buffer);
+
 		stbi_write_jpg("render.jpg", internal.render_width_px, internal.render_height_px, internal.render_channel_count, internal.buffer, 100);
 		LOGDEBUG("Saved screenshot.");
 	}
 
-	void raytrace_trace_rays(const ComputeReadWriteBuffer& screen_buffer)
+	void raytrace_trace_rays()
 	{
-		ComputeOperation("rt_trace.cl")
+		internal.trace_pass->begin(get_trace_defines())
 			.read_write(*internal.gpu_accumulation_buffer)	
-			.read_write(screen_buffer)
-			.read(ComputeReadBuffer({&internal.hovered_instance_idx, 1}))
-			.read(ComputeReadBuffer({&internal.distance_to_hovered, 1}))
+			.read_write(*internal.gpu_render_buffer)
+			.read(*internal.gpu_hovered_instance_buffer, ComputeSplitMerge::single_row(scene_data.mouse_pos[1]))
+			.read(*internal.gpu_distance_to_hovered_buffer, ComputeSplitMerge::single_row(scene_data.mouse_pos[1]))
 			.write(Assets::get_vertex_data_compute_buffer())
 			.write(Assets::get_tris_compute_buffer())
+			.write(Assets::get_vertex_position_compute_buffer())
+			.write(Assets::get_tri_indices_compute_buffer())
 			.write(Assets::get_bvh_compute_buffer())
 			.write(Assets::get_tri_idx_compute_buffer())
 			.write(Assets::get_mesh_header_buffer())
 			.write(Assets::get_texture_compute_buffer())
 			.write(Assets::get_texture_header_buffer())
+			.write(Assets::get_texture_tile_table_buffer())
+			.read_write(Assets::get_texture_feedback_buffer(), ComputeSplitMerge::maximum())
 			.write({&scene_data, 1})
 			.write(*internal.exr_buffer)
-			.write({&World::get_world_device_data(), 1})
-			.write(World::get_material_vector())
+			.write(World::get_instance_buffer())
+			.write(World::get_material_buffer())
 			.write(tlas)
 			.write(tlas_idx)
 			.read_write(*internal.gpu_detail_buffer)
 			.read_write((*internal.gpu_primary_ray_buffer))
 			.global_dispatch({internal.render_width_px, internal.render_height_px, 1})
-			.execute();
+			.autotune_work_groups()
+			.split_across_devices()
+			.enqueue();
 
 		internal.accumulated_frames++;
 	}
@@ -421,12 +644,17 @@ namespace Raytracer
 		args.camera_fov = 110;
 		args.camera_transform = Camera::get_instance_matrix(active_camera);
 
-		ComputeOperation("rt_generate_rays.cl")
+		// Angle between neighbouring primary rays, where the trace pass starts its ray cones
+		scene_data.pixel_spread_angle = glm::atan(2.0f * glm::tan(glm::radians(args.camera_fov * 0.5f)) / (f32)args.width);
+		scene_data.texture_lod_bias = settings.texture_lod_bias;
+
+		internal.generate_rays_pass->begin()
 			.write({&args, 1})
 			.read_write((*internal.gpu_primary_ray_buffer))
 			.read_write(*internal.gpu_wavefront_buffer)
 			.global_dispatch({internal.render_width_px, internal.render_height_px, 1})
-			.execute();
+			.autotune_work_groups()
+			.enqueue();
 	}
 	
 	void raytrace_extend()
@@ -444,7 +672,7 @@ namespace Raytracer
 			.write(Assets::get_tri_idx_compute_buffer())
 			.write(Assets::get_mesh_header_buffer())
 			.write({ &scene_data, 1 })
-			.write({ &World::get_world_device_data(), 1 })
+			.write(World::get_instance_buffer())
 			.write(tlas)
 			.write(tlas_idx)
 			.read_write(*internal.gpu_detail_buffer)
@@ -452,12 +680,12 @@ namespace Raytracer
 			.read_write(*internal.gpu_wavefront_buffer)
 			.write((*internal.gpu_extend_output_buffer))
 			.global_dispatch({ internal.render_width_px, internal.render_height_px, 1 })
-			.execute();
+			.enqueue();
 
 		internal.accumulated_frames++;
 	}
 
-	void raytrace_shade(const ComputeReadWriteBuffer& screen_buffer)
+	void raytrace_shade()
 	{
 		ComputeOperation("rt_shade.cl")
 			.write(Assets::get_vertex_data_compute_buffer())
@@ -468,15 +696,15 @@ namespace Raytracer
 			.write(Assets::get_texture_header_buffer())
 			.write({ &scene_data, 1 })
 			.write(*internal.exr_buffer)
-			.write({ &World::get_world_device_data(), 1 })
-			.write(World::get_material_vector())
+			.write(World::get_instance_buffer())
+			.write(World::get_material_buffer())
 			.read_write(*internal.gpu_detail_buffer)
-			.read_write(screen_buffer)
+			.read_write(*internal.gpu_render_buffer)
 			.read_write(*internal.gpu_wavefront_buffer)
 			.read_write((*internal.gpu_primary_ray_buffer))
 			.read_write((*internal.gpu_accumulation_buffer))
 			.global_dispatch({ internal.render_width_px, internal.render_height_px, 1 })
-			.execute();
+			.enqueue();
 	}
 
 	void raytrace_connect()
@@ -485,7 +713,7 @@ namespace Raytracer
 	}
 
 	// Averages out acquired samples, and renders them to the screen
-	void raytrace_finalize(const ComputeReadWriteBuffer& screen_buffer)
+	void raytrace_finalize()
 	{
 		struct FinalizeArgs
 		{
@@ -503,19 +731,43 @@ namespace Raytracer
 		args.view_type = internal.view_type;
 		args.selected_object_idx = internal.selected_instance_idx;
 
-		ComputeOperation("rt_finalize.cl")
+		internal.finalize_pass->begin(ComputeDefines().set("VIEW_TYPE", (i64)internal.view_type))
 			.read_write((*internal.gpu_accumulation_buffer))
-			.read_write(screen_buffer)
+			.read_write(*internal.gpu_render_buffer)
 			.write({&args, 1})
 			.read_write(*internal.gpu_detail_buffer)
 			.global_dispatch({internal.render_width_px, internal.render_height_px, 1})
-			.execute();
+			.autotune_work_groups()
+			.enqueue();
 	}
 
 	void raytrace()
 	{
 		perf::log_section("render passes");
 
+		// Assets that finished loading on the workers are swapped in between frames, instances join the TLAS then
+		Assets::update_imports();
+		internal.world_dirty |= World::update_pending_assets();
+		update_skybox();
+
+		// Buffers that grew during loading left their old ranges behind, arenas only those lived in can go
+		if(internal.release_arenas_after_imports && Assets::get_pending_imports().empty())
+		{
+			Compute::release_empty_arenas();
+			internal.release_arenas_after_imports = false;
+		}
+
+		World::commit_device_data();
+		scene_data.instance_count = World::get_mesh_instance_count();
+
+		WorldUploadStats world_uploads = World::get_upload_stats();
+		perf::log_value("world uploads (bytes)", "instances", (f32)world_uploads.instance_byte_size);
+		perf::log_value("world uploads (bytes)", "materials", (f32)world_uploads.material_byte_size);
+
+		// Tiles the last frames asked for, the fallbacks they replace were blurrier so accumulation restarts
+		scene_data.frame_number++;
+		internal.render_dirty |= Assets::update_texture_streaming(scene_data.frame_number);
+
 		if(internal.render_dirty || !settings.accumulate_frames || internal.world_dirty)
 		{
 			scene_data.reset_accumulator = true;
@@ -533,9 +785,6 @@ namespace Raytracer
 		scene_data.inv_old_camera_transform = glm::inverse(scene_data.camera_transform);
 		scene_data.camera_transform = Camera::get_instance_matrix(active_camera);
 
-		u32 render_area = internal.render_width_px * internal.render_height_px;
-		ComputeReadWriteBuffer screen_buffer({internal.buffer, (usize)(render_area)});
-
 		bool accumulate_frames = !(settings.limit_accumulated_frames && (internal.accumulated_frames > (u32)settings.accumulated_frame_limit));
 
 		perf::log_slice("pre render");
@@ -557,7 +806,7 @@ namespace Raytracer
 			raytrace_generate_primary_rays();
 			perf::log_slice("raytrace_generate_primary_rays");
 
-			raytrace_trace_rays(screen_buffer);
+			raytrace_trace_rays();
 			perf::log_slice("raytrace_trace_rays");
 
 			//wavefront.passes = 1;
@@ -566,21 +815,34 @@ namespace Raytracer
 			{
 				//raytrace_extend();
 				//perf::log_slice("raytrace_extend");
-				//raytrace_shade(screen_buffer);
+				//raytrace_shade();
 				//perf::log_slice("raytrace_shade");
 
 				wavefront.passes--;
 			}
 
-			raytrace_finalize(screen_buffer);
+			raytrace_finalize();
 			perf::log_slice("raytrace_finalize");
 
+			// Copied out asynchronously, presented next frame by acquire_frame()
+			internal.output_frames->enqueue_readback(*internal.gpu_render_buffer);
+
 			scene_data.reset_accumulator = false;
 		}
 
 		raytrace_save_render_to_file();
 	}
 
+	const u32* acquire_frame()
+	{
+		u32* presentable_frame = (u32*)internal.output_frames->acquire_presentable_frame();
+
+		if(presentable_frame != nullptr)
+			internal.buffer = presentable_frame;
+
+		return internal.buffer;
+	}
+
 	constexpr std::string material_type_to_string(const MaterialType& type)
 	{
 		switch(type)
@@ -607,30 +869,33 @@ namespace Raytracer
 		return "";
 	}
 
-	void ui_material_editor(Material& material)
+	// True if the material changed
+	bool ui_material_editor(Material& material)
 	{
+		bool changed = false;
+
 		bool is_diffuse = material.type == MaterialType::Diffuse;
 		bool is_metal = material.type == MaterialType::Metal;
 		bool is_dielectric = material.type == MaterialType::Dielectric;
 		bool is_cook_torrance = material.type == MaterialType::CookTorranceBRDF;
 		
-		internal.render_dirty |= ImGui::ColorPicker3("Albedo", glm::value_ptr(material.albedo), ImGuiColorEditFlags_NoInputs);
-		internal.render_dirty |= ImGui::DragFloat("Emissiveness", &material.albedo.a, 0.01f, 0.0f, 100.0f);
+		changed |= ImGui::ColorPicker3("Albedo", glm::value_ptr(material.albedo), ImGuiColorEditFlags_NoInputs);
+		changed |= ImGui::DragFloat("Emissiveness", &material.albedo.a, 0.01f, 0.0f, 100.0f);
 		
 		if(is_dielectric)
-		internal.render_dirty |= ImGui::DragFloat("Absorbtion", &material.absorbtion_coefficient, 0.01f, 0.0f, 1.0f);
+		changed |= ImGui::DragFloat("Absorbtion", &material.absorbtion_coefficient, 0.01f, 0.0f, 1.0f);
 
 		if(is_dielectric)
-		internal.render_dirty |= ImGui::DragFloat("IOR", &material.ior, 0.01f, 1.0f, 2.0f);
+		changed |= ImGui::DragFloat("IOR", &material.ior, 0.01f, 1.0f, 2.0f);
 					
 		if(is_diffuse || is_metal || is_cook_torrance)
-		internal.render_dirty |= ImGui::DragFloat("Specularity", &material.specularity, 0.01f, 0.0f, 1.0f);
+		changed |= ImGui::DragFloat("Specularity", &material.specularity, 0.01f, 0.0f, 1.0f);
 		
 		if(is_cook_torrance)
-		internal.render_dirty |= ImGui::DragFloat("Roughness", &material.roughness, 0.01f, 0.0f, 1.0f);
+		changed |= ImGui::DragFloat("Roughness", &material.roughness, 0.01f, 0.0f, 1.0f);
 
 		if(is_cook_torrance)
-		internal.render_dirty |= ImGui::DragFloat("Metallic", &material.metallic, 0.01f, 0.0f, 1.0f);
+		changed |= ImGui::DragFloat("Metallic", &material.metallic, 0.01f, 0.0f, 1.0f);
 
 		MaterialType old_type = material.type;
 
@@ -648,7 +913,10 @@ namespace Raytracer
 			ImGui::EndCombo();
 		}
 
-		internal.render_dirty |= (material.type != old_type);
+		changed |= (material.type != old_type);
+		internal.render_dirty |= changed;
+
+		return changed;
 	}
 
 	void ui_selected_instance()
@@ -661,7 +929,7 @@ namespace Raytracer
 
 		ImGui::SeparatorText("Transform");
 
-		MeshInstanceHeader& instance = World::get_mesh_device_data(internal.selected_instance_idx);
+		MeshInstanceHeader& instance = World::get_mesh_instance_ref(internal.selected_instance_idx);
 		bool transformed = false;
 
 		glm::vec3 translation;
@@ -673,12 +941,14 @@ namespace Raytracer
 		transformed |= ImGui::InputFloat3("Translation", glm::value_ptr(translation));
 		transformed |= ImGui::InputFloat3("Rotation", glm::value_ptr(rotation));
 		transformed |= ImGui::InputFloat3("Scale", glm::value_ptr(scale));
-				
-		ImGuizmo::RecomposeMatrixFromComponents(glm::value_ptr(translation), glm::value_ptr(rotation), glm::value_ptr(scale), glm::value_ptr(instance.transform));
 
+		// Recomposing an untouched transform would still round it, and change it every frame
 		if(transformed)
 		{
-			instance.inverse_transform = glm::inverse(instance.transform);
+			glm::mat4 transform;
+			ImGuizmo::RecomposeMatrixFromComponents(glm::value_ptr(translation), glm::value_ptr(rotation), glm::value_ptr(scale), glm::value_ptr(transform));
+
+			World::set_instance_transform(internal.selected_instance_idx, transform);
 			internal.render_dirty = true;
 			internal.world_dirty = true;
 		}
@@ -686,17 +956,80 @@ namespace Raytracer
 		ImGui::Dummy({0, 20});
 		ImGui::SeparatorText("Material");
 
-		internal.render_dirty |= ImGui::InputInt("Texture index", &instance.texture_idx, 1, 1);
-		instance.texture_idx = glm::clamp(instance.texture_idx, -1, (i32)Assets::get_texture_count() - 1);
+		// Every image on disk, picking one imports it
+		if(ImGui::BeginCombo("Texture", instance.texture_idx >= 0 ? Assets::get_texture_name(instance.texture_idx).c_str() : "None"))
+		{
+			if(ImGui::Selectable("None", instance.texture_idx < 0))
+			{
+				instance.texture_idx = -1;
+				World::mark_instance_dirty(internal.selected_instance_idx);
+				internal.render_dirty = true;
+			}
+
+			for(const char* extension : { "png", "jpg", "jpeg" })
+			{
+				for(const DiskAsset& image_file : Assets::get_disk_files_by_extension(extension))
+				{
+					bool selected = instance.texture_idx >= 0 && Assets::get_texture_name(instance.texture_idx) == image_file.file_name;
+
+					if(ImGui::Selectable(image_file.file_name.c_str(), selected))
+					{
+						World::set_instance_texture(internal.selected_instance_idx, image_file.file_name);
+						internal.render_dirty = true;
+					}
+				}
+			}
+
+			ImGui::EndCombo();
+		}
 
 		i32 mat_idx_proxy = (i32) instance.material_idx;
 		internal.render_dirty |= ImGui::InputInt("Material", &mat_idx_proxy, 1);
 		if(mat_idx_proxy > (i32)World::get_material_count() - 1)
 			World::add_material();
 		mat_idx_proxy = glm::max(mat_idx_proxy, 0);
-		instance.material_idx = (u32)mat_idx_proxy;
 
-		ui_material_editor(World::get_material_ref(instance.material_idx));
+		if(instance.material_idx != (u32)mat_idx_proxy)
+		{
+			instance.material_idx = (u32)mat_idx_proxy;
+			World::mark_instance_dirty(internal.selected_instance_idx);
+		}
+
+		if(ui_material_editor(World::get_material_ref(instance.material_idx)))
+			World::mark_material_dirty(instance.material_idx);
+	}
+
+	void ui_device_memory()
+	{
+		ComputeMemoryReport report = Compute::get_memory_report();
+
+		auto to_mb = [](u64 bytes) { return (f32)bytes / (1024.0f * 1024.0f); };
+		u64 reserved_bytes = report.arena_reserved_bytes + report.dedicated_bytes;
+
+		ImGui::SeparatorText("Device memory");
+
+		ImGui::ProgressBar((f32)reserved_bytes / (f32)glm::max(report.device_global_bytes, (u64)1), ImVec2(-1, 0),
+			std::format("{:.1f} / {:.1f} MB", to_mb(reserved_bytes), to_mb(report.device_global_bytes)).c_str());
+
+		ImGui::Text("%u arenas, %.1f MB reserved, %.1f MB free", report.arena_count, to_mb(report.arena_reserved_bytes), to_mb(report.arena_free_bytes));
+		ImGui::Text("%.1f MB in dedicated buffers", to_mb(report.dedicated_bytes));
+
+		if(ImGui::BeginTable("Device memory categories", 3, ImGuiTableFlags_RowBg))
+		{
+			for(u32 i = 0; i < (u32)ComputeMemoryCategory::Count; i++)
+			{
+				u64 bytes = report.category_bytes[i];
+
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(Compute::get_memory_category_name((ComputeMemoryCategory)i));
+				ImGui::TableNextColumn();
+				ImGui::Text("%.2f MB", to_mb(bytes));
+				ImGui::TableNextColumn();
+				ImGui::Text("%.2f%%", 100.0 * (f64)bytes / (f64)glm::max(report.device_global_bytes, (u64)1));
+			}
+			ImGui::EndTable();
+		}
 	}
 
 	void ui()
@@ -720,7 +1053,7 @@ namespace Raytracer
 				internal.world_dirty = true;
 			}
 
-			bool selected_index_out_of_range = (i32)World::get_world_device_data().mesh_instance_count <= internal.selected_instance_idx;
+			bool selected_index_out_of_range = (i32)World::get_mesh_instance_count() <= internal.selected_instance_idx;
 
 			if(selected_index_out_of_range)
 			{
@@ -810,6 +1143,12 @@ namespace Raytracer
 			ImGui::SeparatorText("Accumulation & Frames");
 			ImGui::Indent();
 
+			internal.render_dirty |= ImGui::SliderInt("Max depth", &settings.max_depth, 1, 32);
+			internal.render_dirty |= ImGui::SliderFloat("Texture LOD bias", &settings.texture_lod_bias, -4.0f, 4.0f);
+
+			if(ImGui::Button("Retune work-groups"))
+				Compute::retune_work_groups();
+
 			ImGui::Checkbox("Accumulate frames?", &settings.accumulate_frames);
 			if(!settings.accumulate_frames)
 				ImGui::BeginDisabled();
@@ -884,20 +1223,13 @@ namespace Raytracer
 			ImGui::SeparatorText("EXR Settings");
 			ImGui::Indent();
 
-			if(ImGui::BeginCombo("EXRs", internal.current_exr.c_str()))
+			if(ImGui::BeginCombo("EXRs", World::get_skybox_name().c_str()))
 			{
-				u32 idx = 0;
 				for(auto exr : Assets::get_disk_files_by_extension("exr"))
 				{
-					if (ImGui::Selectable((exr.file_name + ".exr").c_str(), exr.file_name == internal.current_exr))
-					{
-						internal.current_exr = exr.file_name;
-						
-						// Load actual exr
-						switch_skybox(idx);
-					}
-
-					idx++;
+					// Loaded on first use
+					if (ImGui::Selectable(exr.file_name.c_str(), exr.file_name == World::get_skybox_name()))
+						switch_skybox(exr.file_name);
 				}
 
 				ImGui::EndCombo();
@@ -906,34 +1238,67 @@ namespace Raytracer
 			ImGui::EndTabItem();
 
 			internal.render_dirty |= ImGui::DragFloat("EXR Angle", &scene_data.exr_angle, 0.1f);
+
+			std::vector<std::string> pending_imports = Assets::get_pending_imports();
+
+			if(!pending_imports.empty())
+			{
+				ImGui::Text("Loading %u assets", (u32)pending_imports.size());
+
+				for(const std::string& file_name : pending_imports)
+					ImGui::BulletText("%s", file_name.c_str());
+			}
 			
 			scene_data.exr_angle = wrap_number(scene_data.exr_angle, 0.0f, 360.0f);
 
-			static std::string selected_mesh_name = Assets::get_disk_files_by_extension("gltf").begin()->file_name;
+			// Files with several primitives import several meshes, so this lists meshes rather than files
 			static u32 selected_mesh_idx = 0;
 			
-			if(ImGui::BeginCombo("Mesh Instances", selected_mesh_name.c_str()))
+			if(ImGui::BeginCombo("Mesh Instances", selected_mesh_idx < Assets::get_mesh_count() ? Assets::get_mesh_name(selected_mesh_idx).c_str() : ""))
 			{
-				u32 idx = 0;
-				for(auto& mesh : Assets::get_disk_files_by_extension("gltf"))
+				for(u32 idx = 0; idx < Assets::get_mesh_count(); idx++)
 				{
-					if (ImGui::Selectable(mesh.file_name.c_str(), mesh.file_name == selected_mesh_name))
-					{
-						selected_mesh_name = mesh.file_name;
+					if (ImGui::Selectable(Assets::get_mesh_name(idx).c_str(), idx == selected_mesh_idx))
 						selected_mesh_idx = idx;
-					}
-					idx++;
 				}
 
 				ImGui::EndCombo();
 			}
 
-			if(ImGui::Button("Add Instance"))
+			if(ImGui::Button("Add Instance") && selected_mesh_idx < Assets::get_mesh_count())
 			{
 				internal.selected_instance_idx = World::add_instance_of_mesh(selected_mesh_idx);
 				internal.world_dirty = true;
 			}
 
+			// Every model file on disk, the one added is imported then
+			static std::string selected_model_name = "";
+
+			if(ImGui::BeginCombo("Models", selected_model_name.c_str()))
+			{
+				for(const char* extension : { "gltf", "glb" })
+				{
+					for(const DiskAsset& model_file : Assets::get_disk_files_by_extension(extension))
+					{
+						if (ImGui::Selectable(model_file.file_name.c_str(), model_file.file_name == selected_model_name))
+							selected_model_name = model_file.file_name;
+					}
+				}
+
+				ImGui::EndCombo();
+			}
+
+			if(ImGui::Button("Add Model") && !selected_model_name.empty())
+			{
+				i32 first_instance_idx = World::add_instances_of_model(selected_model_name);
+
+				if(first_instance_idx >= 0)
+				{
+					internal.selected_instance_idx = first_instance_idx;
+					internal.world_dirty = true;
+				}
+			}
+
 			ImGui::Dummy({0, 20});
 			ImGui::Unindent();
 			ImGui::SeparatorText("Selected Instance");
@@ -954,14 +1319,15 @@ namespace Raytracer
 			u32 number_idx = 0;
 			for(u32 idx = 0; idx < World::get_material_count(); idx++)
 			{
-				auto current_material = World::get_material_ref(idx);
+				Material& current_material = World::get_material_ref(idx);
 
 				if (ImGui::TreeNode(("## material list index" + std::to_string(number_idx)).c_str()))
 				{
 					ImGui::SameLine();
 					ImGui::Text((material_type_to_string(current_material.type).c_str()));
 
-					ui_material_editor(current_material);
+					if(ui_material_editor(current_material))
+						World::mark_material_dirty(idx);
 
 					ImGui::TreePop();
 				}
@@ -977,6 +1343,12 @@ namespace Raytracer
 		if(ImGui::BeginTabItem("Performance"))
 		{
 			perf::draw_section_implot_graph("render passes");
+			perf::draw_section_implot_graph("device kernels (ms)");
+			perf::draw_section_implot_graph("device transfers (ms)");
+			perf::draw_section_implot_graph("device transfers (KB)");
+			perf::draw_section_implot_graph("world uploads (bytes)");
+			perf::draw_section_implot_graph("device queue latency (ms)");
+			ui_device_memory();
 			ImGui::EndTabItem();
 		}
 
@@ -991,15 +1363,13 @@ namespace Raytracer
 		{
 			i32 transform_idx = internal.selected_instance_idx;
 
-			MeshInstanceHeader& instance = World::get_mesh_device_data(transform_idx);
-			glm::mat4 transform = instance.transform;
+			glm::mat4 transform = World::get_mesh_instance_ref(transform_idx).transform;
 
 			glm::mat4 projection = glm::perspectiveRH(glm::radians(90.0f), (f32)internal.render_width_px / (f32)internal.render_height_px, 0.1f, 1000.0f);
 
 			if (ImGuizmo::Manipulate(glm::value_ptr(view), glm::value_ptr(projection), (ImGuizmo::OPERATION)(internal.current_gizmo_operation), ImGuizmo::LOCAL, glm::value_ptr(transform)))
 			{
-				instance.transform = transform;
-				instance.inverse_transform = glm::inverse(transform);
+				World::set_instance_transform(transform_idx, transform);
 				internal.world_dirty = true;
 			}
 		}
@@ -11,14 +11,12 @@ struct RaytracerInitDesc
 {
 	u32 width_px { 0 };
 	u32 height_px { 0 };
-	u32* screen_buffer_ptr { nullptr };
 };
 
 struct RaytracerResizeDesc
 {
 	u32 width_px { 0 };
 	u32 height_px { 0 };
-	u32* new_buffer_ptr { nullptr }; // Optional
 };
 
 namespace Raytracer
@@ -27,6 +25,9 @@ namespace Raytracer
 	void terminate();
 	void resize(const RaytracerResizeDesc& desc);
 	void raytrace();
+
+	// Returns the most recent finished frame to present, rendering of the next frame continues meanwhile
+	const u32* acquire_frame();
 	void update(const f32 delta_time_ms);
 	void ui();
 
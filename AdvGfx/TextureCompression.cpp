@@ -0,0 +1,209 @@
+#include "TextureCompression.h"
+
+const u32 BLOCK_TEXEL_COUNT = TextureCompression::BLOCK_SIZE * TextureCompression::BLOCK_SIZE;
+
+void get_block_texels(const u8* rgba, u32 width, u32 height, u32 block_x, u32 block_y, glm::vec3 texels[BLOCK_TEXEL_COUNT])
+{
+	for(u32 y = 0; y < TextureCompression::BLOCK_SIZE; y++)
+	{
+		u32 texel_y = glm::min(block_y * TextureCompression::BLOCK_SIZE + y, height - 1);
+
+		for(u32 x = 0; x < TextureCompression::BLOCK_SIZE; x++)
+		{
+			u32 texel_x = glm::min(block_x * TextureCompression::BLOCK_SIZE + x, width - 1);
+			const u8* texel = &rgba[(texel_x + texel_y * width) * 4];
+
+			texels[x + y * TextureCompression::BLOCK_SIZE] = glm::vec3(texel[0], texel[1], texel[2]);
+		}
+	}
+}
+
+u16 pack_rgb565(glm::vec3 color)
+{
+	glm::uvec3 quantized = glm::uvec3(glm::round(glm::clamp(color, 0.0f, 255.0f) * glm::vec3(31.0f, 63.0f, 31.0f) / 255.0f));
+	return (u16)((quantized.r << 11) | (quantized.g << 5) | quantized.b);
+}
+
+// Bit replication, the way decoders expand 565
+glm::vec3 unpack_rgb565(u16 color)
+{
+	u32 r = (color >> 11) & 31;
+	u32 g = (color >> 5) & 63;
+	u32 b = color & 31;
+
+	return glm::vec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+}
+
+// Endpoints at the extremes of the block's principal axis, indices to the nearest of the four palette colors
+void encode_bc1_block(const glm::vec3 texels[BLOCK_TEXEL_COUNT], u8* block)
+{
+	glm::vec3 mean(0.0f);
+	glm::vec3 min_color(255.0f);
+	glm::vec3 max_color(0.0f);
+
+	for(u32 i = 0; i < BLOCK_TEXEL_COUNT; i++)
+	{
+		mean += texels[i];
+		min_color = glm::min(min_color, texels[i]);
+		max_color = glm::max(max_color, texels[i]);
+	}
+
+	mean /= (f32)BLOCK_TEXEL_COUNT;
+
+	glm::mat3 covariance(0.0f);
+
+	for(u32 i = 0; i < BLOCK_TEXEL_COUNT; i++)
+	{
+		glm::vec3 offset = texels[i] - mean;
+		covariance += glm::outerProduct(offset, offset);
+	}
+
+	// A few power iterations, starting from the bounding box diagonal
+	glm::vec3 axis = max_color - min_color;
+
+	for(u32 i = 0; i < 4; i++)
+	{
+		glm::vec3 next_axis = covariance * axis;
+		f32 largest = glm::max(glm::max(glm::abs(next_axis.x), glm::abs(next_axis.y)), glm::abs(next_axis.z));
+
+		if(largest == 0.0f)
+			break;
+
+		axis = next_axis / largest;
+	}
+
+	f32 min_t = 0.0f;
+	f32 max_t = 0.0f;
+
+	if(glm::dot(axis, axis) > 0.0f)
+	{
+		axis = glm::normalize(axis);
+		min_t = FLT_MAX;
+		max_t = -FLT_MAX;
+
+		for(u32 i = 0; i < BLOCK_TEXEL_COUNT; i++)
+		{
+			f32 t = glm::dot(texels[i] - mean, axis);
+			min_t = glm::min(min_t, t);
+			max_t = glm::max(max_t, t);
+		}
+	}
+
+	u16 color0 = pack_rgb565(mean + axis * max_t);
+	u16 color1 = pack_rgb565(mean + axis * min_t);
+
+	// color0 > color1 selects the four color mode, equal endpoints leave every index at 0
+	if(color0 < color1)
+		std::swap(color0, color1);
+
+	glm::vec3 palette[4];
+	palette[0] = unpack_rgb565(color0);
+	palette[1] = unpack_rgb565(color1);
+	palette[2] = (2.0f * palette[0] + palette[1]) / 3.0f;
+	palette[3] = (palette[0] + 2.0f * palette[1]) / 3.0f;
+
+	u32 indices = 0;
+
+	for(u32 i = 0; color0 != color1 && i < BLOCK_TEXEL_COUNT; i++)
+	{
+		u32 best_index = 0;
+		f32 best_distance = FLT_MAX;
+
+		for(u32 p = 0; p < 4; p++)
+		{
+			glm::vec3 difference = texels[i] - palette[p];
+			f32 distance = glm::dot(difference, difference);
+
+			if(distance < best_distance)
+			{
+				best_distance = distance;
+				best_index = p;
+			}
+		}
+
+		indices |= best_index << (i * 2);
+	}
+
+	block[0] = (u8)(color0 & 0xff);
+	block[1] = (u8)(color0 >> 8);
+	block[2] = (u8)(color1 & 0xff);
+	block[3] = (u8)(color1 >> 8);
+
+	for(u32 i = 0; i < 4; i++)
+		block[4 + i] = (u8)(indices >> (i * 8));
+}
+
+// Always the eight value mode (red0 > red1), indices by position between the endpoints
+void encode_bc4_block(const glm::vec3 texels[BLOCK_TEXEL_COUNT], u8* block)
+{
+	f32 min_red = 255.0f;
+	f32 max_red = 0.0f;
+
+	for(u32 i = 0; i < BLOCK_TEXEL_COUNT; i++)
+	{
+		min_red = glm::min(min_red, texels[i].r);
+		max_red = glm::max(max_red, texels[i].r);
+	}
+
+	u8 red0 = (u8)glm::round(max_red);
+	u8 red1 = (u8)glm::round(min_red);
+
+	u64 indices = 0;
+
+	for(u32 i = 0; red0 != red1 && i < BLOCK_TEXEL_COUNT; i++)
+	{
+		// Steps from red0 (0) to red1 (7), stored as 0, 2..7, 1
+		u32 step = (u32)glm::round((red0 - texels[i].r) * 7.0f / (red0 - red1));
+		u64 index = step == 0 ? 0 : (step == 7 ? 1 : step + 1);
+
+		indices |= index << (i * 3);
+	}
+
+	block[0] = red0;
+	block[1] = red1;
+
+	for(u32 i = 0; i < 6; i++)
+		block[2 + i] = (u8)(indices >> (i * 8));
+}
+
+usize TextureCompression::get_compressed_byte_size(u32 width, u32 height)
+{
+	usize blocks_x = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	usize blocks_y = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	return blocks_x * blocks_y * BLOCK_BYTE_SIZE;
+}
+
+void TextureCompression::compress_bc1(const u8* rgba, u32 width, u32 height, u8* blocks)
+{
+	u32 blocks_x = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	u32 blocks_y = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	glm::vec3 texels[BLOCK_TEXEL_COUNT];
+
+	for(u32 block_y = 0; block_y < blocks_y; block_y++)
+	{
+		for(u32 block_x = 0; block_x < blocks_x; block_x++)
+		{
+			get_block_texels(rgba, width, height, block_x, block_y, texels);
+			encode_bc1_block(texels, &blocks[(block_x + block_y * blocks_x) * BLOCK_BYTE_SIZE]);
+		}
+	}
+}
+
+void TextureCompression::compress_bc4(const u8* rgba, u32 width, u32 height, u8* blocks)
+{
+	u32 blocks_x = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	u32 blocks_y = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	glm::vec3 texels[BLOCK_TEXEL_COUNT];
+
+	for(u32 block_y = 0; block_y < blocks_y; block_y++)
+	{
+		for(u32 block_x = 0; block_x < blocks_x; block_x++)
+		{
+			get_block_texels(rgba, width, height, block_x, block_y, texels);
+			encode_bc4_block(texels, &blocks[(block_x + block_y * blocks_x) * BLOCK_BYTE_SIZE]);
+		}
+	}
+}
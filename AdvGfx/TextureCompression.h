@@ -0,0 +1,16 @@
+#pragma once
+
+// BC1 and BC4 block encoders, every 4x4 texel block becomes 8 bytes. Edge blocks of sizes that aren't a multiple of 4 repeat the last row and column
+namespace TextureCompression
+{
+	const u32 BLOCK_SIZE = 4;
+	const u32 BLOCK_BYTE_SIZE = 8;
+
+	usize get_compressed_byte_size(u32 width, u32 height);
+
+	// RGB of an RGBA8 image, alpha is dropped
+	void compress_bc1(const u8* rgba, u32 width, u32 height, u8* blocks);
+
+	// The red channel of an RGBA8 image, for greyscale textures
+	void compress_bc4(const u8* rgba, u32 width, u32 height, u8* blocks);
+}
@@ -0,0 +1,159 @@
+#include "TextureFile.h"
+
+#include <fstream>
+
+const u64 TEXTURE_FILE_ALIGNMENT = 64;
+
+std::string TextureFile::get_baked_path(const std::string& source_path)
+{
+	std::string file_name = get_file_name_from_path_string(source_path);
+
+	return std::format("{}\\texture_cache\\{}_{:016x}.ptex", get_current_directory_path(), file_name, hash_string(source_path));
+}
+
+u32 TextureFile::get_tile_byte_size(TextureFormat format)
+{
+	if(format == TextureFormat::RGBA8)
+		return TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE * 4;
+
+	return (TEXTURE_TILE_SIZE / 4) * (TEXTURE_TILE_SIZE / 4) * 8;
+}
+
+u32 TextureFile::get_tile_count(u32 width, u32 height)
+{
+	return ((width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE) * ((height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE);
+}
+
+std::vector<u8> TextureFile::bake(const std::string& source_path, const TextureLevels& levels)
+{
+	TextureFileHeader header;
+	get_file_stamp(source_path, header.source_byte_size, header.source_write_time);
+
+	header.width = levels.width;
+	header.height = levels.height;
+	header.level_count = (u32)levels.level_offsets.size();
+	header.format = levels.format;
+	header.tile_byte_size = get_tile_byte_size(levels.format);
+
+	for(u32 level = 0; level < header.level_count; level++)
+	{
+		header.level_tile_offsets[level] = header.tile_count;
+		header.tile_count += get_tile_count(glm::max(levels.width >> level, 1u), glm::max(levels.height >> level, 1u));
+	}
+
+	header.tiles_offset = ((sizeof(TextureFileHeader) + TEXTURE_FILE_ALIGNMENT - 1) / TEXTURE_FILE_ALIGNMENT) * TEXTURE_FILE_ALIGNMENT;
+
+	std::vector<u8> baked(header.tiles_offset + (u64)header.tile_count * header.tile_byte_size);
+	memcpy(baked.data(), &header, sizeof(TextureFileHeader));
+
+	// Rows of texels, or of 4x4 blocks for the BC formats
+	u32 unit_size = levels.format == TextureFormat::RGBA8 ? 1 : 4;
+	u32 unit_byte_size = levels.format == TextureFormat::RGBA8 ? 4 : 8;
+	u32 units_per_tile = TEXTURE_TILE_SIZE / unit_size;
+
+	for(u32 level = 0; level < header.level_count; level++)
+	{
+		u32 level_width = glm::max(levels.width >> level, 1u);
+		u32 level_height = glm::max(levels.height >> level, 1u);
+		u32 units_x = (level_width + unit_size - 1) / unit_size;
+		u32 units_y = (level_height + unit_size - 1) / unit_size;
+		u32 tiles_x = (level_width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+
+		const u8* level_data = &levels.data[levels.level_offsets[level]];
+
+		for(u32 unit_y = 0; unit_y < units_y; unit_y++)
+		{
+			u32 tile_y = unit_y / units_per_tile;
+
+			for(u32 tile_x = 0; tile_x < tiles_x; tile_x++)
+			{
+				u32 first_unit_x = tile_x * units_per_tile;
+				u32 row_unit_count = glm::min(units_per_tile, units_x - first_unit_x);
+
+				u32 tile_idx = header.level_tile_offsets[level] + tile_x + tile_y * tiles_x;
+				u8* tile_row = &baked[header.tiles_offset + (u64)tile_idx * header.tile_byte_size + (u64)(unit_y % units_per_tile) * units_per_tile * unit_byte_size];
+
+				memcpy(tile_row, &level_data[((u64)first_unit_x + (u64)unit_y * units_x) * unit_byte_size], row_unit_count * unit_byte_size);
+			}
+		}
+	}
+
+	return baked;
+}
+
+bool TextureFile::get_view(const u8* data, u64 byte_size, TextureFileView& view)
+{
+	if(byte_size < sizeof(TextureFileHeader))
+		return false;
+
+	const TextureFileHeader* header = (const TextureFileHeader*)data;
+
+	bool valid = header->magic == TEXTURE_FILE_MAGIC && header->version == TEXTURE_FILE_VERSION
+		&& header->level_count > 0 && header->level_count <= MAX_TEXTURE_LEVELS
+		&& header->tile_byte_size == get_tile_byte_size(header->format)
+		&& header->tiles_offset + (u64)header->tile_count * header->tile_byte_size <= byte_size;
+
+	if(!valid)
+		return false;
+
+	view.header = header;
+	view.tiles = data + header->tiles_offset;
+
+	return true;
+}
+
+bool TextureFile::write(const std::string& path, const std::vector<u8>& baked)
+{
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+	// Written to a temporary file first, so a crash never leaves a truncated bake behind
+	std::string temporary_path = path + ".tmp";
+	std::ofstream f(temporary_path, std::ios::binary | std::ios::trunc);
+
+	if(!f.good())
+		return false;
+
+	f.write((const char*)baked.data(), baked.size());
+	f.close();
+
+	if(f.fail())
+		return false;
+
+	std::filesystem::rename(temporary_path, path, error);
+	return !error;
+}
+
+bool MappedTextureFile::open(const std::string& path, const std::string& source_path, TextureFormat format)
+{
+	close();
+
+	if(!file.open(path) || !TextureFile::get_view(file.data, file.byte_size, view))
+	{
+		close();
+		return false;
+	}
+
+	u64 source_byte_size = 0;
+	i64 source_write_time = 0;
+	bool source_found = get_file_stamp(source_path, source_byte_size, source_write_time);
+
+	// A missing source is fine, the bake is all that is needed. Greyscale images are baked as BC4 whenever BC1 is asked for
+	bool same_format = view.header->format == format || (format == TextureFormat::BC1 && view.header->format == TextureFormat::BC4);
+	bool up_to_date = !source_found || (view.header->source_byte_size == source_byte_size && view.header->source_write_time == source_write_time);
+
+	if(!same_format || !up_to_date)
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedTextureFile::close()
+{
+	view = {};
+
+	file.close();
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Assets.h"
+
+// Baked textures (.ptex): a header followed by the mip chain cut into square tiles, the unit textures are streamed in.
+// Tiles are stored level by level and row by row, in the format the device reads them
+const u32 TEXTURE_FILE_MAGIC = 0x58455450; // "PTEX"
+const u32 TEXTURE_FILE_VERSION = 1;
+
+// In texels, BC formats store a tile as 16x16 blocks
+const u32 TEXTURE_TILE_SIZE = 64;
+
+struct TextureFileHeader
+{
+	u32 magic { TEXTURE_FILE_MAGIC };
+	u32 version { TEXTURE_FILE_VERSION };
+
+	// The source image the texture was baked from, a mismatch means the bake is stale
+	u64 source_byte_size { 0 };
+	i64 source_write_time { 0 };
+
+	u32 width { 0 };
+	u32 height { 0 };
+	u32 level_count { 0 };
+	TextureFormat format { TextureFormat::RGBA8 };
+
+	u32 tile_count { 0 };
+	u32 tile_byte_size { 0 };
+
+	// Byte offset from the start of the file, every tile takes tile_byte_size bytes
+	u64 tiles_offset { 0 };
+
+	// Index of the first tile of each level
+	u32 level_tile_offsets[MAX_TEXTURE_LEVELS] { };
+};
+
+// Mip chain with every level after the previous one, rows of texels (RGBA8) or of 4x4 blocks (BC)
+struct TextureLevels
+{
+	u32 width { 0 };
+	u32 height { 0 };
+	TextureFormat format { TextureFormat::RGBA8 };
+
+	std::vector<u8> data;
+	std::vector<u64> level_offsets;
+};
+
+// Tiles of a baked texture, pointing into a mapping or into memory
+struct TextureFileView
+{
+	const TextureFileHeader* header { nullptr };
+	const u8* tiles { nullptr };
+
+	const u8* get_tile(u32 tile_idx) const { return tiles + (u64)tile_idx * header->tile_byte_size; }
+};
+
+// Read-only mapping of a .ptex file, the view stays valid as long as the mapping is open
+struct MappedTextureFile
+{
+	// Fails if the file is missing, truncated, of another version or format or baked from another revision of the source
+	bool open(const std::string& path, const std::string& source_path, TextureFormat format);
+	void close();
+
+	TextureFileView view;
+
+private:
+	MappedFile file;
+};
+
+namespace TextureFile
+{
+	// Where the baked version of a source image lives
+	std::string get_baked_path(const std::string& source_path);
+
+	u32 get_tile_byte_size(TextureFormat format);
+	u32 get_tile_count(u32 width, u32 height);
+
+	// The whole file, tiled. Kept in memory as it is if writing it fails
+	std::vector<u8> bake(const std::string& source_path, const TextureLevels& levels);
+
+	bool get_view(const u8* data, u64 byte_size, TextureFileView& view);
+
+	bool write(const std::string& path, const std::vector<u8>& baked);
+}
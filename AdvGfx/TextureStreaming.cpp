@@ -0,0 +1,348 @@
+#include "TextureStreaming.h"
+
+#include "Jobs.h"
+
+// Stamps this recent still count as in use, the feedback readback lags a frame or two behind
+const u32 FEEDBACK_FRAME_WINDOW = 2;
+
+// Tiles read from disk by one job, only one batch is in flight at a time
+const u32 MAX_TILES_PER_PAGE_IN = 256;
+
+struct StreamedTile
+{
+	u32 texture_idx { 0 };
+	u32 tile_idx_in_texture { 0 };
+	u32 level { 0 };
+	u32 slot { TEXTURE_TILE_NOT_RESIDENT };
+	u32 last_used_frame { 0 };
+	bool pending { false };
+	bool pinned { false };
+};
+
+struct PageInBatch
+{
+	std::vector<u32> tile_idxs;
+	std::vector<u8> data;
+};
+
+struct
+{
+	std::vector<TextureFileView> textures {};
+	std::vector<StreamedTile> tiles {};
+
+	// Host copies of the device buffers, except for the pool which tiles are written into straight from their
+	// source. The feedback is double buffered, the host scans the one the last frame read back while the current
+	// frame writes into the other
+	std::vector<u32> tile_table {};
+	HostVector<u32> feedback[2] {};
+	u32 feedback_idx { 0 };
+
+	u32 tile_byte_size { 0 };
+	std::vector<u32> slot_tiles {};
+	std::vector<u32> free_slots {};
+
+	// Slot to the tile data it gets, uploaded before the source (a page-in batch or a mapping) goes away
+	std::map<u32, const u8*> dirty_slots {};
+
+	bool tile_table_dirty { false };
+	bool feedback_resized { false };
+
+	std::future<PageInBatch> page_in;
+
+	ComputeGrowableBuffer* pool_buffer			{ nullptr };
+	ComputeGrowableBuffer* tile_table_buffer	{ nullptr };
+	ComputeReadWriteBuffer* feedback_buffers[2]	{ nullptr, nullptr };
+
+	TextureStreamingStats stats {};
+} internal;
+
+void evict_slot(u32 slot)
+{
+	u32 tile_idx = internal.slot_tiles[slot];
+
+	if(tile_idx == TEXTURE_TILE_NOT_RESIDENT)
+		return;
+
+	internal.tiles[tile_idx].slot = TEXTURE_TILE_NOT_RESIDENT;
+	internal.tile_table[tile_idx] = TEXTURE_TILE_NOT_RESIDENT;
+	internal.slot_tiles[slot] = TEXTURE_TILE_NOT_RESIDENT;
+	internal.tile_table_dirty = true;
+
+	internal.stats.evicted_last_update++;
+}
+
+// Slots of tiles that weren't used in the last frames, least recently used at the back
+std::vector<u32> get_eviction_candidates(u32 frame_number)
+{
+	std::vector<u32> candidates;
+
+	for(u32 slot = 0; slot < (u32)internal.slot_tiles.size(); slot++)
+	{
+		u32 tile_idx = internal.slot_tiles[slot];
+
+		if(tile_idx == TEXTURE_TILE_NOT_RESIDENT)
+			continue;
+
+		const StreamedTile& tile = internal.tiles[tile_idx];
+
+		if(!tile.pinned && tile.last_used_frame + FEEDBACK_FRAME_WINDOW < frame_number)
+			candidates.push_back(slot);
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](u32 a, u32 b)
+	{
+		return internal.tiles[internal.slot_tiles[a]].last_used_frame > internal.tiles[internal.slot_tiles[b]].last_used_frame;
+	});
+
+	return candidates;
+}
+
+// Copies the tile into a free slot, or into the least recently used one. False if every slot is in use
+bool make_resident(u32 tile_idx, const u8* data, std::vector<u32>& eviction_candidates)
+{
+	u32 slot = TEXTURE_TILE_NOT_RESIDENT;
+
+	if(!internal.free_slots.empty())
+	{
+		slot = internal.free_slots.back();
+		internal.free_slots.pop_back();
+	}
+	else if(!eviction_candidates.empty())
+	{
+		slot = eviction_candidates.back();
+		eviction_candidates.pop_back();
+		evict_slot(slot);
+	}
+	else
+	{
+		return false;
+	}
+
+	internal.slot_tiles[slot] = tile_idx;
+	internal.tiles[tile_idx].slot = slot;
+	internal.tile_table[tile_idx] = slot;
+	internal.dirty_slots[slot] = data;
+	internal.tile_table_dirty = true;
+
+	internal.stats.uploaded_last_update++;
+
+	return true;
+}
+
+// Neighbouring slots whose tiles are also next to each other in their source go up as one write. Slots fill in
+// order and batches are laid out in request order, so most of a batch is a single run
+void upload_dirty_slots()
+{
+	usize tile_byte_size = internal.tile_byte_size;
+
+	for(auto run_start = internal.dirty_slots.begin(); run_start != internal.dirty_slots.end();)
+	{
+		auto run_end = std::next(run_start);
+		usize run_tile_count = 1;
+
+		while(run_end != internal.dirty_slots.end() && run_end->first == run_start->first + run_tile_count && run_end->second == run_start->second + run_tile_count * tile_byte_size)
+		{
+			run_end++;
+			run_tile_count++;
+		}
+
+		internal.pool_buffer->update_range(run_start->second, (usize)run_start->first * tile_byte_size, run_tile_count * tile_byte_size);
+		run_start = run_end;
+	}
+
+	internal.dirty_slots.clear();
+}
+
+void TextureStreaming::init(u64 pool_byte_size, u32 tile_byte_size)
+{
+	u32 slot_count = (u32)glm::max(pool_byte_size / tile_byte_size, (u64)1);
+
+	internal.tile_byte_size = tile_byte_size;
+	internal.slot_tiles.assign(slot_count, TEXTURE_TILE_NOT_RESIDENT);
+
+	// Handed out from the back, so the first slots fill first
+	for(u32 slot = slot_count; slot > 0; slot--)
+		internal.free_slots.push_back(slot - 1);
+
+	internal.pool_buffer = new ComputeGrowableBuffer(ComputeMemoryCategory::Textures);
+	internal.tile_table_buffer = new ComputeGrowableBuffer(ComputeMemoryCategory::Textures);
+
+	// Only sized here, slots are uploaded as they fill
+	internal.pool_buffer->resize((usize)slot_count * tile_byte_size);
+
+	// Kernels always get a feedback buffer, even without any textures
+	for(u32 i = 0; i < 2; i++)
+	{
+		internal.feedback[i].resize(1);
+		internal.feedback_buffers[i] = new ComputeReadWriteBuffer(internal.feedback[i], ComputeMemoryCategory::Readback);
+	}
+
+	LOGDEBUG(std::format("Texture tile pool of {} slots, {} MB", slot_count, internal.pool_buffer->get_byte_size() / (1024 * 1024)));
+}
+
+u32 TextureStreaming::add_texture(const TextureFileView& view)
+{
+	u32 texture_idx = (u32)internal.textures.size();
+	u32 first_tile_idx = (u32)internal.tiles.size();
+
+	internal.textures.push_back(view);
+
+	for(u32 tile_idx_in_texture = 0; tile_idx_in_texture < view.header->tile_count; tile_idx_in_texture++)
+	{
+		StreamedTile& tile = internal.tiles.emplace_back();
+		tile.texture_idx = texture_idx;
+		tile.tile_idx_in_texture = tile_idx_in_texture;
+
+		while(tile.level + 1 < view.header->level_count && view.header->level_tile_offsets[tile.level + 1] <= tile_idx_in_texture)
+			tile.level++;
+	}
+
+	internal.tile_table.resize(internal.tiles.size(), TEXTURE_TILE_NOT_RESIDENT);
+	internal.tile_table_dirty = true;
+	internal.feedback_resized = true;
+
+	// The coarsest level is a single tile, every lookup can fall back to it
+	u32 pinned_tile_idx = (u32)internal.tiles.size() - 1;
+	internal.tiles[pinned_tile_idx].pinned = true;
+
+	std::vector<u32> no_eviction_candidates;
+
+	if(!make_resident(pinned_tile_idx, view.get_tile(view.header->tile_count - 1), no_eviction_candidates))
+		LOGERROR("Texture tile pool is too small to hold the coarsest level of every texture");
+
+	return first_tile_idx;
+}
+
+bool TextureStreaming::update(u32 frame_number)
+{
+	internal.stats.uploaded_last_update = 0;
+	internal.stats.evicted_last_update = 0;
+
+	// This frame's kernels write the other buffer, the last frame's readback has to land before the scan
+	internal.feedback_idx = frame_number % 2;
+
+	const HostVector<u32>& feedback = internal.feedback[1 - internal.feedback_idx];
+	internal.feedback_buffers[1 - internal.feedback_idx]->wait_for_read_back();
+
+	// Tiles looked up in the last frames, the ones that aren't resident are requested
+	std::vector<u32> requests;
+	u32 feedback_count = (u32)glm::min(feedback.size(), internal.tiles.size());
+
+	for(u32 tile_idx = 0; tile_idx < feedback_count; tile_idx++)
+	{
+		u32 stamp = feedback[tile_idx];
+
+		if(stamp == 0 || stamp + FEEDBACK_FRAME_WINDOW < frame_number)
+			continue;
+
+		StreamedTile& tile = internal.tiles[tile_idx];
+		tile.last_used_frame = glm::max(tile.last_used_frame, stamp);
+
+		if(tile.slot == TEXTURE_TILE_NOT_RESIDENT && !tile.pending)
+			requests.push_back(tile_idx);
+	}
+
+	// Tiles are uploaded straight out of the batch, so it lives until upload_dirty_slots()
+	PageInBatch finished_batch;
+
+	if(internal.page_in.valid() && internal.page_in.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		finished_batch = internal.page_in.get();
+		std::vector<u32> eviction_candidates = get_eviction_candidates(frame_number);
+
+		for(usize i = 0; i < finished_batch.tile_idxs.size(); i++)
+		{
+			u32 tile_idx = finished_batch.tile_idxs[i];
+			internal.tiles[tile_idx].pending = false;
+
+			// Once the pool is full of tiles in use, the rest is requested again later
+			if(internal.tiles[tile_idx].slot == TEXTURE_TILE_NOT_RESIDENT)
+				make_resident(tile_idx, &finished_batch.data[i * internal.tile_byte_size], eviction_candidates);
+		}
+	}
+
+	if(!internal.page_in.valid() && !requests.empty())
+	{
+		// Coarse levels first, they are few and replace the blurriest fallbacks
+		std::sort(requests.begin(), requests.end(), [](u32 a, u32 b) { return internal.tiles[a].level > internal.tiles[b].level; });
+		requests.resize(glm::min(requests.size(), (usize)MAX_TILES_PER_PAGE_IN));
+
+		std::vector<const u8*> sources;
+
+		for(u32 tile_idx : requests)
+		{
+			StreamedTile& tile = internal.tiles[tile_idx];
+			tile.pending = true;
+			sources.push_back(internal.textures[tile.texture_idx].get_tile(tile.tile_idx_in_texture));
+		}
+
+		u32 tile_byte_size = internal.tile_byte_size;
+
+		// Reading the mapping is what pages the tiles in from disk
+		internal.page_in = Jobs::submit_with_result([requests, sources, tile_byte_size]()
+		{
+			PageInBatch batch;
+			batch.tile_idxs = requests;
+			batch.data.resize(sources.size() * tile_byte_size);
+
+			for(usize i = 0; i < sources.size(); i++)
+				memcpy(&batch.data[i * tile_byte_size], sources[i], tile_byte_size);
+
+			return batch;
+		});
+	}
+
+	upload_dirty_slots();
+
+	if(internal.tile_table_dirty)
+	{
+		internal.tile_table_buffer->update(internal.tile_table, 0);
+		internal.tile_table_dirty = false;
+	}
+
+	if(internal.feedback_resized)
+	{
+		// A readback may still be writing into the old host memory
+		Compute::finish();
+
+		for(u32 i = 0; i < 2; i++)
+		{
+			internal.feedback[i].resize(glm::max(internal.tiles.size(), (usize)1), 0);
+
+			delete internal.feedback_buffers[i];
+			internal.feedback_buffers[i] = new ComputeReadWriteBuffer(internal.feedback[i], ComputeMemoryCategory::Readback);
+		}
+
+		internal.feedback_resized = false;
+	}
+
+	return internal.stats.uploaded_last_update > 0;
+}
+
+ComputeGrowableBuffer& TextureStreaming::get_tile_pool_buffer()
+{
+	return *internal.pool_buffer;
+}
+
+ComputeGrowableBuffer& TextureStreaming::get_tile_table_buffer()
+{
+	return *internal.tile_table_buffer;
+}
+
+ComputeReadWriteBuffer& TextureStreaming::get_feedback_buffer()
+{
+	return *internal.feedback_buffers[internal.feedback_idx];
+}
+
+TextureStreamingStats TextureStreaming::get_stats()
+{
+	TextureStreamingStats stats = internal.stats;
+	stats.slot_count = (u32)internal.slot_tiles.size();
+	stats.resident_tile_count = stats.slot_count - (u32)internal.free_slots.size();
+	stats.tile_count = (u32)internal.tiles.size();
+
+	for(const StreamedTile& tile : internal.tiles)
+		stats.pending_tile_count += tile.pending ? 1 : 0;
+
+	return stats;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "TextureFile.h"
+
+// Slot in the tile table of a tile that isn't in the pool
+const u32 TEXTURE_TILE_NOT_RESIDENT = UINT32_MAX;
+
+struct TextureStreamingStats
+{
+	u32 slot_count { 0 };
+	u32 resident_tile_count { 0 };
+	u32 pending_tile_count { 0 };
+	u32 tile_count { 0 };
+	u32 uploaded_last_update { 0 };
+	u32 evicted_last_update { 0 };
+};
+
+// Keeps the texture tiles the renderer asked for in a fixed size pool of device memory. Kernels stamp every tile
+// they look up with the frame number in the feedback buffer, tiles that aren't resident are paged in from their
+// bake on a worker, least recently used tiles make room. The coarsest level of every texture stays resident
+namespace TextureStreaming
+{
+	void init(u64 pool_byte_size, u32 tile_byte_size);
+
+	// The view has to stay valid from then on. Returns the texture's first entry in the tile table
+	u32 add_texture(const TextureFileView& view);
+
+	// Acts on the feedback of the last frames and uploads the tiles that finished paging in, true if any did
+	bool update(u32 frame_number);
+
+	ComputeGrowableBuffer& get_tile_pool_buffer();
+	ComputeGrowableBuffer& get_tile_table_buffer();
+
+	// The one this frame's kernels write, it alternates with every update
+	ComputeReadWriteBuffer& get_feedback_buffer();
+
+	TextureStreamingStats get_stats();
+}
@@ -5,6 +5,8 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <mutex>
+#include <thread>
 
 std::string get_current_directory_path()
 {
@@ -18,8 +20,15 @@ std::string get_current_directory_path()
 std::string latest_msg;
 Log::MessageType latest_msg_type;
 
+// Workers log too, notifications are only touched by the main thread
+std::mutex log_mutex;
+std::thread::id main_thread_id = std::this_thread::get_id();
+std::vector<std::pair<ImGuiToastType, std::string>> pending_notifications;
+
 void Log::print(Log::MessageType type, const char* file, int line_number, const char* func, const std::string& message)
 {
+	std::lock_guard<std::mutex> lock(log_mutex);
+
 	HANDLE handle = GetStdHandle(STD_OUTPUT_HANDLE);
 
 	// Modify color of text
@@ -58,12 +67,29 @@ void Log::print(Log::MessageType type, const char* file, int line_number, const
 		}
 	}
 
+	if(std::this_thread::get_id() != main_thread_id)
+	{
+		pending_notifications.push_back({toast_type, message});
+		return;
+	}
+
 	ImGuiNotify::InsertNotification({toast_type, 3000, message.c_str()});
 }
 
+void Log::flush_notifications()
+{
+	std::lock_guard<std::mutex> lock(log_mutex);
+
+	for(auto& [toast_type, message] : pending_notifications)
+		ImGuiNotify::InsertNotification({toast_type, 3000, message.c_str()});
+
+	pending_notifications.clear();
+}
 
 std::pair<std::string, Log::MessageType> Log::get_latest_msg()
 {
+	std::lock_guard<std::mutex> lock(log_mutex);
+
 	return {latest_msg, latest_msg_type};
 }
 
@@ -89,4 +115,68 @@ std::string get_file_name_from_path_string(const std::string& path)
 	{
 		return path.substr(idx + 1);
 	}
-}
\ No newline at end of file
+}
+
+bool get_file_stamp(const std::string& path, u64& byte_size, i64& write_time)
+{
+	std::error_code error;
+
+	byte_size = std::filesystem::file_size(path, error);
+	if(error)
+		return false;
+
+	write_time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+	return !error;
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+
+	// Empty files can't be mapped
+	LARGE_INTEGER file_size;
+	if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	data = mapping != nullptr ? (const u8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+	if(data == nullptr)
+	{
+		close();
+		return false;
+	}
+
+	byte_size = (u64)file_size.QuadPart;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if(data != nullptr)
+		UnmapViewOfFile(data);
+
+	if(mapping != nullptr)
+		CloseHandle(mapping);
+
+	if(file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+
+	data = nullptr;
+	byte_size = 0;
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+}
@@ -9,4 +9,33 @@ inline void rotate_array_right(T* in_array, size_t size)
 	memcpy(in_array + 1, temp_array, sizeof(T) * (size - 1));
 
 	delete[] temp_array;
-}
\ No newline at end of file
+}
+
+// Page aligned storage, so OpenCL can use host memory in place (CL_MEM_USE_HOST_PTR) instead of making its own copy
+template <typename T>
+struct PageAlignedAllocator
+{
+	using value_type = T;
+	static constexpr usize alignment { 4096 };
+
+	PageAlignedAllocator() = default;
+
+	template <typename U>
+	PageAlignedAllocator(const PageAlignedAllocator<U>&) {}
+
+	T* allocate(usize count)
+	{
+		return (T*)::operator new(count * sizeof(T), std::align_val_t(alignment));
+	}
+
+	void deallocate(T* ptr, usize)
+	{
+		::operator delete(ptr, std::align_val_t(alignment));
+	}
+
+	template <typename U>
+	bool operator==(const PageAlignedAllocator<U>&) const { return true; }
+};
+
+template <typename T>
+using HostVector = std::vector<T, PageAlignedAllocator<T>>;
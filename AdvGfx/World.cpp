@@ -5,40 +5,302 @@
 
 #include <fstream>
 
+// An instance whose mesh or texture is still loading, kept out of the world (and the TLAS) until both are in
+struct PendingInstance
+{
+	MeshInstanceHeader header;
+	std::string mesh_name;
+	std::string texture_name;
+};
+
+// Elements of a host array changed since the last upload
+struct DirtyElements
+{
+	std::vector<u32> idxs {};
+
+	// Everything from here on, after elements were added or removed
+	usize changed_from { SIZE_MAX };
+
+	void mark(u32 idx) { idxs.push_back(idx); }
+	void mark_from(usize idx) { changed_from = glm::min(changed_from, idx); }
+	bool any() const { return !idxs.empty() || changed_from != SIZE_MAX; }
+};
+
+// A texture picked for an instance before it was loaded
+struct PendingTexture
+{
+	i32 instance_idx { -1 };
+	std::string file_name;
+};
+
 struct
 {
-	WorldDeviceData device_data;
 	std::vector<MeshInstanceHeader> mesh_instances {};
 
+	// Kernel layout of mesh_instances, uploaded from here. The buffer is a device copy, so edits never reach frames in flight
+	std::vector<MeshInstanceDeviceData> device_instances {};
+	ComputeGrowableBuffer* instance_buffer { nullptr };
+	DirtyElements dirty_instances {};
+
 	Material default_material = {glm::vec4(1.0f, 0.5f, 0.7f, 0.0f), 1.5f, 0.1f, MaterialType::Diffuse, 0.0f, 0.0f, 0.0f};
 	std::vector<Material> materials = {default_material};
+	ComputeGrowableBuffer* material_buffer { nullptr };
+	DirtyElements dirty_materials {};
+
+	// -1 if the materials differ in type, kernels are specialized on it
+	i32 single_material_type { -1 };
+
+	WorldUploadStats upload_stats {};
+
+	std::string skybox_name { "" };
+
+	std::vector<PendingInstance> pending_instances {};
+	std::vector<std::string> pending_models {};
+	std::vector<PendingTexture> pending_textures {};
 } internal;
 
+bool is_loading(const PendingInstance& pending_instance)
+{
+	return Assets::is_import_pending(Assets::get_file_name_of_mesh(pending_instance.mesh_name))
+		|| (!pending_instance.texture_name.empty() && Assets::is_import_pending(pending_instance.texture_name));
+}
+
+// Whatever was added or removed goes up in one write, single changes in runs of neighbouring elements. Returns the bytes uploaded
+template<typename T, typename Allocator>
+u64 upload_dirty_elements(ComputeGrowableBuffer& buffer, const std::vector<T, Allocator>& data, DirtyElements& dirty)
+{
+	u64 uploaded_byte_size = 0;
+	usize changed_from = glm::min(dirty.changed_from, data.size());
+
+	if(dirty.changed_from != SIZE_MAX)
+	{
+		buffer.update(data, changed_from * sizeof(T));
+		uploaded_byte_size += (data.size() - changed_from) * sizeof(T);
+	}
+
+	std::sort(dirty.idxs.begin(), dirty.idxs.end());
+	dirty.idxs.erase(std::unique(dirty.idxs.begin(), dirty.idxs.end()), dirty.idxs.end());
+
+	for(usize run_start = 0; run_start < dirty.idxs.size() && dirty.idxs[run_start] < changed_from;)
+	{
+		usize run_end = run_start + 1;
+
+		while(run_end < dirty.idxs.size() && dirty.idxs[run_end] == dirty.idxs[run_end - 1] + 1 && dirty.idxs[run_end] < changed_from)
+			run_end++;
+
+		usize run_byte_size = (run_end - run_start) * sizeof(T);
+		buffer.update_range(data, dirty.idxs[run_start] * sizeof(T), run_byte_size);
+
+		uploaded_byte_size += run_byte_size;
+		run_start = run_end;
+	}
+
+	dirty = {};
+
+	return uploaded_byte_size;
+}
+
+MeshInstanceDeviceData get_device_data(const MeshInstanceHeader& instance)
+{
+	MeshInstanceDeviceData device_data;
+
+	glm::mat4 inverse_transform = glm::inverse(instance.transform);
+	glm::mat3 normal_transform = glm::transpose(glm::mat3(inverse_transform));
+
+	// glm is column major
+	for(u32 row = 0; row < 3; row++)
+	{
+		for(u32 column = 0; column < 4; column++)
+			device_data.inverse_transform[row * 4 + column] = inverse_transform[column][row];
+
+		for(u32 column = 0; column < 3; column++)
+			device_data.normal_transform[row * 3 + column] = normal_transform[column][row];
+	}
+
+	device_data.determinant = glm::determinant(glm::mat3(instance.transform));
+	device_data.mesh_idx = instance.mesh_idx;
+	device_data.material_idx = instance.material_idx;
+	device_data.texture_idx = instance.texture_idx;
+
+	return device_data;
+}
+
+// Derives the device side of the instances that changed, the dirty marks stay for the upload
+void update_device_instances()
+{
+	const DirtyElements& dirty = internal.dirty_instances;
+	internal.device_instances.resize(internal.mesh_instances.size());
+
+	for(u32 instance_idx : dirty.idxs)
+	{
+		if(instance_idx < internal.mesh_instances.size())
+			internal.device_instances[instance_idx] = get_device_data(internal.mesh_instances[instance_idx]);
+	}
+
+	for(usize instance_idx = dirty.changed_from; instance_idx < internal.mesh_instances.size(); instance_idx++)
+		internal.device_instances[instance_idx] = get_device_data(internal.mesh_instances[instance_idx]);
+}
+
+void place_instance(const PendingInstance& pending_instance)
+{
+	i32 mesh_idx = Assets::get_mesh_idx(pending_instance.mesh_name);
+
+	if(mesh_idx < 0)
+	{
+		LOGERROR(std::format("Dropped an instance of {}, the mesh could not be loaded", pending_instance.mesh_name));
+		return;
+	}
+
+	MeshInstanceHeader instance = pending_instance.header;
+	instance.mesh_idx = (u32)mesh_idx;
+	instance.texture_idx = pending_instance.texture_name.empty() ? -1 : Assets::get_texture_idx(pending_instance.texture_name);
+
+	internal.dirty_instances.mark_from(internal.mesh_instances.size());
+	internal.mesh_instances.push_back(instance);
+}
+
+i32 place_model(const std::string& model_name)
+{
+	auto model = Assets::get_models().find(model_name);
+
+	if(model == Assets::get_models().end() || model->second.empty())
+		return -1;
+
+	i32 first_instance_idx = (i32)internal.mesh_instances.size();
+	internal.dirty_instances.mark_from(first_instance_idx);
+
+	for(const ModelInstance& model_instance : model->second)
+	{
+		MeshInstanceHeader new_mesh_instance;
+		new_mesh_instance.transform = model_instance.transform;
+		new_mesh_instance.mesh_idx = model_instance.mesh_idx;
+
+		internal.mesh_instances.push_back(new_mesh_instance);
+	}
+
+	return first_instance_idx;
+}
+
+
+void World::init()
+{
+	internal.instance_buffer = new ComputeGrowableBuffer(ComputeMemoryCategory::Geometry);
+	internal.material_buffer = new ComputeGrowableBuffer(ComputeMemoryCategory::Other);
+
+	internal.dirty_instances.mark_from(0);
+	internal.dirty_materials.mark_from(0);
+}
 
 i32 World::add_instance_of_mesh(u32 mesh_idx)
 {
 	MeshInstanceHeader new_mesh_instance;
 	new_mesh_instance.transform = glm::identity<glm::mat4>();
-	new_mesh_instance.inverse_transform = glm::inverse(new_mesh_instance.transform);
 	new_mesh_instance.mesh_idx = mesh_idx;
 
+	internal.dirty_instances.mark_from(internal.mesh_instances.size());
 	internal.mesh_instances.push_back(new_mesh_instance);
 
 	return ((i32)internal.mesh_instances.size() - 1);
 }
 
+i32 World::add_instances_of_model(const std::string& model_name)
+{
+	Assets::request_files({ model_name });
+
+	if(Assets::is_import_pending(model_name))
+	{
+		internal.pending_models.push_back(model_name);
+		return -1;
+	}
+
+	return place_model(model_name);
+}
+
+void World::set_instance_texture(i32 instance_idx, const std::string& file_name)
+{
+	std::erase_if(internal.pending_textures, [instance_idx](const PendingTexture& pending_texture) { return pending_texture.instance_idx == instance_idx; });
+
+	Assets::request_files({ file_name });
+
+	if(Assets::is_import_pending(file_name))
+	{
+		internal.pending_textures.push_back({ instance_idx, file_name });
+		return;
+	}
+
+	internal.mesh_instances[instance_idx].texture_idx = Assets::get_texture_idx(file_name);
+	internal.dirty_instances.mark(instance_idx);
+}
+
+bool World::update_pending_assets()
+{
+	usize instance_count = internal.mesh_instances.size();
+	usize pending_texture_count = internal.pending_textures.size();
+
+	std::erase_if(internal.pending_instances, [](const PendingInstance& pending_instance)
+	{
+		if(is_loading(pending_instance))
+			return false;
+
+		place_instance(pending_instance);
+		return true;
+	});
+
+	std::erase_if(internal.pending_models, [](const std::string& model_name)
+	{
+		if(Assets::is_import_pending(model_name))
+			return false;
+
+		if(place_model(model_name) < 0)
+			LOGERROR(std::format("Could not add {}, it has no meshes that loaded", model_name));
+
+		return true;
+	});
+
+	std::erase_if(internal.pending_textures, [](const PendingTexture& pending_texture)
+	{
+		if(Assets::is_import_pending(pending_texture.file_name))
+			return false;
+
+		internal.mesh_instances[pending_texture.instance_idx].texture_idx = Assets::get_texture_idx(pending_texture.file_name);
+		internal.dirty_instances.mark(pending_texture.instance_idx);
+		return true;
+	});
+
+	return internal.mesh_instances.size() != instance_count || internal.pending_textures.size() != pending_texture_count;
+}
+
 void World::remove_mesh_instance(i32 instance_idx)
 {
 	internal.mesh_instances.erase(internal.mesh_instances.begin() + instance_idx);
+	internal.dirty_instances.mark_from(instance_idx);
+
+	// Later instances moved down by one
+	std::erase_if(internal.pending_textures, [instance_idx](const PendingTexture& pending_texture) { return pending_texture.instance_idx == instance_idx; });
+
+	for(PendingTexture& pending_texture : internal.pending_textures)
+		pending_texture.instance_idx -= pending_texture.instance_idx > instance_idx ? 1 : 0;
 }
 
-MeshInstanceHeader& World::get_mesh_device_data(usize instance_idx)
+MeshInstanceHeader& World::get_mesh_instance_ref(usize instance_idx)
 {
 	return internal.mesh_instances[instance_idx];
 }
 
+void World::mark_instance_dirty(u32 instance_idx)
+{
+	internal.dirty_instances.mark(instance_idx);
+}
+
+void World::set_instance_transform(u32 instance_idx, const glm::mat4& transform)
+{
+	internal.mesh_instances[instance_idx].transform = transform;
+	internal.dirty_instances.mark(instance_idx);
+}
+
 Material& World::add_material()
 {
+	internal.dirty_materials.mark_from(internal.materials.size());
 	internal.materials.push_back(internal.default_material);
 	return internal.materials.at(internal.materials.size() - 1);
 }
@@ -53,25 +315,109 @@ u32 World::get_material_count()
 	return (u32)internal.materials.size();
 }
 
-std::vector<Material>& World::get_material_vector()
+void World::mark_material_dirty(u32 material_idx)
+{
+	internal.dirty_materials.mark(material_idx);
+}
+
+i32 World::get_single_material_type()
+{
+	return internal.single_material_type;
+}
+
+const std::vector<Material>& World::get_material_vector()
 {
 	return internal.materials;
 }
 
-WorldDeviceData& World::get_world_device_data()
+u32 World::get_mesh_instance_count()
+{
+	return (u32)internal.mesh_instances.size();
+}
+
+const std::vector<MeshInstanceHeader>& World::get_mesh_instances()
+{
+	return internal.mesh_instances;
+}
+
+// Only rescanned when materials changed, not every time a kernel variant is picked
+void update_single_material_type()
 {
-	memset(internal.device_data.mesh_instances, 0, 4096 * sizeof(MeshInstanceHeader));
-	memcpy(internal.device_data.mesh_instances, internal.mesh_instances.data(), internal.mesh_instances.size() * sizeof(MeshInstanceHeader));
-	internal.device_data.mesh_instance_count = (u32)internal.mesh_instances.size();
+	if(!internal.dirty_materials.any())
+		return;
+
+	const std::vector<Material>& materials = internal.materials;
+	bool single_material_type = !materials.empty();
 
-	return internal.device_data;
+	for(const Material& material : materials)
+		single_material_type &= material.type == materials[0].type;
+
+	internal.single_material_type = single_material_type ? (i32)materials[0].type : -1;
 }
+
+void World::commit_device_data()
+{
+	update_device_instances();
+	update_single_material_type();
+
+	internal.upload_stats.instance_byte_size = upload_dirty_elements(*internal.instance_buffer, internal.device_instances, internal.dirty_instances);
+	internal.upload_stats.material_byte_size = upload_dirty_elements(*internal.material_buffer, internal.materials, internal.dirty_materials);
+}
+
+ComputeGrowableBuffer& World::get_instance_buffer()
+{
+	return *internal.instance_buffer;
+}
+
+ComputeGrowableBuffer& World::get_material_buffer()
+{
+	return *internal.material_buffer;
+}
+
+WorldUploadStats World::get_upload_stats()
+{
+	return internal.upload_stats;
+}
+
+const std::string& World::get_skybox_name()
+{
+	return internal.skybox_name;
+}
+
+void World::set_skybox_name(const std::string& file_name)
+{
+	internal.skybox_name = file_name;
+}
+
 void World::serialize_scene()
 {
 	json scene_data;
 
-	scene_data["MeshInstanceHeaders"] = internal.mesh_instances;
+	// Indices are kept for reference, names are what loading goes by
+	json instances = json::array();
+
+	for(const MeshInstanceHeader& instance : internal.mesh_instances)
+	{
+		json instance_data = instance;
+		instance_data["mesh_name"] = Assets::get_mesh_name(instance.mesh_idx);
+		instance_data["texture_name"] = instance.texture_idx >= 0 ? Assets::get_texture_name(instance.texture_idx) : "";
+
+		instances.push_back(instance_data);
+	}
+
+	// Still loading, but part of the scene all the same
+	for(const PendingInstance& pending_instance : internal.pending_instances)
+	{
+		json instance_data = pending_instance.header;
+		instance_data["mesh_name"] = pending_instance.mesh_name;
+		instance_data["texture_name"] = pending_instance.texture_name;
+
+		instances.push_back(instance_data);
+	}
+
+	scene_data["MeshInstanceHeaders"] = instances;
 	scene_data["Materials"] = internal.materials;
+	scene_data["Skybox"] = internal.skybox_name;
 
 	std::ofstream o("phantasma.scene.json");
 	o << scene_data << std::endl;
@@ -86,9 +432,62 @@ void World::deserialize_scene()
 	if(file_opened_successfully)
 	{
 		json scene_data = json::parse(f);
-		internal.mesh_instances = scene_data["MeshInstanceHeaders"];
+		const json& instances = scene_data["MeshInstanceHeaders"];
+
+		bool references_by_name = true;
+		std::vector<std::string> file_names;
+
+		for(const json& instance_data : instances)
+		{
+			references_by_name &= instance_data.contains("mesh_name");
+
+			file_names.push_back(Assets::get_file_name_of_mesh(instance_data.value("mesh_name", "")));
+			file_names.push_back(instance_data.value("texture_name", ""));
+		}
+
+		if(scene_data.find("Skybox") != scene_data.end())
+			internal.skybox_name = scene_data["Skybox"];
+
+		file_names.push_back(internal.skybox_name);
+
+		internal.mesh_instances.clear();
+		internal.pending_instances.clear();
+		internal.dirty_instances.mark_from(0);
+
+		// Instances join the world as their assets finish loading, see update_pending_assets()
+		if(references_by_name)
+		{
+			std::erase(file_names, "");
+			Assets::request_files(file_names);
+
+			for(const json& instance_data : instances)
+				internal.pending_instances.push_back({ instance_data.get<MeshInstanceHeader>(), instance_data["mesh_name"].get<std::string>(), instance_data.value("texture_name", "") });
+		}
+		else
+		{
+			// Older scenes only have indices into everything on disk, so all of it has to be there before they mean anything
+			Assets::import_all_files();
+
+			for(const json& instance_data : instances)
+			{
+				MeshInstanceHeader instance = instance_data;
+
+				if(instance.mesh_idx >= Assets::get_mesh_count())
+				{
+					LOGERROR(std::format("Dropped an instance of mesh {}, the mesh could not be loaded", instance.mesh_idx));
+					continue;
+				}
+
+				instance.texture_idx = instance.texture_idx < (i32)Assets::get_texture_count() ? instance.texture_idx : -1;
+
+				internal.mesh_instances.push_back(instance);
+			}
+		}
 
 		if(scene_data.find("Materials") != scene_data.end())
+		{
 			internal.materials = scene_data["Materials"];
+			internal.dirty_materials.mark_from(0);
+		}
 	}
 }
\ No newline at end of file
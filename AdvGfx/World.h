@@ -1,47 +1,89 @@
 #pragma once
 #include "Math.h"
 #include "Material.h"
+#include "Compute.h"
 
 struct MeshInstanceHeader
 {
 	glm::mat4 transform {glm::identity<glm::mat4>()};
-	glm::mat4 inverse_transform {glm::identity<glm::mat4>()};
 		
 	u32 mesh_idx { 0 };
 	u32 material_idx { 0 };
 	i32 texture_idx { -1 }; // TODO: We should support more textures
-	u32 pad { 0 };
 
 	// Needed to save/load vector of this
 	NLOHMANN_DEFINE_TYPE_INTRUSIVE(MeshInstanceHeader, 
 		transform, 
-		inverse_transform, 
 		mesh_idx,
 		material_idx,
 		texture_idx);
 };
 
-struct WorldDeviceData
+// What kernels get of an instance (MeshInstanceHeader in common.cl), derived once whenever the instance changes.
+// Rows of affine matrices, so hits neither copy nor transpose anything
+struct MeshInstanceDeviceData
 {
-	u32 mesh_instance_count;
-	u32 pad_0[3];
-	MeshInstanceHeader mesh_instances[4096]; // TODO: we do this because you can't get the proper size of a struct if it has a std::vector in it. find a workaround?
+	f32 inverse_transform[12];	// World to object space, 3x4
+	f32 normal_transform[9];	// Inverse transpose of the upper 3x3 of the transform
+	f32 determinant;			// Of the upper 3x3 of the transform, scales areas along with normal_transform
+
+	u32 mesh_idx;
+	u32 material_idx;
+	i32 texture_idx;
+};
+
+// Bytes the last commit_device_data() uploaded
+struct WorldUploadStats
+{
+	u64 instance_byte_size { 0 };
+	u64 material_byte_size { 0 };
 };
 
 namespace World
 {
+	void init();
+
 	// Returns index of object
 	int add_instance_of_mesh(u32 mesh_idx);
+	// Places every mesh of a model file like its node hierarchy does, returns the first new index. If the model is
+	// still loading, the instances are added by update_pending_assets() once it is in and this returns -1
+	int add_instances_of_model(const std::string& model_name);
+	// Same for textures, the instance keeps its current one until the new one is in
+	void set_instance_texture(i32 instance_idx, const std::string& file_name);
 	void remove_mesh_instance(i32 instance_idx);
-	MeshInstanceHeader& get_mesh_device_data(usize instance_idx);
+
+	// Call after Assets::update_imports(), true if instances were added or changed
+	bool update_pending_assets();
+
+	// Changes made through these references only reach the device once marked dirty
+	MeshInstanceHeader& get_mesh_instance_ref(usize instance_idx);
+	void mark_instance_dirty(u32 instance_idx);
+	void set_instance_transform(u32 instance_idx, const glm::mat4& transform);
 
 	Material& add_material();
 	Material& get_material_ref(u32 material_idx);
+	void mark_material_dirty(u32 material_idx);
 	u32 get_material_count();
-	std::vector<Material>& get_material_vector();
+	const std::vector<Material>& get_material_vector();
+	// The type all materials share, -1 if they differ. Up to date after commit_device_data()
+	i32 get_single_material_type();
+
+	u32 get_mesh_instance_count();
+	const std::vector<MeshInstanceHeader>& get_mesh_instances();
+
+	// Uploads only the instances and materials that changed, coalesced into runs. Call once per frame before tracing
+	void commit_device_data();
+	WorldUploadStats get_upload_stats();
+
+	// Hold only the live instances, kernels get the count separately
+	ComputeGrowableBuffer& get_instance_buffer();
+	ComputeGrowableBuffer& get_material_buffer();
 
-	WorldDeviceData& get_world_device_data();
+	// File name of the environment map, empty if the scene doesn't pick one
+	const std::string& get_skybox_name();
+	void set_skybox_name(const std::string& file_name);
 
+	// Assets are referenced by name in the scene file, loading it imports only what it uses
 	void serialize_scene();
 	void deserialize_scene();
 }
\ No newline at end of file
@@ -71,22 +71,22 @@ float4 transform(float4 vector, float* transform)
 	return result;
 }
 
-void transpose4x4(float* matrix)
+// Row major 3x4 affine transform, w is 1 for points and 0 for directions
+float3 transform_affine(float3 vector, float w, float* transform)
 {
-	float temp = 0.0f;
-
-	temp = matrix[1], matrix[1] = matrix[4], matrix[4] = temp;
-	temp = matrix[2], matrix[2] = matrix[8], matrix[8] = temp;
-	temp = matrix[6], matrix[6] = matrix[9], matrix[9] = temp;
-	temp = matrix[3], matrix[3] = matrix[12], matrix[12] = temp;
-	temp = matrix[7], matrix[7] = matrix[13], matrix[13] = temp;
-	temp = matrix[11], matrix[11] = matrix[14], matrix[14] = temp;
+	return (float3)(
+		transform[0] * vector.x + transform[1] * vector.y + transform[2] * vector.z + transform[3] * w,
+		transform[4] * vector.x + transform[5] * vector.y + transform[6] * vector.z + transform[7] * w,
+		transform[8] * vector.x + transform[9] * vector.y + transform[10] * vector.z + transform[11] * w);
 }
 
-void copy4x4(float* src, float* dst)
+// Row major 3x3
+float3 transform3x3(float3 vector, float* transform)
 {
-	for(int i = 0; i < 16; i++)
-		dst[i] = src[i];
+	return (float3)(
+		transform[0] * vector.x + transform[1] * vector.y + transform[2] * vector.z,
+		transform[3] * vector.x + transform[4] * vector.y + transform[5] * vector.z,
+		transform[6] * vector.x + transform[7] * vector.y + transform[8] * vector.z);
 }
 
 // Taken from https://www.scratchapixel.com/lessons/3d-basic-rendering/introduction-to-shading/reflection-refraction-fresnel.html
@@ -274,6 +274,40 @@ bool is_within_bounds(int x, int y, int width, int height)
 	return (x >= 0 && y >= 0 && x < width && y < height);
 }
 
+// Set by the work-group autotuner, reorders work-groups into vertical stripes of TILE_SWIZZLE_WIDTH groups
+#ifndef TILE_SWIZZLE
+#define TILE_SWIZZLE 0
+#endif
+
+#define TILE_SWIZZLE_WIDTH 8
+
+// Pixel of this work-item. Global sizes are rounded up to the work-group size, so bounds still have to be checked
+int2 get_pixel_coordinates()
+{
+#if TILE_SWIZZLE
+	// Work-groups are launched roughly in linear order, keeping consecutive groups close together keeps their rays in the same BVH nodes
+	uint groups_x = get_num_groups(0);
+	uint groups_y = get_num_groups(1);
+	uint linear_group = get_group_id(0) + get_group_id(1) * groups_x;
+
+	uint stripe_group_count = TILE_SWIZZLE_WIDTH * groups_y;
+	uint stripe = linear_group / stripe_group_count;
+	uint group_in_stripe = linear_group % stripe_group_count;
+
+	// Last stripe can be narrower
+	uint stripe_width = min((uint)TILE_SWIZZLE_WIDTH, groups_x - stripe * TILE_SWIZZLE_WIDTH);
+
+	uint group_x = stripe * TILE_SWIZZLE_WIDTH + group_in_stripe % stripe_width;
+	uint group_y = group_in_stripe / stripe_width;
+
+	return (int2)(
+		group_x * get_local_size(0) + get_local_id(0) + get_global_offset(0),
+		group_y * get_local_size(1) + get_local_id(1) + get_global_offset(1));
+#else
+	return (int2)(get_global_id(0), get_global_id(1));
+#endif
+}
+
 // Structs
 
 #ifndef VIEW_TYPE_ENUM_DEFINED
@@ -309,7 +343,10 @@ typedef struct SceneData
 	float inv_old_camera_transform[16];
 	float exr_angle;
 	uint material_idx;
-	uint2 pad;
+	float pixel_spread_angle;
+	float texture_lod_bias;
+	uint frame_number;
+	uint instance_count; // Of the instance buffer, which only holds the live instances
 } SceneData;
 
 #endif
@@ -415,32 +452,20 @@ typedef struct MeshHeader
 
 #define MESH_INSTANCE_HEADER_DEFINED
 
+// MeshInstanceDeviceData on the host
 typedef struct MeshInstanceHeader
 {
-	float transform[16];
-	float inverse_transform[16];
+	float inverse_transform[12];	// World to object space, row major 3x4
+	float normal_transform[9];		// Object to world space normals, row major 3x3
+	float determinant;				// Of the object to world transform, scales areas along with normal_transform
 		
 	uint mesh_idx;
 	uint material_idx;
-	uint texture_idx;
-	uint pad;
+	int texture_idx;
 } MeshInstanceHeader;
 
 #endif
 
-#ifndef WORLD_MANAGER_DEVICE_DATA_DEFINED
-
-#define WORLD_MANAGER_DEVICE_DATA_DEFINED
-
-typedef struct WorldManagerDeviceData
-{
-	uint mesh_count;
-	uint pad_0[3];
-	MeshInstanceHeader instances[4096];
-} WorldManagerDeviceData;
-
-#endif
-
 #ifndef WAVEFRONT_DATA_DEFINED
 
 #define WAVEFRONT_DATA_DEFINED
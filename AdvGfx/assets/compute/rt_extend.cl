@@ -7,7 +7,9 @@ typedef struct BVHArgs
 	BVHNode* blas_nodes;
 	BVHNode* tlas_nodes;
 
-	WorldManagerDeviceData* world_data;
+	MeshInstanceHeader* instances;
+
+	uint instance_count;
 	MeshHeader* mesh_headers;
 
 	Tri* tris;
@@ -73,8 +75,8 @@ void intersect_bvh(BVHArgs* args)
 
 	float3 org_dir = args->ray->D;
 	float3 org_pos = args->ray->O;
-	args->ray->D = transform((float4)(args->ray->D, 0), args->inverse_transform).xyz;
-	args->ray->O = transform((float4)(args->ray->O, 1), args->inverse_transform).xyz;
+	args->ray->D = transform_affine(args->ray->D, 0.0f, args->inverse_transform);
+	args->ray->O = transform_affine(args->ray->O, 1.0f, args->inverse_transform);
 
 	if (intersect_aabb( args->ray, node ) == 1e30f)
 	{
@@ -157,7 +159,7 @@ int intersect_tlas(BVHArgs* args)
 		{
 			for (uint i = 0; i < node->primitive_count; i++ )
 			{
-				MeshInstanceHeader* instance = &args->world_data->instances[args->tlas_idx[node->left_first + i]];
+				MeshInstanceHeader* instance = &args->instances[args->tlas_idx[node->left_first + i]];
 
 				args->mesh_header = &args->mesh_headers[instance->mesh_idx];
 				args->inverse_transform = instance->inverse_transform;
@@ -218,7 +220,8 @@ typedef struct ExtendArgs
 	uint* trisIdx;
 	uint* rand_seed;
 	MeshHeader* mesh_headers;
-	WorldManagerDeviceData* world_data;
+	MeshInstanceHeader* instances;
+	uint instance_count;
 	BVHNode* tlas_nodes;
 	uint* tlas_idx;
 	PerPixelData* detail_buffer;
@@ -241,7 +244,8 @@ float3 extend(ExtendArgs* args)
 	bvh_args.trisIdx = args->trisIdx;
 	bvh_args.tlas_idx = args->tlas_idx;
 	bvh_args.mesh_headers = args->mesh_headers;
-	bvh_args.world_data = args->world_data;
+	bvh_args.instances = args->instances;
+	bvh_args.instance_count = args->instance_count;
 	bvh_args.blas_hits = 0;
 	bvh_args.tlas_hits = 0;
 
@@ -250,7 +254,7 @@ float3 extend(ExtendArgs* args)
 
     bvh_args.ray = &current_ray;
 
-    if(args->world_data->mesh_count > 0)
+    if(args->instance_count > 0)
     {
         hit_mesh_header_idx = intersect_tlas(&bvh_args);
     }
@@ -281,7 +285,7 @@ float3 extend(ExtendArgs* args)
     else
     {
         args->detail_buffer->normal = (float4)(current_ray.O + current_ray.D * current_ray.t, 0.0f);
-        //MeshInstanceHeader* instance = &(*args->world_data).instances[hit_mesh_header_idx];
+        //MeshInstanceHeader* instance = &args->instances[hit_mesh_header_idx];
         //current_ray.intersection
     }
 	return 0;
@@ -293,7 +297,7 @@ void kernel rt_extend(
 	global uint* trisIdx, 
 	global struct MeshHeader* mesh_headers, 
 	global struct SceneData* scene_data, 
-	global struct WorldManagerDeviceData* world_manager_data, 
+	global struct MeshInstanceHeader* instances, 
 	global BVHNode* tlas_nodes,
 	global uint* tlas_idx,
 	global PerPixelData* detail_buffer,
@@ -319,7 +323,8 @@ void kernel rt_extend(
 	extend_args.trisIdx = trisIdx;
 	extend_args.rand_seed = &rand_seed;
 	extend_args.mesh_headers = mesh_headers;
-	extend_args.world_data = world_manager_data;
+	extend_args.instances = instances;
+	extend_args.instance_count = scene_data->instance_count;
 	extend_args.tlas_nodes = tlas_nodes;
 	extend_args.tlas_idx = tlas_idx;
 	extend_args.detail_buffer = &detail_buffer[pixel_index];
@@ -30,16 +30,27 @@ void kernel rt_finalize(
 	global PerPixelData* detail_buffer
 	)
 {     
-	int x = get_global_id(0);
-	int y = get_global_id(1);	
+	int2 pixel = get_pixel_coordinates();
+	int x = pixel.x;
+	int y = pixel.y;
 	int width = args->width;
 	int height = args->height;
 
+	if(!is_within_bounds(x, y, width, height))
+		return;
+
 	uint pixel_idx = (x + y * width);
 
 	float3 color = 0;
+
+	// Set by the host when specializing, the switch then folds to a single case
+#ifdef VIEW_TYPE
+	ViewType view_type = VIEW_TYPE;
+#else
+	ViewType view_type = args->view_type;
+#endif
 	
-	switch(args->view_type)
+	switch(view_type)
 	{
 		case Render:
 		{
@@ -16,16 +16,24 @@ void kernel rt_generate_rays(
 	global WavefrontData* wavefront_data
 	)
 {     
-	int x = get_global_id(0);
-	int y = get_global_id(1);
+	int2 pixel = get_pixel_coordinates();
+	int x = pixel.x;
+	int y = pixel.y;
 	int width = args->width;
 	int height = args->height;
 
+	if(!is_within_bounds(x, y, width, height))
+		return;
+
 	uint pixel_index = (x + y * width);
 
 	uint rand_seed = WangHash(pixel_index + args->accumulated_frames * width * height);
 
-	float camera_fov = 110.0f;
+#ifdef CAMERA_FOV
+	float camera_fov = CAMERA_FOV;
+#else
+	float camera_fov = args->camera_fov;
+#endif
 	float tan_half_angle = tan(radians(camera_fov * 0.5f));
 	float aspectScale = width * 0.5f;
 	
@@ -2,10 +2,11 @@
 
 typedef struct TextureHeader
 {
-	uint start_offset;
 	uint width;
 	uint height;
-	uint pad;
+	uint level_count;
+	uint format;
+	uint level_tile_offsets[16];
 } TextureHeader;
 
 float3 get_exr_color(float3 direction, float* exr, int2 exr_size, float exr_angle)
@@ -141,7 +142,8 @@ typedef struct ShadeArgs
 	float* exr;
 	int2 exr_size;
 	float exr_angle;
-	WorldManagerDeviceData* world_data;
+	MeshInstanceHeader* instances;
+	uint instance_count;
 	Material* materials;
 	PerPixelData* detail_buffer;
 	unsigned char* textures;
@@ -187,7 +189,7 @@ float3 shade(ShadeArgs* args)
     }
     else
     {
-        MeshInstanceHeader* instance = &(*args->world_data).instances[hit_mesh_header_idx];
+        MeshInstanceHeader* instance = &args->instances[hit_mesh_header_idx];
         MeshHeader* mesh = &args->mesh_headers[instance->mesh_idx];	
         Material mat = args->materials[instance->material_idx];
 
@@ -199,13 +201,8 @@ float3 shade(ShadeArgs* args)
         float2 uvs = interpolate_tri_uvs(vertex_data, &current_ray);
 
         // We have to apply transform so normals are world-space
-
-        float local_inverse_transform_ver[16];
-        copy4x4(instance->inverse_transform, &local_inverse_transform_ver);
-        transpose4x4(&local_inverse_transform_ver);
-
-        normal = transform((float4)(normal, 0.0f), &local_inverse_transform_ver).xyz;
-        geo_normal = transform((float4)(geo_normal, 0.0f), &local_inverse_transform_ver).xyz;
+        normal = transform3x3(normal, instance->normal_transform);
+        geo_normal = transform3x3(geo_normal, instance->normal_transform);
         
         normal = normalize(normal);
         geo_normal = normalize(geo_normal);
@@ -237,41 +234,7 @@ float3 shade(ShadeArgs* args)
         bool is_emissive = mat.albedo.a != 0.0f;
 
         // <Texture Lookup>
-        if(instance->texture_idx != -1)
-        {
-            TextureHeader header = args->texture_headers[instance->texture_idx];
-
-            const uint channels = 4;
-
-            // Get coordinates, float, uint, fractional
-            float texel_xf = uvs.x * header.width;
-            float texel_yf = uvs.y * header.height;
-            uint texel_x_min = floor(texel_xf);
-            uint texel_y_min = floor(texel_yf);
-            float hor_fract = texel_xf - texel_x_min;
-            float ver_fract = texel_yf - texel_y_min;
-
-            // sample texture at 4 spots
-            float3 texels[4];
-            uint top_idx = (texel_x_min + texel_y_min * header.width) * channels;
-            uint bot_idx = (texel_x_min + (texel_y_min + 1) * header.width) * channels;
-            uchar *top_texels = &args->textures[top_idx + header.start_offset];
-            uchar *bot_texels = &args->textures[bot_idx + header.start_offset];
-            texels[0] = (float3)(top_texels[0], top_texels[1], top_texels[2]);
-            texels[1] = (float3)(top_texels[4], top_texels[5], top_texels[6]);
-            texels[2] = (float3)(bot_texels[0], bot_texels[1], bot_texels[2]);
-            texels[3] = (float3)(bot_texels[4], bot_texels[5], bot_texels[6]);
-            
-            // interpolate
-            float3 bilinear_color = lerp(lerp(texels[0], texels[1], hor_fract), lerp(texels[2], texels[3], hor_fract), ver_fract) / 255.0f;
-
-            material_color = bilinear_color;
-
-            if(is_primary_ray)
-            {
-                args->detail_buffer->albedo = (float4)(bilinear_color, 0.0f);
-            }
-        }
+        // Textures are streamed in tiles now, only the megakernel in rt_trace.cl looks them up
         // </Texture Lookup>
 
         if(is_primary_ray)
@@ -399,7 +362,7 @@ void kernel rt_shade(
 	global struct MeshHeader* texture_headers, 
 	global struct SceneData* scene_data, 
 	global float* exr, 
-	global struct WorldManagerDeviceData* world_manager_data, 
+	global struct MeshInstanceHeader* instances, 
 	global struct Material* materials, 
 	global PerPixelData* detail_buffer,	
     global uint* render_buffer,
@@ -452,7 +415,8 @@ void kernel rt_shade(
     shade_args.exr = exr;
     shade_args.exr_size = scene_data->exr_size;
     shade_args.exr_angle = scene_data->exr_angle;
-    shade_args.world_data = world_manager_data;
+    shade_args.instances = instances;
+    shade_args.instance_count = scene_data->instance_count;
     shade_args.materials = materials;
     shade_args.detail_buffer = &detail_buffer[pixel_index];
     shade_args.textures = textures;
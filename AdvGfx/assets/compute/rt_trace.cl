@@ -1,42 +1,284 @@
+// Specialization defines, set by the host per variant. The defaults keep every path alive
+
+#ifndef DEPTH
 #define DEPTH 16
+#endif
+
+// Skips the texture lookup entirely
+#ifndef NO_TEXTURES
+#define NO_TEXTURES 0
+#endif
+
+// Albedo, normal and acceleration structure statistics for the debug views
+#ifndef DEBUG_VIEWS
+#define DEBUG_VIEWS 1
+#endif
+
+// Triangles index into unique vertices, instead of storing every corner. Layout define, it has to match the buffers
+#ifndef INDEXED_GEOMETRY
+#define INDEXED_GEOMETRY 0
+#endif
+
+// Octahedral normals and half precision UVs, 8 bytes per vertex instead of 32. Layout define as well
+#ifndef COMPACT_VERTEX_DATA
+#define COMPACT_VERTEX_DATA 0
+#endif
+
+// Material type shared by every material, -1 if mixed
+#ifndef SINGLE_MATERIAL_TYPE
+#define SINGLE_MATERIAL_TYPE -1
+#endif
+
+#define MAX_TEXTURE_LEVELS 16
+
+// Added to the spread angle of a ray cone for each non-mirror bounce, fully rough surfaces add all of it
+#define RAY_CONE_BOUNCE_SPREAD 0.3f
+
+#define TEXTURE_FORMAT_RGBA8 0
+#define TEXTURE_FORMAT_BC1 1
+#define TEXTURE_FORMAT_BC4 2
+
+// Textures are streamed in tiles of 64x64 texels, the tile table maps a tile to its slot in the pool
+#define TEXTURE_TILE_SIZE 64
+#define TILE_NOT_RESIDENT 0xffffffffu
 
 typedef struct TextureHeader
 {
-	uint start_offset;
 	uint width;
 	uint height;
-	uint pad;
+	uint level_count;
+	uint format;
+	uint level_tile_offsets[MAX_TEXTURE_LEVELS];
 } TextureHeader;
 
-float3 get_exr_color(float3 direction, float* exr, int2 exr_size, float exr_angle, bool include_sun)
-{	
-	float theta = acos(direction.y);
-	float phi = atan2(direction.z, direction.x) + PI;
+typedef struct TextureArgs
+{
+	uchar* tile_pool;
+	TextureHeader* headers;
+	uint* tile_table;
+	uint* feedback;
+	uint frame_number;
+} TextureArgs;
+
+uint get_tile_byte_size(uint format)
+{
+	return format == TEXTURE_FORMAT_RGBA8 ? TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE * 4 : (TEXTURE_TILE_SIZE / 4) * (TEXTURE_TILE_SIZE / 4) * 8;
+}
 
-	float v = theta / PI;
-	float u = phi / (2 * PI);
-	
-	u = wrap_float(u + exr_angle / 360.0f, 0.0f, 1.0f);
+// Stamps the tile as used this frame, the host pages in the ones that aren't resident
+uint lookup_texture_tile(TextureArgs* args, TextureHeader* header, uint level, uint2 tile)
+{
+	uint tiles_x = (max(header->width >> level, 1u) + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+	uint tile_idx = header->level_tile_offsets[level] + tile.x + tile.y * tiles_x;
 
-	uint i = floor(u * (exr_size.x - 1u));
-	uint j = floor(v * (exr_size.y - 1u));
+	// Most lookups hit a tile already stamped, skipping those saves the write
+	if(args->feedback[tile_idx] != args->frame_number)
+		args->feedback[tile_idx] = args->frame_number;
 
-	uint idx = (i + j * exr_size.x);
+	return args->tile_table[tile_idx];
+}
+
+float3 decode_rgb565(uint color)
+{
+	return (float3)((float)((color >> 11) & 31), (float)((color >> 5) & 63), (float)(color & 31)) / (float3)(31.0f, 63.0f, 31.0f);
+}
+
+// Decodes only the texel asked for from its tile, blocks are 8 bytes per 4x4 texels in both formats
+float3 fetch_texel(uchar* tile, uint format, uint x, uint y)
+{
+	if(format == TEXTURE_FORMAT_RGBA8)
+	{
+		uchar* texel = &tile[(x + y * TEXTURE_TILE_SIZE) * 4];
+		return (float3)(texel[0], texel[1], texel[2]) / 255.0f;
+	}
 
-	float4 color = sample_exr(exr, idx * 4u);
+	uchar* block = &tile[((x / 4) + (y / 4) * (TEXTURE_TILE_SIZE / 4)) * 8];
+	uint texel_in_block = (x % 4) + (y % 4) * 4;
 
-	return color.xyz * color.w;
+	if(format == TEXTURE_FORMAT_BC4)
+	{
+		float red0 = block[0];
+		float red1 = block[1];
+
+		ulong indices = 0;
+		for(uint i = 0; i < 6; i++)
+			indices |= (ulong)block[2 + i] << (i * 8);
+
+		uint index = (uint)(indices >> (texel_in_block * 3)) & 7;
+
+		float red;
+		if(index < 2)
+			red = index == 0 ? red0 : red1;
+		else if(red0 > red1)
+			red = ((8 - index) * red0 + (index - 1) * red1) / 7.0f;
+		else
+			red = index >= 6 ? (index == 6 ? 0.0f : 255.0f) : ((6 - index) * red0 + (index - 1) * red1) / 5.0f;
+
+		return (float3)(red / 255.0f);
+	}
+
+	// BC1
+	uint color0 = block[0] | (block[1] << 8);
+	uint color1 = block[2] | (block[3] << 8);
+	uint indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint)block[7] << 24);
+	uint index = (indices >> (texel_in_block * 2)) & 3;
+
+	float3 rgb0 = decode_rgb565(color0);
+	float3 rgb1 = decode_rgb565(color1);
+
+	if(index < 2)
+		return index == 0 ? rgb0 : rgb1;
+
+	if(color0 > color1)
+		return index == 2 ? (2.0f * rgb0 + rgb1) / 3.0f : (rgb0 + 2.0f * rgb1) / 3.0f;
+
+	return index == 2 ? (rgb0 + rgb1) * 0.5f : (float3)(0.0f);
+}
+
+uint wrap_texel(int texel, uint size)
+{
+	int wrapped = texel % (int)size;
+	return (uint)(wrapped < 0 ? wrapped + (int)size : wrapped);
 }
 
-void intersect_tri(Ray* ray, Tri* tris, uint triIdx, MeshHeader* header)
+// The tile a texel is in, a null pointer if it isn't resident
+uchar* get_texel_tile(TextureArgs* args, TextureHeader* header, uint level, uint x, uint y)
 {
-	const float3 edge1 = tris[triIdx].vertex1 - tris[triIdx].vertex0;
-	const float3 edge2 = tris[triIdx].vertex2 - tris[triIdx].vertex0;
+	uint slot = lookup_texture_tile(args, header, level, (uint2)(x / TEXTURE_TILE_SIZE, y / TEXTURE_TILE_SIZE));
+
+	if(slot == TILE_NOT_RESIDENT)
+		return 0;
+
+	return &args->tile_pool[(ulong)slot * get_tile_byte_size(header->format)];
+}
+
+// Bilinear, with repeat addressing. Falls back to coarser levels until the tile is resident, the coarsest always is
+bool sample_texture(TextureArgs* args, TextureHeader* header, uint level, float2 uv, float3* color)
+{
+	uint width, height, center_x, center_y;
+	uchar* center_tile = 0;
+
+	for(; level < header->level_count; level++)
+	{
+		width = max(header->width >> level, 1u);
+		height = max(header->height >> level, 1u);
+		center_x = wrap_texel((int)floor(uv.x * width), width);
+		center_y = wrap_texel((int)floor(uv.y * height), height);
+
+		center_tile = get_texel_tile(args, header, level, center_x, center_y);
+
+		if(center_tile)
+			break;
+	}
+
+	if(!center_tile)
+		return false;
+
+	// Get coordinates, float, int, fractional
+	float texel_xf = uv.x * width - 0.5f;
+	float texel_yf = uv.y * height - 0.5f;
+	float texel_x_floor = floor(texel_xf);
+	float texel_y_floor = floor(texel_yf);
+	float hor_fract = texel_xf - texel_x_floor;
+	float ver_fract = texel_yf - texel_y_floor;
+
+	uint x0 = wrap_texel((int)texel_x_floor, width);
+	uint x1 = wrap_texel((int)texel_x_floor + 1, width);
+	uint y0 = wrap_texel((int)texel_y_floor, height);
+	uint y1 = wrap_texel((int)texel_y_floor + 1, height);
+
+	float3 center_rgb = fetch_texel(center_tile, header->format, center_x % TEXTURE_TILE_SIZE, center_y % TEXTURE_TILE_SIZE);
+
+	// sample texture at 4 spots, texels in neighbouring tiles that aren't resident take the center texel
+	uint2 spots[4] = { (uint2)(x0, y0), (uint2)(x1, y0), (uint2)(x0, y1), (uint2)(x1, y1) };
+	float3 texels_rgb[4];
+
+	for(uint i = 0; i < 4; i++)
+	{
+		uchar* tile = get_texel_tile(args, header, level, spots[i].x, spots[i].y);
+		texels_rgb[i] = tile ? fetch_texel(tile, header->format, spots[i].x % TEXTURE_TILE_SIZE, spots[i].y % TEXTURE_TILE_SIZE) : center_rgb;
+	}
+
+	// interpolate
+	*color = lerp(lerp(texels_rgb[0], texels_rgb[1], hor_fract), lerp(texels_rgb[2], texels_rgb[3], hor_fract), ver_fract);
+	return true;
+}
+
+// Ray cone texture LOD (Akenine-Moller et al. 2019): texel to world area ratio of the triangle, plus the cone's footprint
+// World area is twice the triangle's area, like the uv area below
+float get_texture_lod(TextureHeader* header, float world_area, float2 uv0, float2 uv1, float2 uv2, float cone_width, float cos_incidence)
+{
+	float2 uv_edge1 = uv1 - uv0;
+	float2 uv_edge2 = uv2 - uv0;
+	float texel_area = fabs(uv_edge1.x * uv_edge2.y - uv_edge2.x * uv_edge1.y) * header->width * header->height;
+
+	float triangle_lod = 0.5f * log2(max(texel_area, 1e-12f) / max(world_area, 1e-12f));
+
+	return triangle_lod + log2(max(cone_width, 1e-12f) / max(cos_incidence, 1e-4f));
+}
+
+// Octahedral map with y up, baked on load. Bilinear, clamped at the edges of the map
+float3 get_exr_color(float3 direction, half* exr, int2 exr_size, float2 exr_rotation, bool include_sun)
+{
+	// Rotating around y shifts the longitude by the exr angle
+	float3 d = (float3)(direction.x * exr_rotation.x - direction.z * exr_rotation.y, direction.y, direction.x * exr_rotation.y + direction.z * exr_rotation.x);
+
+	float2 octahedral = d.xz / (fabs(d.x) + fabs(d.y) + fabs(d.z));
+
+	if(d.y < 0.0f)
+		octahedral = (1.0f - fabs(octahedral.yx)) * (float2)(octahedral.x >= 0.0f ? 1.0f : -1.0f, octahedral.y >= 0.0f ? 1.0f : -1.0f);
+
+	float2 texel = (octahedral * 0.5f + 0.5f) * convert_float2(exr_size) - 0.5f;
+	float2 texel_floor = floor(texel);
+	float2 weight = texel - texel_floor;
+
+	int2 t0 = clamp(convert_int2(texel_floor), (int2)(0), exr_size - 1);
+	int2 t1 = clamp(convert_int2(texel_floor) + 1, (int2)(0), exr_size - 1);
+
+	float3 c00 = vload_half3(t0.x + t0.y * exr_size.x, exr);
+	float3 c10 = vload_half3(t1.x + t0.y * exr_size.x, exr);
+	float3 c01 = vload_half3(t0.x + t1.y * exr_size.x, exr);
+	float3 c11 = vload_half3(t1.x + t1.y * exr_size.x, exr);
+
+	return lerp(lerp(c00, c10, weight.x), lerp(c01, c11, weight.x), weight.y);
+}
+
+// Vertex indices of a triangle, relative to the first vertex of its mesh. De-indexed corners are laid out per triangle
+uint3 get_tri_vertex_idxs(uint* tri_indices, MeshHeader* header, uint triIdx)
+{
+#if INDEXED_GEOMETRY
+	uint* idxs = &tri_indices[(header->tris_offset + triIdx) * 3];
+	return (uint3)(idxs[0], idxs[1], idxs[2]);
+#else
+	return (uint3)(triIdx * 3, triIdx * 3 + 1, triIdx * 3 + 2);
+#endif
+}
+
+Tri get_tri(Tri* tris, float4* vertex_positions, uint* tri_indices, MeshHeader* header, uint triIdx)
+{
+#if INDEXED_GEOMETRY
+	uint3 idxs = get_tri_vertex_idxs(tri_indices, header, triIdx);
+	float4* positions = &vertex_positions[header->vertex_data_offset];
+
+	Tri tri;
+	tri.vertex0 = positions[idxs.x].xyz;
+	tri.vertex1 = positions[idxs.y].xyz;
+	tri.vertex2 = positions[idxs.z].xyz;
+	return tri;
+#else
+	return tris[header->tris_offset + triIdx];
+#endif
+}
+
+void intersect_tri(Ray* ray, Tri* tri, uint triIdx)
+{
+	const float3 edge1 = tri->vertex1 - tri->vertex0;
+	const float3 edge2 = tri->vertex2 - tri->vertex0;
 	const float3 h = cross( ray->D, edge2 );
 	const float a = dot( edge1, h );
 	if (fabs(a) < EPSILON) return; // ray parallel to triangle
 	const float f = 1 / a;
-	const float3 s = ray->O - tris[triIdx].vertex0;
+	const float3 s = ray->O - tri->vertex0;
 	const float u = f * dot( s, h );
 	if (u < 0 || u > 1) return;
 	const float3 q = cross( s, edge1 );
@@ -75,10 +317,14 @@ typedef struct BVHArgs
 	BVHNode* blas_nodes;
 	BVHNode* tlas_nodes;
 
-	WorldManagerDeviceData* world_data;
+	MeshInstanceHeader* instances;
+
+	uint instance_count;
 	MeshHeader* mesh_headers;
 
 	Tri* tris;
+	float4* vertex_positions;
+	uint* tri_indices;
 	uint* trisIdx;
 
 	MeshHeader* mesh_header;
@@ -101,8 +347,8 @@ void intersect_bvh(BVHArgs* args)
 
 	float3 org_dir = args->ray->D;
 	float3 org_pos = args->ray->O;
-	args->ray->D = transform((float4)(args->ray->D, 0), args->inverse_transform).xyz;
-	args->ray->O = transform((float4)(args->ray->O, 1), args->inverse_transform).xyz;
+	args->ray->D = transform_affine(args->ray->D, 0.0f, args->inverse_transform);
+	args->ray->O = transform_affine(args->ray->O, 1.0f, args->inverse_transform);
 
 	if (intersect_aabb( args->ray, node ) == 1e30f)
 	{
@@ -118,7 +364,12 @@ void intersect_bvh(BVHArgs* args)
 		if(node->primitive_count > 0)
 		{
 			for (uint i = 0; i < node->primitive_count; i++ )
-				intersect_tri( args->ray, &args->tris[args->mesh_header->tris_offset], args->trisIdx[node->left_first + i + args->mesh_header->tri_idx_offset], args->mesh_header);
+			{
+				uint tri_idx = args->trisIdx[node->left_first + i + args->mesh_header->tri_idx_offset];
+				Tri tri = get_tri(args->tris, args->vertex_positions, args->tri_indices, args->mesh_header, tri_idx);
+
+				intersect_tri(args->ray, &tri, tri_idx);
+			}
 
 			if(stack_ptr == 0)
 				break;
@@ -175,32 +426,71 @@ float beers_law(float thickness, float absorption_coefficient)
 	return pow(EULER, -absorption_coefficient * thickness);
 }
 
-float3 interpolate_tri_normal(VertexData* vertex_data, struct Ray* ray)
+typedef struct CompactVertexData
+{
+	uint normal;
+	uint uv;
+} CompactVertexData;
+
+#if COMPACT_VERTEX_DATA
+typedef CompactVertexData ShadingVertexData;
+#else
+typedef VertexData ShadingVertexData;
+#endif
+
+// Two snorm16 on the octahedron, the lower half is folded over the upper one
+float3 decode_octahedral_normal(uint packed)
+{
+	float2 octahedral = max((float2)((float)(short)(packed & 0xffffu), (float)(short)(packed >> 16)) / 32767.0f, -1.0f);
+	float3 normal = (float3)(octahedral, 1.0f - fabs(octahedral.x) - fabs(octahedral.y));
+
+	float fold = max(-normal.z, 0.0f);
+	normal.x += normal.x >= 0.0f ? -fold : fold;
+	normal.y += normal.y >= 0.0f ? -fold : fold;
+
+	return normalize(normal);
+}
+
+float3 get_vertex_normal(ShadingVertexData* vertex)
+{
+#if COMPACT_VERTEX_DATA
+	return decode_octahedral_normal(vertex->normal);
+#else
+	return vertex->normal;
+#endif
+}
+
+float2 get_vertex_uv(ShadingVertexData* vertex)
+{
+#if COMPACT_VERTEX_DATA
+	return vload_half2(0, (half*)&vertex->uv);
+#else
+	return vertex->uv;
+#endif
+}
+
+float3 interpolate_tri_normal(ShadingVertexData* vertex_data, uint3 idxs, struct Ray* ray)
 {
 	float u = ray->u;
 	float v = ray->v;
 	float w = 1.0f - u - v;
 
-	uint idx = ray->tri_hit * 3;
-
-	float3 v0_normal = vertex_data[idx + 0].normal * w;
-	float3 v1_normal = vertex_data[idx + 1].normal * u;
-	float3 v2_normal = vertex_data[idx + 2].normal * v;
+	float3 v0_normal = get_vertex_normal(&vertex_data[idxs.x]) * w;
+	float3 v1_normal = get_vertex_normal(&vertex_data[idxs.y]) * u;
+	float3 v2_normal = get_vertex_normal(&vertex_data[idxs.z]) * v;
 
 	return normalize(v0_normal + v1_normal + v2_normal);
 }
 
-float2 interpolate_tri_uvs(VertexData* vertex_data, struct Ray* ray)
+float2 interpolate_tri_uvs(ShadingVertexData* vertex_data, uint3 idxs, struct Ray* ray)
 {
 	float u = ray->u;
 	float v = ray->v;
 	float w = 1.0f - u - v;
 
-	uint idx = ray->tri_hit * 3;
-
-	float2 v0_uv = vertex_data[idx + 0].uv * w;
-	float2 v1_uv = vertex_data[idx + 1].uv * u;
-	float2 v2_uv = vertex_data[idx + 2].uv * v;
+	float2 v0_uv = get_vertex_uv(&vertex_data[idxs.x]) * w;
+	float2 v1_uv = get_vertex_uv(&vertex_data[idxs.y]) * u;
+	float2 v2_uv = get_vertex_uv(&vertex_data[idxs.z]) * v;
 
 	return (v0_uv + v1_uv + v2_uv);
 }
@@ -228,21 +518,25 @@ typedef struct TraceArgs
 {
 	Ray* primary_ray;
 	BVHNode* blas_nodes;
-	VertexData* vertex_data;
+	ShadingVertexData* vertex_data;
 	Tri* tris;
+	float4* vertex_positions;
+	uint* tri_indices;
 	uint* trisIdx;
 	uint* rand_seed;
 	MeshHeader* mesh_headers;
-	TextureHeader* texture_headers;
-	float* exr;
+	TextureArgs textures;
+	half* exr;
 	int2 exr_size;
-	float exr_angle;
-	WorldManagerDeviceData* world_data;
+	float2 exr_rotation;
+	float pixel_spread_angle;
+	float texture_lod_bias;
+	MeshInstanceHeader* instances;
+	uint instance_count;
 	Material* materials;
 	BVHNode* tlas_nodes;
 	uint* tlas_idx;
 	PerPixelData* detail_buffer;
-	unsigned char* textures;
 } TraceArgs;
 
 float4 malleys_method(uint* rand_seed)
@@ -309,7 +603,7 @@ int intersect_tlas(BVHArgs* args)
 		{
 			for (uint i = 0; i < node->primitive_count; i++ )
 			{
-				MeshInstanceHeader* instance = &args->world_data->instances[args->tlas_idx[node->left_first + i]];
+				MeshInstanceHeader* instance = &args->instances[args->tlas_idx[node->left_first + i]];
 
 				args->mesh_header = &args->mesh_headers[instance->mesh_idx];
 				args->inverse_transform = instance->inverse_transform;
@@ -376,16 +670,23 @@ float3 trace(TraceArgs* args)
 	bvh_args.blas_nodes = args->blas_nodes;
 	bvh_args.tlas_nodes = args->tlas_nodes;
 	bvh_args.tris = args->tris;
+	bvh_args.vertex_positions = args->vertex_positions;
+	bvh_args.tri_indices = args->tri_indices;
 	bvh_args.trisIdx = args->trisIdx;
 	bvh_args.tlas_idx = args->tlas_idx;
 	bvh_args.mesh_headers = args->mesh_headers;
-	bvh_args.world_data = args->world_data;
+	bvh_args.instances = args->instances;
+	bvh_args.instance_count = args->instance_count;
 	bvh_args.blas_hits = 0;
 	bvh_args.tlas_hits = 0;
 
 	float3 e = 0;
 	float3 t = 1;
 
+	// Ray cone used for texture LOD, widening with distance and with every rough bounce
+	float cone_width = 0.0f;
+	float cone_spread = args->pixel_spread_angle;
+
 	while(depth > 0)
 	{
 		// Go through ray stack, return if empty
@@ -399,7 +700,7 @@ float3 trace(TraceArgs* args)
 
 		bvh_args.ray = &current_ray;
 
-		if(args->world_data->mesh_count > 0)
+		if(args->instance_count > 0)
 		{
 			hit_mesh_header_idx = intersect_tlas(&bvh_args);
 		}
@@ -409,18 +710,20 @@ float3 trace(TraceArgs* args)
 		if(is_primary_ray)
 		{
 			args->primary_ray->t = current_ray.t;
-			args->detail_buffer->tlas_hits = bvh_args.tlas_hits;
-			args->detail_buffer->blas_hits = bvh_args.blas_hits;
 			args->detail_buffer->hit_object = hit_mesh_header_idx;
 			args->detail_buffer->hit_position = (float4)(current_ray.O + current_ray.D * current_ray.t, 0.0f);
+#if DEBUG_VIEWS
+			args->detail_buffer->tlas_hits = bvh_args.tlas_hits;
+			args->detail_buffer->blas_hits = bvh_args.blas_hits;
 			args->detail_buffer->normal = (float4)(-current_ray.D, 0.0f);
+#endif
 		}
 		
 		bool hit_anything = current_ray.t < 1e30;
 
 		if(!hit_anything)
 		{
-			float3 exr_color = get_exr_color(current_ray.D, args->exr, args->exr_size, args->exr_angle, is_primary_ray);
+			float3 exr_color = get_exr_color(current_ray.D, args->exr, args->exr_size, args->exr_rotation, is_primary_ray);
 
 			// Slighly Biased way to get rid of fireflies
 			float sqr_length = dot(exr_color, exr_color);
@@ -428,35 +731,35 @@ float3 trace(TraceArgs* args)
 			exr_color = (sqr_length < light_limit ? exr_color : normalize(exr_color) * light_limit);
 
 
+#if DEBUG_VIEWS
 			if(is_primary_ray)
 			{
 				args->detail_buffer->albedo = (float4)(exr_color, 0.0f);
 			}
+#endif
 
 			return t * exr_color;
 		}
 		else
 		{
-			MeshInstanceHeader* instance = &(*args->world_data).instances[hit_mesh_header_idx];
+			MeshInstanceHeader* instance = &args->instances[hit_mesh_header_idx];
 			MeshHeader* mesh = &args->mesh_headers[instance->mesh_idx];	
 			Material mat = args->materials[instance->material_idx];
 
-			VertexData* vertex_data = &args->vertex_data[mesh->vertex_data_offset];
+			ShadingVertexData* vertex_data = &args->vertex_data[mesh->vertex_data_offset];
+			uint3 vertex_idxs = get_tri_vertex_idxs(args->tri_indices, mesh, current_ray.tri_hit);
+
+			float hit_cone_width = cone_width + cone_spread * current_ray.t;
 
 			float3 hit_pos = current_ray.O + (current_ray.D * current_ray.t);
-			float3 normal = interpolate_tri_normal(vertex_data, &current_ray);
+			float3 normal = interpolate_tri_normal(vertex_data, vertex_idxs, &current_ray);
 			float3 geo_normal = current_ray.geo_normal;
-			float2 uvs = interpolate_tri_uvs(vertex_data, &current_ray);
+			float2 uvs = interpolate_tri_uvs(vertex_data, vertex_idxs, &current_ray);
 
 
 			// We have to apply transform so normals are world-space
-
-			float local_inverse_transform_ver[16];
-			copy4x4(instance->inverse_transform, &local_inverse_transform_ver);
-			transpose4x4(&local_inverse_transform_ver);
-
-			normal = transform((float4)(normal, 0.0f), &local_inverse_transform_ver).xyz;
-			geo_normal = transform((float4)(geo_normal, 0.0f), &local_inverse_transform_ver).xyz;
+			normal = transform3x3(normal, instance->normal_transform);
+			geo_normal = transform3x3(geo_normal, instance->normal_transform);
 			
 			normal = normalize(normal);
 			geo_normal = normalize(geo_normal);
@@ -468,10 +771,12 @@ float3 trace(TraceArgs* args)
 			if(inner_normal)
 				normal = -normal;
 
+#if DEBUG_VIEWS
 			if(is_primary_ray)
 			{
 				args->detail_buffer->normal = (float4)(normal, 0.0f);
 			}
+#endif
 
 			hemisphere_normal = tangent_to_base_vector(hemisphere_normal, normal);
 
@@ -488,47 +793,39 @@ float3 trace(TraceArgs* args)
 			bool is_emissive = mat.albedo.a != 0.0f;
 
 			// <Texture Lookup>
+#if !NO_TEXTURES
 			if(instance->texture_idx != -1)
 			{
-				TextureHeader header = args->texture_headers[instance->texture_idx];
-
-				const uint channels = 4;
-
-				// Get coordinates, float, uint, fractional
-				float texel_xf = uvs.x * header.width;
-				float texel_yf = uvs.y * header.height;
-				uint texel_x_min = floor(texel_xf);
-				uint texel_y_min = floor(texel_yf);
-				float hor_fract = texel_xf - texel_x_min;
-				float ver_fract = texel_yf - texel_y_min;
-
-				// sample texture at 4 spots
-				float3 texels[4];
-				uint top_idx = (texel_x_min + texel_y_min * header.width) * channels;
-				uint bot_idx = (texel_x_min + (texel_y_min + 1) * header.width) * channels;
-				uchar *top_texels = &args->textures[top_idx + header.start_offset];
-				uchar *bot_texels = &args->textures[bot_idx + header.start_offset];
-				texels[0] = (float3)(top_texels[0], top_texels[1], top_texels[2]);
-				texels[1] = (float3)(top_texels[4], top_texels[5], top_texels[6]);
-				texels[2] = (float3)(bot_texels[0], bot_texels[1], bot_texels[2]);
-				texels[3] = (float3)(bot_texels[4], bot_texels[5], bot_texels[6]);
-				
-				// interpolate
-				float3 bilinear_color = lerp(lerp(texels[0], texels[1], hor_fract), lerp(texels[2], texels[3], hor_fract), ver_fract) / 255.0f;
-
-				material_color = bilinear_color;
-
-				if(is_primary_ray)
-				{
-					args->detail_buffer->albedo = (float4)(bilinear_color, 0.0f);
-				}
+				TextureHeader* header = &args->textures.headers[instance->texture_idx];
+
+				Tri tri = get_tri(args->tris, args->vertex_positions, args->tri_indices, mesh, current_ray.tri_hit);
+				// The cross product of transformed edges is the normal transform of their cross product, scaled by the determinant
+				float3 object_cross = cross(tri.vertex1 - tri.vertex0, tri.vertex2 - tri.vertex0);
+				float world_area = fabs(instance->determinant) * length(transform3x3(object_cross, instance->normal_transform));
+
+				float lod = get_texture_lod(header, world_area,
+					get_vertex_uv(&vertex_data[vertex_idxs.x]), get_vertex_uv(&vertex_data[vertex_idxs.y]), get_vertex_uv(&vertex_data[vertex_idxs.z]),
+					hit_cone_width, fabs(dot(normal, current_ray.D))) + args->texture_lod_bias;
+
+				// Picking either neighbouring level by the fraction averages out to trilinear filtering over the accumulated frames
+				lod = clamp(lod, 0.0f, (float)(header->level_count - 1));
+				uint level = (uint)lod;
+				level = min(level + (RandomFloat(args->rand_seed) < lod - level ? 1u : 0u), header->level_count - 1);
+
+				// Keeps the material color only if not even the coarsest tile is resident yet
+				float3 texture_color;
+				if(sample_texture(&args->textures, header, level, uvs, &texture_color))
+					material_color = texture_color;
 			}
+#endif
 			// </Texture Lookup>
 
+#if DEBUG_VIEWS
 			if(is_primary_ray)
 			{
 				args->detail_buffer->albedo = (float4)(material_color, 0.0f);
 			}
+#endif
 			// Add in emission late as to not taint the albedo buffer
 			material_color *=  (mat.albedo.a + 1.0f);
 
@@ -544,7 +841,24 @@ float3 trace(TraceArgs* args)
 			}
 			// </Russian roulette>
 
-			switch(mat.type)
+#if SINGLE_MATERIAL_TYPE >= 0
+			// Constant, so the compiler drops the other cases
+			MaterialType material_type = SINGLE_MATERIAL_TYPE;
+#else
+			MaterialType material_type = mat.type;
+#endif
+
+			// Mirrors and glass keep the cone as is, rougher surfaces spread it
+			float bounce_roughness = 0.0f;
+			if(material_type == Diffuse || material_type == Metal)
+				bounce_roughness = 1.0f - mat.specularity;
+			else if(material_type == CookTorranceBRDF)
+				bounce_roughness = mat.roughness;
+
+			cone_width = hit_cone_width;
+			cone_spread += bounce_roughness * RAY_CONE_BOUNCE_SPREAD;
+
+			switch(material_type)
 			{
 				case Diffuse:
 				{
@@ -708,16 +1022,20 @@ void kernel rt_trace(
 	global uint* render_buffer, 
 	global int* mouse, 
 	global float* distance,
-	global VertexData* vertex_data, 
+	global ShadingVertexData* vertex_data, 
 	global struct Tri* tris, 
+	global float4* vertex_positions,
+	global uint* tri_indices,
 	global struct BVHNode* blas_nodes, 
 	global uint* trisIdx, 
 	global struct MeshHeader* mesh_headers, 
 	global unsigned char* textures,
-	global struct MeshHeader* texture_headers, 
+	global struct TextureHeader* texture_headers, 
+	global uint* texture_tile_table,
+	global uint* texture_feedback,
 	global struct SceneData* scene_data, 
-	global float* exr, 
-	global struct WorldManagerDeviceData* world_manager_data, 
+	global half* exr, 
+	global struct MeshInstanceHeader* instances, 
 	global struct Material* materials, 
 	global BVHNode* tlas_nodes,
 	global uint* tlas_idx,
@@ -729,8 +1047,12 @@ void kernel rt_trace(
 	uint height = scene_data->resolution.y;
 	float aspect_ratio = (float)(width) / (float)(height);
 
-	int x = get_global_id(0);
-	int y = get_global_id(1);
+	int2 pixel = get_pixel_coordinates();
+	int x = pixel.x;
+	int y = pixel.y;
+
+	if(!is_within_bounds(x, y, width, height))
+		return;
 
 	uint pixel_index = (x + y * width);
 
@@ -744,19 +1066,27 @@ void kernel rt_trace(
 	trace_args.blas_nodes = blas_nodes;
 	trace_args.vertex_data = vertex_data;
 	trace_args.tris = tris;
+	trace_args.vertex_positions = vertex_positions;
+	trace_args.tri_indices = tri_indices;
 	trace_args.trisIdx = trisIdx;
 	trace_args.rand_seed = &rand_seed;
 	trace_args.mesh_headers = mesh_headers;
 	trace_args.exr = exr;
 	trace_args.exr_size = scene_data->exr_size;
-	trace_args.exr_angle = scene_data->exr_angle;
-	trace_args.world_data = world_manager_data;
+	trace_args.exr_rotation = (float2)(cos(radians(scene_data->exr_angle)), sin(radians(scene_data->exr_angle)));
+	trace_args.pixel_spread_angle = scene_data->pixel_spread_angle;
+	trace_args.texture_lod_bias = scene_data->texture_lod_bias;
+	trace_args.instances = instances;
+	trace_args.instance_count = scene_data->instance_count;
 	trace_args.materials = materials;
 	trace_args.tlas_nodes = tlas_nodes;
 	trace_args.tlas_idx = tlas_idx;
 	trace_args.detail_buffer = &detail_buffer[pixel_index];
-	trace_args.textures = textures;
-	trace_args.texture_headers = texture_headers;
+	trace_args.textures.tile_pool = textures;
+	trace_args.textures.headers = texture_headers;
+	trace_args.textures.tile_table = texture_tile_table;
+	trace_args.textures.feedback = texture_feedback;
+	trace_args.textures.frame_number = scene_data->frame_number;
 
 	float3 color = trace(&trace_args);
 
@@ -0,0 +1,7 @@
+// Merges the copy one device of a split dispatch wrote into the buffer of the primary device, element by element
+void kernel split_merge(global uint* destination, global const uint* source)
+{
+	uint i = get_global_id(0);
+
+	destination[i] = max(destination[i], source[i]);
+}
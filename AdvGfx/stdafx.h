@@ -46,17 +46,6 @@
 
 #include "Math.h"
 
-#define TINYGLTF_NOEXCEPTION
-//#define TINYGLTF_NO_STB_IMAGE
-//#define TINYGLTF_NO_STB_IMAGE_WRITE
-//#define TINYGLTF_NO_EXTERNAL_IMAGE
-#define TINYGLTF_NO_INCLUDE_JSON
-#define TINYGLTF_NO_INCLUDE_RAPIDJSON
-#define TINYGLTF_NO_INCLUDE_STB_IMAGE
-#define TINYGLTF_NO_INCLUDE_STB_IMAGE_WRITE
-#define TINYGLTF_USE_CPP14
 #include "json.hpp"
 #include <stb_image.h>
 #include <stb_image_write.h>
-
-#include "tiny_gltf.h"